@@ -1,6 +1,8 @@
 #include "RedisProxy.h"
 #include "socketchat.h"
+#include "EventLoop.h"
 #include "SimpleBuffer.h"
+#include "RespParser.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +10,7 @@
 #include <assert.h>
 #include <vector>
 #include <string>
+#include <mutex>
 // intercepts all messages to and from Redis so we can log them
 #ifdef _MSC_VER
 #pragma warning(disable:4100)
@@ -23,6 +26,7 @@ namespace redisproxy
 
     static FILE *gClientCommands = nullptr; 
     static FILE *gRedisCommands = nullptr;
+    static std::mutex gLogFileMutex;
 
 
     typedef std::vector< std::string > StringVector;
@@ -33,6 +37,7 @@ namespace redisproxy
         RedisProxyMonitor(void)
         {
 #if 1
+            std::lock_guard<std::mutex> lock(gLogFileMutex); // monitors are created on every worker thread
             if (gClientCommands == nullptr)
             {
                 gClientCommands = fopen("f:\\clientcommands.txt", "wb");
@@ -48,6 +53,7 @@ namespace redisproxy
 
         virtual ~RedisProxyMonitor(void)
         {
+            setEventLoop(nullptr, nullptr);
             delete mSocketChat;
             if (mResponseBuffer)
             {
@@ -78,6 +84,7 @@ namespace redisproxy
             if (mSocketChat)
             {
                 mSocketChat->sendText(message);
+                scheduleFlush();
             }
 
             return ret;
@@ -130,31 +137,43 @@ namespace redisproxy
             if (mSocketChat)
             {
                 mSocketChat->sendBinary(data, dataLen);
+                scheduleFlush();
             }
 
             return ret;
         }
 
+        // Forward the frame to redis as the same sequence of lines a client would have sent
+        virtual bool fromClient(const respparser::RespElement *elements, uint32_t elementCount) override final
+        {
+            if (elementCount && elements[0].mType == respparser::RespType::ARRAY)
+            {
+                elements++;
+                elementCount--;
+            }
+            char scratch[32];
+            snprintf(scratch, sizeof(scratch), "*%u", elementCount);
+            fromClient(scratch);
+            for (uint32_t i = 0; i < elementCount; i++)
+            {
+                snprintf(scratch, sizeof(scratch), "$%u", elements[i].mLength);
+                fromClient(scratch);
+                fromClient(elements[i].mData, elements[i].mLength);
+            }
+            return true;
+        }
+
         virtual void getToClient(Callback *c) override final
         {
             if (!mSocketChat) return;
             mSocketChat->poll(this, 0);
             uint32_t streamLen;
-            const uint8_t *scan = mResponseBuffer->getData(streamLen);	// Get the raw stream of responses
+            const uint8_t *stream = mResponseBuffer->getData(streamLen);	// Every reply line from redis, as received
             if (streamLen)
             {
-                const uint8_t *eof = &scan[streamLen];	// This is the end of the data stream
-                while (scan < eof)
-                {
-                    const uint32_t *header = (const uint32_t *)scan;	// Get the header
-                    uint32_t stringLen = header[0];				// Get the length of the API string (JSON response)
-                    const uint8_t *msg = (const uint8_t *)&header[1];
-                    c->receiveRedisMessage(msg, stringLen);
-                    scan += (stringLen + sizeof(uint32_t));	// Advance to the next response
-                }
+                c->receiveRedisResponse(stream, streamLen);
                 mResponseBuffer->clear();	// Zero out the response buffer now that we have processed all responses
             }
-
         }
 
         virtual void release(void) override final
@@ -162,6 +181,35 @@ namespace redisproxy
             delete this;
         }
 
+        // Redis replies wake our owner directly, which then calls 'getToClient' to forward them
+        virtual void setEventLoop(eventloop::EventLoop *loop, eventloop::EventLoopCallback *owner) override final
+        {
+            if (mEventLoop && mSocketChat)
+            {
+                mEventLoop->removeSocket(mSocketChat->getSocket());
+            }
+            mEventLoop = loop;
+            mEventOwner = owner;
+            if (mEventLoop && mSocketChat && owner)
+            {
+                mEventLoop->addSocket(mSocketChat->getSocket(), owner);
+            }
+        }
+
+        // Replies from redis are forwarded as they are, so none is ever built up here
+        virtual void setStreamCallback(Callback *c) override final
+        {
+        }
+
+        // The forwarded message only reaches redis when our owner next calls 'getToClient'
+        void scheduleFlush(void)
+        {
+            if (mEventLoop && mEventOwner)
+            {
+                mEventLoop->schedule(mEventOwner);
+            }
+        }
+
         virtual void receiveMessage(const char *data) override final
         {
             if (gRedisCommands)
@@ -170,22 +218,23 @@ namespace redisproxy
                 fprintf(gRedisCommands, "\r\n");
                 fflush(gRedisCommands);
             }
-            uint32_t slen = uint32_t(strlen(data));
-            uint8_t *dest = mResponseBuffer->confirmCapacity(slen + sizeof(slen));
-            uint32_t *dlen = (uint32_t *)dest;
-            *dlen = slen;
-            memcpy(dest + 4, data, slen);
-            mResponseBuffer->addBuffer(nullptr, slen + sizeof(slen));
+            addResponseLine(data, uint32_t(strlen(data)));
+        }
+
+        // Forward a line exactly as redis sent it, restoring the CR/LF the line was split on
+        void addResponseLine(const void *data, uint32_t dataLen)
+        {
+            uint8_t *dest = mResponseBuffer->confirmCapacity(dataLen + 2);
+            memcpy(dest, data, dataLen);
+            dest[dataLen] = '\r';
+            dest[dataLen + 1] = '\n';
+            mResponseBuffer->addBuffer(nullptr, dataLen + 2);
         }
 
         // if the data stream has non ASCII data in it
         virtual void receiveBinaryMessage(const void *data, uint32_t dataLen) override final
         {
-            uint8_t *dest = mResponseBuffer->confirmCapacity(dataLen + sizeof(dataLen));
-            uint32_t *dlen = (uint32_t *)dest;
-            *dlen = dataLen;
-            memcpy(dest + 4, data, dataLen);
-            mResponseBuffer->addBuffer(nullptr, dataLen + sizeof(dataLen));
+            addResponseLine(data, dataLen);
             if (gRedisCommands)
             {
                 fprintf(gRedisCommands, "[Server]");
@@ -210,6 +259,8 @@ namespace redisproxy
 
         socketchat::SocketChat                  *mSocketChat{ nullptr };
         simplebuffer::SimpleBuffer              *mResponseBuffer{ nullptr };
+        eventloop::EventLoop                    *mEventLoop{ nullptr };
+        eventloop::EventLoopCallback            *mEventOwner{ nullptr };
     };
 
 RedisProxy *RedisProxy::createMonitor(void)
@@ -3,8 +3,10 @@
 #include "StringId.h"			// Helper class to made a string to an id/enum and back very quickly
 #include "SimpleBuffer.h"
 #include "RedisCommandStream.h"
+#include "RespParser.h"
 #include "KeyValueDatabase.h"
 #include "ObjectPool.h"
+#include "EventLoop.h"
 #include "wplatform.h"
 
 #include <assert.h>
@@ -12,18 +14,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <cmath>
 
 #include <vector>
 #include <string>
+#include <atomic>
 
 #ifdef _MSC_VER
 #pragma warning(disable:4100 4456 4189)
 #endif
 
 #define USE_LOG_FILE 1
+#define LOG_CLIENT_TRAFFIC 0    // Echo every client command on the console; stdout is a lock shared by every worker thread
 
 #define MAX_COMMAND_STRING (1024*4) // 4k
 #define MAX_TOTAL_MEMORY (1024*1024)*1024	// 1gb
+#define STREAM_CHUNK_SIZE (64*1024) // A reply being streamed is sent on whenever this much has been written
 
 typedef std::vector< std::string > StringVector;
 
@@ -52,28 +60,44 @@ namespace redisproxy
                 mDatabase = keyvaluedatabase::KeyValueDatabase::create(keyvaluedatabase::KeyValueDatabase::REDIS);
                 mMyDatabase = true;
             }
-            static uint32_t gCount = 0;
-            gCount++;
-            mInstanceId = gCount;
+            static std::atomic<uint32_t> gCount{ 0 }; // proxies are created on every worker thread
+            mInstanceId = ++gCount;
             printf("RedisProxy[%d]\n", mInstanceId);
             mResponseBuffer = simplebuffer::SimpleBuffer::create(MAX_COMMAND_STRING, MAX_TOTAL_MEMORY);
+            mHeldResponses = simplebuffer::SimpleBuffer::create(MAX_COMMAND_STRING, MAX_TOTAL_MEMORY);
             mMultiBuffer = simplebuffer::SimpleBuffer::create(MAX_COMMAND_STRING, MAX_TOTAL_MEMORY);
             mCommandStream = rediscommandstream::RedisCommandStream::create();
+            mInputBuffer = simplebuffer::SimpleBuffer::create(MAX_COMMAND_STRING, MAX_TOTAL_MEMORY);
+            mInputParser = respparser::RespParser::create();
+            mMultiParser = respparser::RespParser::create();
 #if USE_LOG_FILE
-            static uint32_t gLogCount = 0;
-            gLogCount++;
+            static std::atomic<uint32_t> gLogCount{ 0 };
+            uint32_t logIndex = ++gLogCount;
             char scratch[512];
-            snprintf(scratch, 512, "f:\\RedisProxy%d.txt", gLogCount);
+            snprintf(scratch, 512, "f:\\RedisProxy%d.txt", logIndex);
             mLogFile = fopen(scratch, "wb");
 #endif
         }
 
         virtual ~RedisProxyImpl(void)
         {
+            // The database may be shared with other clients and outlive us
+            if (mDatabase && !mMyDatabase)
+            {
+                mDatabase->cancelCallbacks(this);
+                for (RedisScanPool::Iterator i = mScanPool.Begin(); i; ++i)
+                {
+                    mDatabase->cancelCallbacks(&(*i));
+                }
+            }
             if (mResponseBuffer)
             {
                 mResponseBuffer->release();
             }
+            if (mHeldResponses)
+            {
+                mHeldResponses->release();
+            }
             if (mMultiBuffer)
             {
                 mMultiBuffer->release();
@@ -82,6 +106,18 @@ namespace redisproxy
             {
                 mCommandStream->release();
             }
+            if (mInputBuffer)
+            {
+                mInputBuffer->release();
+            }
+            if (mInputParser)
+            {
+                mInputParser->release();
+            }
+            if (mMultiParser)
+            {
+                mMultiParser->release();
+            }
             if (mMyDatabase && mDatabase)
             {
                 mDatabase->release();
@@ -94,34 +130,260 @@ namespace redisproxy
 #endif
         }
 
-        void redisPush(uint32_t argc)
+        // An integer argument; false (with an error sent) if it is not one
+        bool getIntegerArgument(uint32_t index, int64_t &value)
         {
-            if (argc == 2)
+            rediscommandstream::RedisAttribute atr;
+            uint32_t dataLen;
+            const char *str = mCommandStream->getAttribute(index, atr, dataLen);
+            char *end = nullptr;
+            if (str && dataLen)
+            {
+                errno = 0;
+                value = strtoll(str, &end, 10);
+            }
+            if (end == nullptr || end != (str + dataLen) || errno == ERANGE)
+            {
+                addResponse("-ERR value is not an integer or out of range");
+                return false;
+            }
+            return true;
+        }
+
+        // A floating point argument; false (with an error sent) if it is not one
+        bool getFloatArgument(uint32_t index, long double &value)
+        {
+            rediscommandstream::RedisAttribute atr;
+            uint32_t dataLen;
+            const char *str = mCommandStream->getAttribute(index, atr, dataLen);
+            char *end = nullptr;
+            if (str && dataLen && !isspace(uint8_t(str[0])))
+            {
+                errno = 0;
+                value = strtold(str, &end);
+            }
+            if (end == nullptr || end != (str + dataLen) || errno == ERANGE || std::isnan(value))
+            {
+                addResponse("-ERR value is not a valid float");
+                return false;
+            }
+            return true;
+        }
+
+        void wrongType(void)
+        {
+            addResponse("-WRONGTYPE Operation against a key holding the wrong kind of value");
+        }
+
+        // LPUSH/RPUSH key value [value ...]
+        void listPush(uint32_t argc, bool toHead)
+        {
+            if (argc >= 2)
             {
                 rediscommandstream::RedisAttribute atr;
                 uint32_t dataLen;
                 const char *key = mCommandStream->getAttribute(0, atr, dataLen);
-                if (key )
+                uint32_t valueCount = argc - 1;
+                mListValues.resize(valueCount);
+                mListValueLengths.resize(valueCount);
+                for (uint32_t i = 0; i < valueCount; i++)
+                {
+                    mListValues[i] = mCommandStream->getAttribute(i + 1, atr, mListValueLengths[i]);
+                }
+                expectReply();
+                mDatabase->push(mDb, key, toHead, valueCount, &mListValues[0], &mListValueLengths[0], this, [](bool isOk,int64_t listCount, void *userPointer)
                 {
-                    const char *value = mCommandStream->getAttribute(1, atr, dataLen);
+                    RedisProxyImpl *r = (RedisProxyImpl *)userPointer;
+                    r->beginReply();
+                    if (listCount >= 0)
+                    {
+                        r->addResponse(":%lld", (long long)listCount);
+                    }
+                    else
+                    {
+                        r->wrongType();
+                    }
+                    r->endReply();
+                });
+            }
+            else
+            {
+                badArgs(toHead ? "lpush" : "rpush");
+            }
+        }
 
-                    mDatabase->push(key, value, dataLen, this, [](bool isOk,int32_t listCount, void *userPointer)
+        // Replies with a single element, or nil if there are none
+        static void listElementReply(void *userPtr, int32_t count, uint32_t index, const void *data, uint32_t dataLen)
+        {
+            RedisProxyImpl *r = (RedisProxyImpl *)userPtr;
+            if (data == nullptr)
+            {
+                r->beginReply();
+                if (count <= 0)
+                {
+                    if (count < 0)
                     {
-                        RedisProxyImpl *r = (RedisProxyImpl *)userPointer;
-                        if (listCount >= 0)
-                        {
-                            r->addResponse(":%d", listCount);
-                        }
-                        else
-                        {
-                            r->addResponse("(error) WRONGTYPE Operation against a key holding the wrong kind of value");
-                        }
-                    });
+                        r->wrongType();
+                    }
+                    else
+                    {
+                        r->addResponse("$-1");
+                    }
+                    r->endReply();
                 }
             }
             else
             {
-                badArgs("rpush");
+                r->addResponse("$%d", dataLen);
+                r->addResponseData(data, dataLen);
+                r->endReply();
+            }
+        }
+
+        // Replies with an array of every element
+        static void listArrayReply(void *userPtr, int32_t count, uint32_t index, const void *data, uint32_t dataLen)
+        {
+            RedisProxyImpl *r = (RedisProxyImpl *)userPtr;
+            if (data == nullptr)
+            {
+                r->beginReply();
+                if (count < 0)
+                {
+                    r->wrongType();
+                }
+                else
+                {
+                    r->addResponse("*%d", count);
+                }
+                if (count <= 0)
+                {
+                    r->endReply();
+                }
+            }
+            else
+            {
+                r->addResponse("$%d", dataLen);
+                r->addResponseData(data, dataLen);
+                if ((index + 1) == uint32_t(count))
+                {
+                    r->endReply();
+                }
+            }
+        }
+
+        // LPOP/RPOP key
+        void listPop(uint32_t argc, bool fromHead)
+        {
+            if (argc == 1)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                expectReply();
+                mDatabase->pop(mDb, key, fromHead, this, listElementReply);
+            }
+            else
+            {
+                badArgs(fromHead ? "lpop" : "rpop");
+            }
+        }
+
+        // LRANGE key start stop
+        void listRange(uint32_t argc)
+        {
+            int64_t start;
+            int64_t stop;
+            if (argc != 3)
+            {
+                badArgs("lrange");
+            }
+            else if (getIntegerArgument(1, start) && getIntegerArgument(2, stop))
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                expectReply();
+                mDatabase->listRange(mDb, key, start, stop, this, listArrayReply);
+            }
+        }
+
+        // LINDEX key index
+        void listIndex(uint32_t argc)
+        {
+            int64_t index;
+            if (argc != 2)
+            {
+                badArgs("lindex");
+            }
+            else if (getIntegerArgument(1, index))
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                expectReply();
+                mDatabase->listIndex(mDb, key, index, this, listElementReply);
+            }
+        }
+
+        // LLEN key
+        void listLength(uint32_t argc)
+        {
+            if (argc == 1)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                expectReply();
+                mDatabase->listLength(mDb, key, this, [](bool isOk, int64_t listCount, void *userPointer)
+                {
+                    RedisProxyImpl *r = (RedisProxyImpl *)userPointer;
+                    r->beginReply();
+                    if (listCount >= 0)
+                    {
+                        r->addResponse(":%lld", (long long)listCount);
+                    }
+                    else
+                    {
+                        r->wrongType();
+                    }
+                    r->endReply();
+                });
+            }
+            else
+            {
+                badArgs("llen");
+            }
+        }
+
+        // LTRIM key start stop
+        void listTrim(uint32_t argc)
+        {
+            int64_t start;
+            int64_t stop;
+            if (argc != 3)
+            {
+                badArgs("ltrim");
+            }
+            else if (getIntegerArgument(1, start) && getIntegerArgument(2, stop))
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                expectReply();
+                mDatabase->listTrim(mDb, key, start, stop, this, [](bool isOk, void *userPointer)
+                {
+                    RedisProxyImpl *r = (RedisProxyImpl *)userPointer;
+                    r->beginReply();
+                    if (isOk)
+                    {
+                        r->addResponse("+OK");
+                    }
+                    else
+                    {
+                        r->wrongType();
+                    }
+                    r->endReply();
+                });
             }
         }
 
@@ -154,10 +416,13 @@ namespace redisproxy
         {
             if (argc == 0)
             {
+                expectReply();
                 mDatabase->unwatch(this,[](bool ok,void *userData)
                 {
                     RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                    r->beginReply();
                     r->addResponse("+OK");
+                    r->endReply();
                 });
             }
             else
@@ -185,13 +450,155 @@ namespace redisproxy
                     }
                 }
             }
-            mDatabase->watch(keyCount, keys, this, [](bool isOk, void *userData)
+            expectReply();
+            mDatabase->watch(mDb, keyCount, keys, this, [](bool isOk, void *userData)
             {
                 RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                r->beginReply();
                 r->addResponse("+OK");
+                r->endReply();
             });
         }
 
+        static void integerReply(bool isOk, int64_t value, void *userPointer)
+        {
+            RedisProxyImpl *r = (RedisProxyImpl *)userPointer;
+            r->beginReply();
+            r->addResponse(":%lld", (long long)value);
+            r->endReply();
+        }
+
+        // Turns a time in seconds or milliseconds ('scale' 1000 or 1), relative to now or not, into
+        // milliseconds since the epoch; false if it does not fit
+        static bool getExpireTime(int64_t t, int64_t scale, bool relative, int64_t &when)
+        {
+            if (t > INT64_MAX / scale || t < INT64_MIN / scale)
+            {
+                return false;
+            }
+            when = t * scale;
+            if (relative)
+            {
+                int64_t now = keyvaluedatabase::getTimeMilliseconds();
+                if (when > INT64_MAX - now)
+                {
+                    return false;
+                }
+                when += now;
+            }
+            return true;
+        }
+
+        // EXPIRE/PEXPIRE key time, or EXPIREAT/PEXPIREAT key timestamp
+        void expire(uint32_t argc, int64_t scale, bool relative, const char *name)
+        {
+            if (argc == 2)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                int64_t t;
+                if (key && getIntegerArgument(1, t))
+                {
+                    int64_t when;
+                    if (getExpireTime(t, scale, relative, when))
+                    {
+                        expectReply();
+                        mDatabase->expireAt(mDb, key, when, this, integerReply);
+                    }
+                    else
+                    {
+                        addResponse("-ERR invalid expire time in '%s' command", name);
+                    }
+                }
+            }
+            else
+            {
+                badArgs(name);
+            }
+        }
+
+        // Redis rounds the time left to the nearest second
+        static void ttlReply(bool isOk, int64_t ttl, void *userPointer)
+        {
+            integerReply(isOk, ttl < 0 ? ttl : (ttl + 500) / 1000, userPointer);
+        }
+
+        // TTL/PTTL key
+        void timeToLive(uint32_t argc, bool milliseconds)
+        {
+            if (argc == 1)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                if (key)
+                {
+                    expectReply();
+                    mDatabase->timeToLive(mDb, key, this, milliseconds ? integerReply : ttlReply);
+                }
+            }
+            else
+            {
+                badArgs(milliseconds ? "pttl" : "ttl");
+            }
+        }
+
+        void persist(uint32_t argc)
+        {
+            if (argc == 1)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                if (key)
+                {
+                    expectReply();
+                    mDatabase->persist(mDb, key, this, integerReply);
+                }
+            }
+            else
+            {
+                badArgs("persist");
+            }
+        }
+
+        // SETEX key seconds value, PSETEX key milliseconds value
+        void setExpire(uint32_t argc, int64_t scale, const char *name)
+        {
+            if (argc == 3)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                int64_t t;
+                if (key && getIntegerArgument(1, t))
+                {
+                    int64_t when;
+                    if (t > 0 && getExpireTime(t, scale, true, when))
+                    {
+                        const char *data = mCommandStream->getAttribute(2, atr, dataLen);
+                        expectReply();
+                        mDatabase->setExpire(mDb, key, data, dataLen, when, this, [](bool isOk, void *userData)
+                        {
+                            RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                            r->beginReply();
+                            r->addResponse(isOk ? "+OK" : "-ERR : Error on set");
+                            r->endReply();
+                        });
+                    }
+                    else
+                    {
+                        addResponse("-ERR invalid expire time in '%s' command", name);
+                    }
+                }
+            }
+            else
+            {
+                badArgs(name);
+            }
+        }
+
         void setnx(uint32_t argc)
         {
             if (argc == 2)
@@ -204,9 +611,11 @@ namespace redisproxy
                     const char *data = mCommandStream->getAttribute(1, atr, dataLen);
                     if (key && data && mDatabase)
                     {
-                        mDatabase->setnx(key, data, dataLen, this, [](bool isOk,int32_t valid, void *userData)
+                        expectReply();
+                        mDatabase->setnx(mDb, key, data, dataLen, this, [](bool isOk,int64_t valid, void *userData)
                         {
                             RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                            r->beginReply();
                             if( isOk )
                             {
                                 r->addResponse(valid ? ":1" : ":0");
@@ -215,6 +624,7 @@ namespace redisproxy
                             {
                                 r->addResponse("-ERR : Error");
                             }
+                            r->endReply();
                         });
                     }
                 }
@@ -225,134 +635,280 @@ namespace redisproxy
             }
         }
 
-        bool processMessage(const char *message)
+        // Run a command which has been added to the command stream
+        // The commands which may add data, which Redis refuses while it is out of memory
+        static bool isDenyOom(rediscommandstream::RedisCommand command)
         {
-            bool ret = false;
-
-            if (mCommandStream)
+            switch (command)
             {
-                uint32_t argc;
-                rediscommandstream::RedisCommand command = mCommandStream->addStream(message, argc);
-                switch (command)
-                {
-                case rediscommandstream::RedisCommand::EXEC:
-                    exec(argc);
-                    break;
-                case rediscommandstream::RedisCommand::SETNX:
-                    setnx(argc);
-                    break;
-                case rediscommandstream::RedisCommand::MULTI:
-                    multi(argc);
-                    break;
-                case rediscommandstream::RedisCommand::WATCH:
-                    watch(argc);
-                    break;
-                case rediscommandstream::RedisCommand::UNWATCH:
-                    unwatch(argc);
-                    break;
-                case rediscommandstream::RedisCommand::RPUSH:
-                    redisPush(argc);
-                    break;
-                case rediscommandstream::RedisCommand::INCR:
-                    incrementBy(argc, 1, false);
-                    break;
-                case rediscommandstream::RedisCommand::DECR:
-                    incrementBy(argc, 1, true);
-                    break;
-                case rediscommandstream::RedisCommand::INCRBY:
-                    incrementBy(argc, false);
-                    break;
-                case rediscommandstream::RedisCommand::DECRBY:
-                    incrementBy(argc, true);
-                    break;
-                case rediscommandstream::RedisCommand::NONE:
-                    break;
-                case rediscommandstream::RedisCommand::PING:
-                    processPing(argc);
-                    break;
-                case rediscommandstream::RedisCommand::SELECT:
-                    select(argc);
-                    break;
-                case rediscommandstream::RedisCommand::SET:
-                    set(argc);
-                    break;
-                case rediscommandstream::RedisCommand::EXISTS:
-                    exists(argc);
-                    break;
-                case rediscommandstream::RedisCommand::DEL:
-                    del(argc);
-                    break;
-                case rediscommandstream::RedisCommand::GET:
-                    get(argc);
-                    break;
-                case rediscommandstream::RedisCommand::SCAN:
-                    scan(argc);
-                    break;
-                default:
-                    assert(0); // command not yet implemented!
-                    break;
-                }
-                if (command != rediscommandstream::RedisCommand::NONE)
-                {
-                    mCommandStream->resetAttributes();
-                }
+            case rediscommandstream::RedisCommand::SET:
+            case rediscommandstream::RedisCommand::SETNX:
+            case rediscommandstream::RedisCommand::SETEX:
+            case rediscommandstream::RedisCommand::PSETEX:
+            case rediscommandstream::RedisCommand::LPUSH:
+            case rediscommandstream::RedisCommand::RPUSH:
+            case rediscommandstream::RedisCommand::INCR:
+            case rediscommandstream::RedisCommand::DECR:
+            case rediscommandstream::RedisCommand::INCRBY:
+            case rediscommandstream::RedisCommand::DECRBY:
+            case rediscommandstream::RedisCommand::INCRBYFLOAT:
+                return true;
+            default:
+                return false;
             }
-
-
-            return ret;
         }
 
-        virtual bool fromClient(const void *data, uint32_t dataLen) override final
+        void processCommand(rediscommandstream::RedisCommand command, uint32_t argc)
         {
-            bool ret = false;
-
-            return ret;
+            // The database evicts keys first if it is over its memory limit
+            if (mDatabase && isDenyOom(command) && !mDatabase->freeMemoryIfNeeded())
+            {
+                addResponse("-OOM command not allowed when used memory > 'maxmemory'.");
+                mCommandStream->resetAttributes();
+                return;
+            }
+            switch (command)
+            {
+            case rediscommandstream::RedisCommand::EXEC:
+                exec(argc);
+                break;
+            case rediscommandstream::RedisCommand::SETNX:
+                setnx(argc);
+                break;
+            case rediscommandstream::RedisCommand::SETEX:
+                setExpire(argc, 1000, "setex");
+                break;
+            case rediscommandstream::RedisCommand::PSETEX:
+                setExpire(argc, 1, "psetex");
+                break;
+            case rediscommandstream::RedisCommand::EXPIRE:
+                expire(argc, 1000, true, "expire");
+                break;
+            case rediscommandstream::RedisCommand::PEXPIRE:
+                expire(argc, 1, true, "pexpire");
+                break;
+            case rediscommandstream::RedisCommand::EXPIREAT:
+                expire(argc, 1000, false, "expireat");
+                break;
+            case rediscommandstream::RedisCommand::PEXPIREAT:
+                expire(argc, 1, false, "pexpireat");
+                break;
+            case rediscommandstream::RedisCommand::TTL:
+                timeToLive(argc, false);
+                break;
+            case rediscommandstream::RedisCommand::PTTL:
+                timeToLive(argc, true);
+                break;
+            case rediscommandstream::RedisCommand::PERSIST:
+                persist(argc);
+                break;
+            case rediscommandstream::RedisCommand::MULTI:
+                multi(argc);
+                break;
+            case rediscommandstream::RedisCommand::WATCH:
+                watch(argc);
+                break;
+            case rediscommandstream::RedisCommand::UNWATCH:
+                unwatch(argc);
+                break;
+            case rediscommandstream::RedisCommand::LPUSH:
+                listPush(argc, true);
+                break;
+            case rediscommandstream::RedisCommand::RPUSH:
+                listPush(argc, false);
+                break;
+            case rediscommandstream::RedisCommand::LPOP:
+                listPop(argc, true);
+                break;
+            case rediscommandstream::RedisCommand::RPOP:
+                listPop(argc, false);
+                break;
+            case rediscommandstream::RedisCommand::LRANGE:
+                listRange(argc);
+                break;
+            case rediscommandstream::RedisCommand::LINDEX:
+                listIndex(argc);
+                break;
+            case rediscommandstream::RedisCommand::LLEN:
+                listLength(argc);
+                break;
+            case rediscommandstream::RedisCommand::LTRIM:
+                listTrim(argc);
+                break;
+            case rediscommandstream::RedisCommand::INCR:
+                incrementBy(argc, 1, false);
+                break;
+            case rediscommandstream::RedisCommand::DECR:
+                incrementBy(argc, 1, true);
+                break;
+            case rediscommandstream::RedisCommand::INCRBY:
+                incrementBy(argc, false);
+                break;
+            case rediscommandstream::RedisCommand::DECRBY:
+                incrementBy(argc, true);
+                break;
+            case rediscommandstream::RedisCommand::INCRBYFLOAT:
+                incrementByFloat(argc);
+                break;
+            case rediscommandstream::RedisCommand::PING:
+                processPing(argc);
+                break;
+            case rediscommandstream::RedisCommand::INFO:
+                info(argc);
+                break;
+            case rediscommandstream::RedisCommand::CONFIG:
+                config(argc);
+                break;
+            case rediscommandstream::RedisCommand::SELECT:
+                select(argc);
+                break;
+            case rediscommandstream::RedisCommand::SWAPDB:
+                swapDb(argc);
+                break;
+            case rediscommandstream::RedisCommand::FLUSHDB:
+                flushDb(argc);
+                break;
+            case rediscommandstream::RedisCommand::FLUSHALL:
+                flushAll(argc);
+                break;
+            case rediscommandstream::RedisCommand::SET:
+                set(argc);
+                break;
+            case rediscommandstream::RedisCommand::EXISTS:
+                exists(argc);
+                break;
+            case rediscommandstream::RedisCommand::DEL:
+                del(argc);
+                break;
+            case rediscommandstream::RedisCommand::UNLINK:
+                unlink(argc);
+                break;
+            case rediscommandstream::RedisCommand::GET:
+                get(argc);
+                break;
+            case rediscommandstream::RedisCommand::SCAN:
+                scan(argc);
+                break;
+            case rediscommandstream::RedisCommand::KEYS:
+                keys(argc);
+                break;
+            case rediscommandstream::RedisCommand::DBSIZE:
+                dbSize(argc);
+                break;
+            default:
+                unknownCommand();
+                break;
+            }
+            mCommandStream->resetAttributes();
         }
 
-        virtual bool fromClient(const char *message) override final
+        void unknownCommand(void)
         {
-            bool ret = false;
+            uint32_t dataLen;
+            const char *name = mCommandStream->getCommandString(dataLen);
+            addResponse("-ERR unknown command '%s'", name ? name : "");
+        }
 
+        // A complete command, parsed in place in the receive buffer
+        void processFrame(const respparser::RespElement *elements, uint32_t elementCount)
+        {
+            uint32_t argc;
+            rediscommandstream::RedisCommand command = mCommandStream->addFrame(elements, elementCount, argc);
 #if USE_LOG_FILE
-            fprintf(mLogFile, "[Client]%s\r\n", message);
-            fflush(mLogFile);
+            logFrame(elements, elementCount);
 #endif
-            printf("Receiving: %s\n", message);
             if (mIsMulti)
             {
-                addMulti(message); // add this message to the multi buffer
-                uint32_t argc;
-                rediscommandstream::RedisCommand command = mCommandStream->addStream(message, argc);
                 switch (command)
                 {
                     case rediscommandstream::RedisCommand::MULTI:
                         multi(argc);
                         mCommandStream->resetAttributes();
-                        ret = true;
                         break;
                     case rediscommandstream::RedisCommand::EXEC:
                         mCommandStream->resetAttributes();
                         processMulti(); // process all of the commands we accumulated
-                        ret = true;
+                        break;
+                    case rediscommandstream::RedisCommand::NONE:
+                        unknownCommand();
+                        mCommandStream->resetAttributes();
                         break;
                     default:
-                        if (command != rediscommandstream::RedisCommand::NONE)
-                        {
-                            mMultiCommandCount++;
-                            addResponse("+QUEUED"); // respond that the message has been queued
-                            mCommandStream->resetAttributes();
-                            ret = true;
-                        }
+                        addMulti(elements, elementCount); // add this command to the multi buffer
+                        mMultiCommandCount++;
+                        addResponse("+QUEUED"); // respond that the message has been queued
+                        mCommandStream->resetAttributes();
                         break;
                 }
             }
+            else if (command == rediscommandstream::RedisCommand::NONE)
+            {
+                unknownCommand();
+                mCommandStream->resetAttributes();
+            }
             else
             {
-                ret = processMessage(message);
+                processCommand(command, argc);
             }
+        }
 
+        // Parse and run every complete frame which has accumulated in the input buffer
+        void processInput(void)
+        {
+            for (;;)
+            {
+                uint32_t dataLen;
+                uint8_t *data = mInputBuffer->getData(dataLen);
+                if (dataLen == 0)
+                {
+                    break;
+                }
+                uint32_t frameLen;
+                respparser::RespParser::Result r = mInputParser->parse(data, dataLen, frameLen);
+                if (r == respparser::RespParser::Result::INCOMPLETE)
+                {
+                    break;
+                }
+                if (r == respparser::RespParser::Result::PROTOCOL_ERROR)
+                {
+                    addResponse("-ERR %s", mInputParser->getError());
+                    mInputParser->reset();
+                    mInputBuffer->clear();
+                    break;
+                }
+                uint32_t elementCount;
+                const respparser::RespElement *elements = mInputParser->getElements(elementCount);
+                if (elementCount)
+                {
+                    processFrame(elements, elementCount);
+                }
+                mInputBuffer->consume(frameLen);
+            }
+        }
 
-            return ret;
+        virtual bool fromClient(const respparser::RespElement *elements, uint32_t elementCount) override final
+        {
+            processFrame(elements, elementCount);
+            return true;
+        }
+
+        virtual bool fromClient(const void *data, uint32_t dataLen) override final
+        {
+            mInputBuffer->addBuffer(data, dataLen);
+            processInput();
+            return true;
+        }
+
+        // A single line of input; either an inline command or one line of a RESP command
+        virtual bool fromClient(const char *message) override final
+        {
+#if LOG_CLIENT_TRAFFIC
+            printf("Receiving: %s\n", message);
+#endif
+            mInputBuffer->addBuffer(message, uint32_t(strlen(message)));
+            mInputBuffer->addBuffer("\r\n", 2);
+            processInput();
+            return true;
         }
 
         void badArgs(const char *cmd)
@@ -360,10 +916,10 @@ namespace redisproxy
             addResponse("-ERR wrong number of arguments for '%s' command", cmd);
         }
 
-        void scanResponse(RedisScan *rs, uint32_t index)
+        void scanResponse(RedisScan *rs, uint64_t cursor)
         {
-            char scratch[512];
-            snprintf(scratch, 512, "%d", index);
+            char scratch[32];
+            snprintf(scratch, 32, "%llu", (unsigned long long)cursor);
             uint32_t slen = uint32_t(strlen(scratch));
             addResponse("*2");
             addResponse("$%d", slen);
@@ -393,48 +949,60 @@ namespace redisproxy
                 const char *value = mCommandStream->getAttribute(0, atr, dataLen);
                 if ( value && mDatabase)
                 {
-                    int32_t scanIndex = atoi(value);
-                    if (scanIndex < 0)
+                    // Cursors are unsigned 64 bit numbers, as in Redis
+                    char *end = nullptr;
+                    errno = 0;
+                    uint64_t cursor = dataLen && isdigit(uint8_t(value[0])) ? uint64_t(strtoull(value, &end, 10)) : 0;
+                    if (end == nullptr || end != (value + dataLen) || errno == ERANGE)
                     {
-                        addResponse("(error) ERR invalid cursor");
+                        addResponse("-ERR invalid cursor");
                     }
                     else
                     {
                         const char *match = nullptr;
-                        const char *count = nullptr;
-                        if (argc >= 3)
+                        int64_t maxScan = 10; // if no count provided, default count is 10
+                        for (uint32_t i = 1; i < argc; i += 2)
                         {
-                            for (uint32_t i = 1; i < argc; i += 2)
+                            mCommandStream->getAttribute(i, atr, dataLen);
+                            if (i + 1 == argc)
                             {
-                                const char *cmd = mCommandStream->getAttribute(i, atr, dataLen);
-                                if (atr == rediscommandstream::RedisAttribute::MATCH)
-                                {
-                                    match = mCommandStream->getAttribute(i + 1, atr, dataLen);
-                                }
-                                else if (atr == rediscommandstream::RedisAttribute::COUNT)
+                                addResponse("-ERR syntax error");
+                                return;
+                            }
+                            else if (atr == rediscommandstream::RedisAttribute::MATCH)
+                            {
+                                match = mCommandStream->getAttribute(i + 1, atr, dataLen);
+                            }
+                            else if (atr == rediscommandstream::RedisAttribute::COUNT)
+                            {
+                                if (!getIntegerArgument(i + 1, maxScan))
                                 {
-                                    count = mCommandStream->getAttribute(i+1, atr, dataLen);
+                                    return;
                                 }
-                                else
+                                if (maxScan < 1 || maxScan > UINT32_MAX)
                                 {
-                                    assert(0);
+                                    addResponse("-ERR syntax error");
+                                    return;
                                 }
                             }
-                        }
-                        int32_t maxScan = 10; // if no count provided, default count is 10
-                        if (count)
-                        {
-                            maxScan = atoi(count);
+                            else
+                            {
+                                addResponse("-ERR syntax error");
+                                return;
+                            }
                         }
                         RedisScan *rs = mScanPool.AllocateObject();
                         rs->mThis = this;
-                        mDatabase->scan(scanIndex, maxScan, match, rs, [](void *userPtr, const char *key,uint32_t index)
+                        expectReply();
+                        mDatabase->scan(mDb, cursor, uint32_t(maxScan), match, rs, [](void *userPtr, const char *key,uint64_t cursor)
                         {
                             RedisScan *rs = (RedisScan *)userPtr;
                             RedisProxyImpl *thisPtr = rs->mThis;
                             if (key == nullptr)
                             {
-                                thisPtr->scanResponse(rs, index); // process response and free RedisScan object
+                                thisPtr->beginReply();
+                                thisPtr->scanResponse(rs, cursor); // process response and free RedisScan object
+                                thisPtr->endReply();
                             }
                             else
                             {
@@ -446,6 +1014,69 @@ namespace redisproxy
             }
         }
 
+        // The database counts the keys before handing them over, so the array's header goes out
+        // first and the keys are streamed after it (see streamResponses)
+        void keys(uint32_t argc)
+        {
+            if (argc != 1)
+            {
+                badArgs("keys");
+                return;
+            }
+            rediscommandstream::RedisAttribute atr;
+            uint32_t dataLen;
+            const char *match = mCommandStream->getAttribute(0, atr, dataLen);
+            expectReply();
+            mDatabase->keys(mDb, match, this, [](void *userPtr, const char *key, uint32_t keyLen)
+            {
+                RedisProxyImpl *r = (RedisProxyImpl *)userPtr;
+                if (key == nullptr)
+                {
+                    r->beginReply();
+                    r->addResponse("*%u", keyLen);
+                    r->mKeysRemaining = keyLen;
+                }
+                else
+                {
+                    r->addResponse("$%d", keyLen);
+                    r->addResponseData(key, keyLen);
+                    r->mKeysRemaining--;
+                }
+                if (r->mKeysRemaining == 0)
+                {
+                    r->endReply();
+                }
+                else
+                {
+                    r->streamResponses();
+                }
+            });
+        }
+
+        void dbSize(uint32_t argc)
+        {
+            if (argc != 0)
+            {
+                badArgs("dbsize");
+                return;
+            }
+            expectReply();
+            mDatabase->dbSize(mDb, this, [](bool ok, int64_t count, void *userPtr)
+            {
+                RedisProxyImpl *r = (RedisProxyImpl *)userPtr;
+                r->beginReply();
+                if (ok)
+                {
+                    r->addResponse(":%lld", (long long)count);
+                }
+                else
+                {
+                    r->addResponse("-ERR : Error on dbsize");
+                }
+                r->endReply();
+            });
+        }
+
         void get(uint32_t argc)
         {
             if (argc == 0)
@@ -459,22 +1090,21 @@ namespace redisproxy
                 const char *key = mCommandStream->getAttribute(0, atr, dataLen);
                 if (key && mDatabase)
                 {
-                    mDatabase->get(key, this, [](void *userData, const void *mem, uint32_t dataLen)
+                    expectReply();
+                    mDatabase->get(mDb, key, this, [](void *userData, const void *mem, uint32_t dataLen)
                     {
                         RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                        r->beginReply();
                         if (mem)
                         {
                             r->addResponse("$%d", dataLen);
-                            char *temp = (char *)malloc(dataLen + 1);
-                            memcpy(temp, mem, dataLen);
-                            temp[dataLen] = 0;
-                            r->addResponse(temp);
-                            free(temp);
+                            r->addResponseData(mem, dataLen);
                         }
                         else
                         {
                             r->addResponse("$-1");
                         }
+                        r->endReply();
                     });
                 }
                 else
@@ -497,10 +1127,13 @@ namespace redisproxy
                 const char *key = mCommandStream->getAttribute(0, atr, dataLen);
                 if (key && mDatabase)
                 {
-                    mDatabase->exists(key, this, [](bool isOk,int32_t response, void* userPtr)
+                    expectReply();
+                    mDatabase->exists(mDb, key, this, [](bool isOk,int64_t response, void* userPtr)
                     {
                         RedisProxyImpl *o = (RedisProxyImpl *)userPtr;
+                        o->beginReply();
                         o->addResponse(response > 0 ? ":1" : ":0");
+                        o->endReply();
                    });
                 }
             }
@@ -519,15 +1152,37 @@ namespace redisproxy
                 const char *key = mCommandStream->getAttribute(0, atr, dataLen);
                 if (key && mDatabase)
                 {
-                    mDatabase->del(key, this, [](bool isOk,int32_t response, void* userPtr)
+                    expectReply();
+                    mDatabase->del(mDb, key, this, [](bool isOk,int64_t response, void* userPtr)
                     {
                         RedisProxyImpl *o = (RedisProxyImpl *)userPtr;
+                        o->beginReply();
                         o->addResponse(response > 0 ? ":1" : ":0");
+                        o->endReply();
                     });
                 }
             }
         }
 
+        // UNLINK key [key ...]; replies with how many of the keys were removed
+        void unlink(uint32_t argc)
+        {
+            if (argc == 0)
+            {
+                badArgs("unlink");
+                return;
+            }
+            mKeyList.resize(argc);
+            for (uint32_t i = 0; i < argc; i++)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                mKeyList[i] = mCommandStream->getAttribute(i, atr, dataLen);
+            }
+            expectReply();
+            mDatabase->unlink(mDb, argc, &mKeyList[0], this, integerReply);
+        }
+
 
         void set(uint32_t argc)
         {
@@ -541,9 +1196,11 @@ namespace redisproxy
                     const char *data = mCommandStream->getAttribute(1, atr, dataLen);
                     if (key && data && mDatabase )
                     {
-                        mDatabase->set(key, data, dataLen, this, [](bool valid, void *userPtr)
+                        expectReply();
+                        mDatabase->set(mDb, key, data, dataLen, this, [](bool valid, void *userPtr)
                         {
                             RedisProxyImpl *r = (RedisProxyImpl *)userPtr;
+                            r->beginReply();
                             if (valid)
                             {
                                 r->addResponse("+OK");
@@ -552,6 +1209,7 @@ namespace redisproxy
                             {
                                 r->addResponse("-ERR : Error on set");
                             }
+                            r->endReply();
                         });
                     }
                 }
@@ -562,41 +1220,42 @@ namespace redisproxy
             }
         }
 
-        bool isInteger(const char *str)
-        {
-            bool ret = false;
-            char c = *str;
-            if ((c >= '0' && c <= '9') || c == '+' || c == '-')
-            {
-                ret = true;
-            }
-            return ret;
-        }
-
-        void incrementBy(const char *key,int32_t dv,bool isNegative)
+        void incrementBy(const char *key,int64_t dv,bool isNegative)
         {
             if (key)
             {
                 if (isNegative)
                 {
-                    dv *= -1;
+                    if (dv == INT64_MIN)
+                    {
+                        addResponse("-ERR decrement would overflow");
+                        return;
+                    }
+                    dv = -dv;
                 }
-                mDatabase->increment(key, dv, this, [](bool isOk, int32_t newValue, void *userData)
+                expectReply();
+                mDatabase->increment(mDb, key, dv, this, [](bool isOk, int64_t newValue, void *userData)
                 {
                     RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                    r->beginReply();
                     if (isOk)
                     {
-                        r->addResponse(":%d", newValue);
+                        r->addResponse(":%lld", (long long)newValue);
+                    }
+                    else if (keyvaluedatabase::IncrementError(newValue) == keyvaluedatabase::IncrementError::WOULD_OVERFLOW)
+                    {
+                        r->addResponse("-ERR increment or decrement would overflow");
                     }
                     else
                     {
-                        r->addResponse("(error) ERR value is not an integer or out of range");
+                        r->addResponse("-ERR value is not an integer or out of range");
                     }
+                    r->endReply();
                 });
             }
         }
 
-        void incrementBy(uint32_t argc,int32_t dv,bool isNegative)
+        void incrementBy(uint32_t argc,int64_t dv,bool isNegative)
         {
             if (argc == 1)
             {
@@ -619,51 +1278,297 @@ namespace redisproxy
                 rediscommandstream::RedisAttribute atr;
                 uint32_t dataLen;
                 const char *key = mCommandStream->getAttribute(0, atr, dataLen);
-                const char *value = mCommandStream->getAttribute(1, atr, dataLen);
-                if (isInteger(value))
+                int64_t dv;
+                if (getIntegerArgument(1, dv))
                 {
-                    int32_t dv = atoi(value);
                     incrementBy(key, dv, isNegative);
                 }
-                else
+            }
+            else
+            {
+                badArgs(isNegative ? "decrby" : "incrby");
+            }
+        }
+
+        // INCRBYFLOAT key increment
+        void incrementByFloat(uint32_t argc)
+        {
+            if (argc == 2)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *key = mCommandStream->getAttribute(0, atr, dataLen);
+                long double dv;
+                if (key && getFloatArgument(1, dv))
                 {
-                    addResponse("(error) ERR value is not an integer or out of range");
+                    expectReply();
+                    mDatabase->incrementFloat(mDb, key, dv, this, [](void *userData, const char *text, uint32_t textLen, keyvaluedatabase::IncrementError error)
+                    {
+                        RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                        r->beginReply();
+                        if (error == keyvaluedatabase::IncrementError::NONE)
+                        {
+                            r->addResponse("$%d", textLen);
+                            r->addResponseData(text, textLen);
+                        }
+                        else if (error == keyvaluedatabase::IncrementError::NOT_FINITE)
+                        {
+                            r->addResponse("-ERR increment would produce NaN or Infinity");
+                        }
+                        else
+                        {
+                            r->addResponse("-ERR value is not a valid float");
+                        }
+                        r->endReply();
+                    });
                 }
             }
             else
             {
-                badArgs(isNegative ? "decrby" : "incrby");
+                badArgs("incrbyfloat");
             }
         }
 
+        // The selection belongs to this client; every command it sends after names it
         void select(uint32_t argc)
         {
+            if (argc != 1)
+            {
+                badArgs("select");
+                return;
+            }
+            int64_t index;
+            if (!getIntegerArgument(0, index))
+            {
+                return;
+            }
+            // Checked here rather than by the database, so the commands which follow are issued
+            // for the right database without waiting on a reply
+            if (index < 0 || index >= int64_t(mDatabase->getDatabaseCount()))
+            {
+                addResponse("-ERR DB index is out of range");
+                return;
+            }
+            mDb = uint32_t(index);
+            addResponse("+OK");
+        }
+
+        // Replies +OK, or the error if the database turned the command down
+        static void databaseReply(bool isOk, void *userPtr)
+        {
+            RedisProxyImpl *r = (RedisProxyImpl *)userPtr;
+            r->beginReply();
+            if (isOk)
+            {
+                r->addResponse("+OK");
+            }
+            else
+            {
+                r->addResponse("-ERR DB index is out of range");
+            }
+            r->endReply();
+        }
+
+        void swapDb(uint32_t argc)
+        {
+            if (argc != 2)
+            {
+                badArgs("swapdb");
+                return;
+            }
+            int64_t a;
+            int64_t b;
+            if (!getIntegerArgument(0, a) || !getIntegerArgument(1, b))
+            {
+                return;
+            }
+            if (a < 0 || a > INT32_MAX || b < 0 || b > INT32_MAX)
+            {
+                addResponse("-ERR DB index is out of range");
+                return;
+            }
+            expectReply();
+            mDatabase->swapDatabases(uint32_t(a), uint32_t(b), this, databaseReply);
+        }
+
+        // The optional ASYNC or SYNC of FLUSHDB and FLUSHALL.  Without either the flush is
+        // synchronous, as in Redis; with the Redis provider the backend's own lazyfree-lazy-user-flush
+        // then decides.  Returns false, having replied with the error, if the arguments are wrong.
+        bool getFlushMode(uint32_t argc, const char *command, bool &async)
+        {
+            async = false;
+            if (argc > 1)
+            {
+                badArgs(command);
+                return false;
+            }
             if (argc == 1)
             {
                 rediscommandstream::RedisAttribute atr;
                 uint32_t dataLen;
-                const char *sel = mCommandStream->getAttribute(0, atr, dataLen);
-                uint32_t index = 0;
-                if (sel)
+                mCommandStream->getAttribute(0, atr, dataLen);
+                if (atr == rediscommandstream::RedisAttribute::SYNC)
                 {
-                    index = atoi(sel);
+                    async = false;
                 }
-                mDatabase->select(index,this,[](bool selectOk,void *userPtr)
+                else if (atr != rediscommandstream::RedisAttribute::ASYNC)
                 {
-                    RedisProxyImpl *r = (RedisProxyImpl *)userPtr;
-                    if (selectOk)
-                    {
-                        r->addResponse("+OK");
-                    }
-                    else
-                    {
-                        r->addResponse("(error) ERR DB index is out of range");
-                    }
-                });
+                    addResponse("-ERR syntax error");
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void flushDb(uint32_t argc)
+        {
+            bool async;
+            if (getFlushMode(argc, "flushdb", async))
+            {
+                expectReply();
+                mDatabase->flushDatabase(mDb, async, this, databaseReply);
+            }
+        }
+
+        void flushAll(uint32_t argc)
+        {
+            bool async;
+            if (getFlushMode(argc, "flushall", async))
+            {
+                expectReply();
+                mDatabase->flushAll(async, this, databaseReply);
+            }
+        }
+
+        // INFO [section]; only the memory section is kept, so any other section is empty
+        void info(uint32_t argc)
+        {
+            bool memory = true;
+            if (argc == 1)
+            {
+                rediscommandstream::RedisAttribute atr;
+                uint32_t dataLen;
+                const char *section = mCommandStream->getAttribute(0, atr, dataLen);
+                const char *name = "memory";
+                memory = section && dataLen == strlen(name);
+                for (uint32_t i = 0; memory && i < dataLen; i++)
+                {
+                    memory = tolower(uint8_t(section[i])) == name[i];
+                }
+            }
+            else if (argc > 1)
+            {
+                badArgs("info");
+                return;
+            }
+            if (!memory)
+            {
+                addResponse("$0");
+                addResponseData("", 0);
+                return;
+            }
+            expectReply();
+            mDatabase->memoryInfo(this, [](void *userData, const void *data, uint32_t dataLen)
+            {
+                RedisProxyImpl *r = (RedisProxyImpl *)userData;
+                r->beginReply();
+                if (data)
+                {
+                    r->addResponse("$%d", dataLen);
+                    r->addResponseData(data, dataLen);
+                }
+                else
+                {
+                    r->addResponse("-ERR : Error on info");
+                }
+                r->endReply();
+            });
+        }
+
+        // True if the argument is this word, in any case
+        bool isArgument(uint32_t index, const char *name)
+        {
+            rediscommandstream::RedisAttribute atr;
+            uint32_t dataLen;
+            const char *arg = mCommandStream->getAttribute(index, atr, dataLen);
+            bool ret = arg && dataLen == strlen(name);
+            for (uint32_t i = 0; ret && i < dataLen; i++)
+            {
+                ret = tolower(uint8_t(arg[i])) == name[i];
+            }
+            return ret;
+        }
+
+        void addBulkString(const char *str)
+        {
+            uint32_t len = uint32_t(strlen(str));
+            addResponse("$%d", len);
+            addResponseData(str, len);
+        }
+
+        // CONFIG GET/SET, for the memory limit and eviction policy only
+        void config(uint32_t argc)
+        {
+            rediscommandstream::RedisAttribute atr;
+            uint32_t dataLen;
+            uint64_t maxMemory;
+            keyvaluedatabase::EvictionPolicy policy;
+            mDatabase->getMaxMemory(maxMemory, policy);
+            if (argc == 2 && isArgument(0, "get"))
+            {
+                char scratch[64];
+                if (isArgument(1, "maxmemory"))
+                {
+                    snprintf(scratch, sizeof(scratch), "%llu", (unsigned long long)maxMemory);
+                    addResponse("*2");
+                    addBulkString("maxmemory");
+                    addBulkString(scratch);
+                }
+                else if (isArgument(1, "maxmemory-policy"))
+                {
+                    addResponse("*2");
+                    addBulkString("maxmemory-policy");
+                    addBulkString(keyvaluedatabase::getEvictionPolicyName(policy));
+                }
+                else
+                {
+                    addResponse("*0");
+                }
+            }
+            else if (argc == 3 && isArgument(0, "set"))
+            {
+                const char *name = mCommandStream->getAttribute(1, atr, dataLen);
+                const char *value = mCommandStream->getAttribute(2, atr, dataLen);
+                bool valid = false;
+                if (isArgument(1, "maxmemory"))
+                {
+                    valid = keyvaluedatabase::parseMemorySize(value, maxMemory);
+                }
+                else if (isArgument(1, "maxmemory-policy"))
+                {
+                    valid = keyvaluedatabase::getEvictionPolicy(value, policy);
+                }
+                else
+                {
+                    addResponse("-ERR Unsupported CONFIG parameter: %s", name);
+                    return;
+                }
+                if (!valid)
+                {
+                    addResponse("-ERR Invalid argument '%s' for CONFIG SET '%s'", value, name);
+                }
+                else if (mDatabase->setMaxMemory(maxMemory, policy))
+                {
+                    addResponse("+OK");
+                }
+                else
+                {
+                    addResponse("-ERR CONFIG SET '%s' is not supported by this database", name);
+                }
             }
             else
             {
-                badArgs("select");
+                badArgs("config");
             }
         }
 
@@ -685,125 +1590,258 @@ namespace redisproxy
             {
                 mDatabase->pump(); // pump cycle for the database (if it needs one)
             }
+            sendResponses(c);
+        }
+
+        void sendResponses(Callback *c)
+        {
             uint32_t streamLen;
-            const uint8_t *scan = mResponseBuffer->getData(streamLen);	// Get the raw stream of responses
+            const uint8_t *stream = mResponseBuffer->getData(streamLen);	// Every reply which is ready, as RESP
             if (streamLen)
             {
-                const uint8_t *eof = &scan[streamLen];	// This is the end of the data stream
-                while (scan < eof)
-                {
-                    const uint32_t *header = (const uint32_t *)scan;	// Get the header
-                    uint32_t stringLen = header[0];				// Get the length of the API string (JSON response)
-                    if (stringLen == 0)
-                    {
-                        c->receiveRedisMessage(""); // empty string
-                    }
-                    else
-                    {
-                        const char *msg = (const char *)&header[1];
 #if USE_LOG_FILE
-                        if (mLogFile)
-                        {
-                            fprintf(mLogFile, "[Server]%s\r\n", msg);
-                            fflush(mLogFile);
-                        }
-#endif
-                        c->receiveRedisMessage(msg);
-                    }
-                    scan += (stringLen + 1 + sizeof(uint32_t));	// Advance to the next response
+                if (mLogFile)
+                {
+                    fprintf(mLogFile, "[Server]%.*s", int(streamLen), (const char *)stream);
+                    fflush(mLogFile);
                 }
+#endif
+                c->receiveRedisResponse(stream, streamLen);
                 mResponseBuffer->clear();	// Zero out the response buffer now that we have processed all responses
             }
         }
 
+        // Called part way through writing a reply, from a database callback.  Everything in the
+        // response buffer is in order ahead of it, so once a chunk has built up it can all go.
+        // This runs inside a database callback, so the database must not be pumped here.
+        void streamResponses(void)
+        {
+            if (mStreamCallback && mResponseBuffer->getSize() >= STREAM_CHUNK_SIZE)
+            {
+                sendResponses(mStreamCallback);
+            }
+        }
+
+        virtual void setStreamCallback(Callback *c) override final
+        {
+            mStreamCallback = c;
+        }
+
         virtual void release(void) override final
         {
             delete this;
         }
 
-        // Initialize the memory stream for the response
-        inline void initMemoryStream(memorystream::MemoryStream &output)
+        virtual void setEventLoop(eventloop::EventLoop *loop, eventloop::EventLoopCallback *owner) override final
         {
-            uint8_t *writeBuffer = mResponseBuffer->confirmCapacity(MAX_COMMAND_STRING); // make sure there enough room in the response buffer for both the JSON portion and the binary data blob
-            assert(writeBuffer);
-            if (!writeBuffer) return;
-            output.init(writeBuffer, MAX_COMMAND_STRING);	// Initialize the stream class for write access it should *never* overflow
-            output.write(uint32_t(0)); // length of message ASCII message
+            mEventLoop = loop;
+            mEventOwner = owner;
+            if (mMyDatabase && mDatabase)
+            {
+                mDatabase->setEventLoop(loop);
+            }
         }
 
         void addResponse(const char *fmt,...)
         {
-            char str[MAX_COMMAND_STRING];
+            char str[MAX_COMMAND_STRING + 2];
             va_list arg;
             va_start(arg, fmt);
-            wplatform::stringFormatV(str, sizeof(str), fmt, arg);
+            wplatform::stringFormatV(str, MAX_COMMAND_STRING, fmt, arg);
             va_end(arg);
 
             uint32_t slen = uint32_t(strlen(str));
-            uint8_t *writeBuffer = mResponseBuffer->confirmCapacity(MAX_COMMAND_STRING); // make sure there enough room in the response buffer for both the JSON portion and the binary data blob
-            assert(writeBuffer);
-            if (!writeBuffer) return;
-            uint32_t *header = (uint32_t *)writeBuffer;
-            header[0] = slen;
-            if (slen)
+            str[slen] = '\r';
+            str[slen + 1] = '\n';
+            writeResponse(str, slen + 2, false);
+        }
+
+        // Queue a command until EXEC; it is stored as a RESP array of bulk strings
+        void addMulti(const respparser::RespElement *elements, uint32_t elementCount)
+        {
+            if (elementCount && elements[0].mType == respparser::RespType::ARRAY)
             {
-                memcpy(&header[1], str, slen + 1);
+                elements++;
+                elementCount--;
+            }
+            char header[32];
+            snprintf(header, sizeof(header), "*%u\r\n", elementCount);
+            mMultiBuffer->addBuffer(header, uint32_t(strlen(header)));
+            for (uint32_t i = 0; i < elementCount; i++)
+            {
+                const respparser::RespElement &e = elements[i];
+                snprintf(header, sizeof(header), "$%u\r\n", e.mLength);
+                mMultiBuffer->addBuffer(header, uint32_t(strlen(header)));
+                mMultiBuffer->addBuffer(e.mData, e.mLength);
+                mMultiBuffer->addBuffer("\r\n", 2);
             }
-            mResponseBuffer->addBuffer(nullptr, slen + 1 + sizeof(uint32_t));
         }
 
-        void addMulti(const char *str)
+        // Add a length delimited payload (the body of a bulk string) which may contain any bytes at all
+        void addResponseData(const void *data, uint32_t dataLen)
         {
-            uint32_t slen = uint32_t(strlen(str));
-            uint8_t *writeBuffer = mMultiBuffer->confirmCapacity(MAX_COMMAND_STRING); // make sure there enough room in the response buffer for both the JSON portion and the binary data blob
+            writeResponse(data, dataLen, true);
+        }
+
+        // Database calls may answer later (the Redis backend) or before they even return (the in memory
+        // database).  Each call is counted by 'expectReply' and its callback brackets the reply it writes
+        // with 'beginReply' and 'endReply'.  A reply written outside of a callback, while database replies
+        // are still outstanding, belongs to a later command; it is held back until those have been written.
+        void expectReply(void)
+        {
+            mRepliesExpected++;
+        }
+
+        void beginReply(void)
+        {
+            mReplyDepth++;
+        }
+
+        void endReply(void)
+        {
+            mReplyDepth--;
+            mRepliesCompleted++;
+            // Release any held replies which were only waiting on this one
+            uint32_t heldLen;
+            uint8_t *held = mHeldResponses->getData(heldLen);
+            uint32_t consumed = 0;
+            while (consumed < heldLen)
+            {
+                const uint32_t *header = (const uint32_t *)&held[consumed];
+                if (header[0] > mRepliesCompleted)
+                {
+                    break;
+                }
+                uint32_t dataLen = header[1];
+                appendResponse(&header[2], dataLen, false);
+                consumed += alignRecord(dataLen);
+            }
+            if (consumed)
+            {
+                mHeldResponses->consume(consumed);
+            }
+        }
+
+        static uint32_t alignRecord(uint32_t dataLen)
+        {
+            return (sizeof(uint32_t) * 2 + dataLen + 3) & ~uint32_t(3);
+        }
+
+        void writeResponse(const void *data, uint32_t dataLen, bool appendLineEnd)
+        {
+            if (mReplyDepth == 0 && mRepliesCompleted != mRepliesExpected)
+            {
+                uint32_t recordLen = alignRecord(dataLen + (appendLineEnd ? 2 : 0));
+                uint8_t *writeBuffer = mHeldResponses->confirmCapacity(recordLen);
+                assert(writeBuffer);
+                if (!writeBuffer) return;
+                uint32_t *header = (uint32_t *)writeBuffer;
+                header[0] = mRepliesExpected;       // may be sent once this many database replies have been written
+                header[1] = dataLen + (appendLineEnd ? 2 : 0);
+                uint8_t *dest = (uint8_t *)&header[2];
+                memcpy(dest, data, dataLen);
+                if (appendLineEnd)
+                {
+                    dest[dataLen] = '\r';
+                    dest[dataLen + 1] = '\n';
+                }
+                mHeldResponses->addBuffer(nullptr, recordLen);
+            }
+            else
+            {
+                appendResponse(data, dataLen, appendLineEnd);
+            }
+        }
+
+        void appendResponse(const void *data, uint32_t dataLen, bool appendLineEnd)
+        {
+            // The first response since the last flush; let our owner know there is something to send
+            if (mEventLoop && mResponseBuffer->getSize() == 0)
+            {
+                mEventLoop->schedule(mEventOwner);
+            }
+            uint32_t totalLen = dataLen + (appendLineEnd ? 2 : 0);
+            uint8_t *writeBuffer = mResponseBuffer->confirmCapacity(totalLen);
             assert(writeBuffer);
             if (!writeBuffer) return;
-            uint32_t *header = (uint32_t *)writeBuffer;
-            header[0] = slen;
-            if (slen)
+            memcpy(writeBuffer, data, dataLen);
+            if (appendLineEnd)
             {
-                memcpy(&header[1], str, slen + 1);
+                writeBuffer[dataLen] = '\r';
+                writeBuffer[dataLen + 1] = '\n';
             }
-            mMultiBuffer->addBuffer(nullptr, slen + 1 + sizeof(uint32_t));
+            mResponseBuffer->addBuffer(nullptr, totalLen);
         }
 
         void processMulti(void)
         {
             addResponse("*%d", mMultiCommandCount);
+            mIsMulti = false;
             uint32_t streamLen;
-            const uint8_t *scan = mMultiBuffer->getData(streamLen);	// Get the raw stream of responses
-            if (streamLen)
+            uint8_t *scan = mMultiBuffer->getData(streamLen);	// Every queued command
+            mMultiParser->reset();
+            while (streamLen)
             {
-                const uint8_t *eof = &scan[streamLen];	// This is the end of the data stream
-                while (scan < eof)
+                uint32_t frameLen;
+                if (mMultiParser->parse(scan, streamLen, frameLen) != respparser::RespParser::Result::FRAME)
                 {
-                    const uint32_t *header = (const uint32_t *)scan;	// Get the header
-                    uint32_t stringLen = header[0];				// Get the length of the API string (JSON response)
-                    if (stringLen == 0)
-                    {
-                    }
-                    else
+                    break; // can not happen; we encoded these frames ourselves
+                }
+                uint32_t elementCount;
+                const respparser::RespElement *elements = mMultiParser->getElements(elementCount);
+                uint32_t argc;
+                rediscommandstream::RedisCommand command = mCommandStream->addFrame(elements, elementCount, argc);
+                processCommand(command, argc);
+                scan += frameLen;
+                streamLen -= frameLen;
+            }
+            mMultiBuffer->clear();	// Zero out the multi buffer now that we have processed all commands
+            mMultiCommandCount = 0;
+        }
+
+#if USE_LOG_FILE
+        void logFrame(const respparser::RespElement *elements, uint32_t elementCount)
+        {
+            if (mLogFile)
+            {
+                fprintf(mLogFile, "[Client]");
+                for (uint32_t i = 0; i < elementCount; i++)
+                {
+                    if (elements[i].mData)
                     {
-                        const char *msg = (const char *)&header[1];
-                        processMessage(msg);
+                        fprintf(mLogFile, "%s%s", i ? " " : "", elements[i].mData);
                     }
-                    scan += (stringLen + 1 + sizeof(uint32_t));	// Advance to the next response
                 }
-                mMultiBuffer->clear();	// Zero out the response buffer now that we have processed all responses
-                mMultiCommandCount = 0;
-                mIsMulti = false;
+                fprintf(mLogFile, "\r\n");
+                fflush(mLogFile);
             }
         }
+#endif
 
         bool                                    mMyDatabase{ false };
         bool                                    mIsMulti{ false };
+        uint32_t                                mDb{ 0 };                   // The logical database this client has selected
         uint32_t                                mInstanceId{ 0 };
-        simplebuffer::SimpleBuffer	            *mResponseBuffer{ nullptr };// Where pending responses are stored
+        simplebuffer::SimpleBuffer	            *mResponseBuffer{ nullptr };// Replies ready to send, as RESP
+        simplebuffer::SimpleBuffer              *mHeldResponses{ nullptr }; // Replies waiting on database replies to earlier commands
+        uint32_t                                mRepliesExpected{ 0 };      // Database calls made
+        uint32_t                                mRepliesCompleted{ 0 };     // Database calls which have replied
+        uint32_t                                mReplyDepth{ 0 };           // Non zero while a database callback is writing its reply
         rediscommandstream::RedisCommandStream  *mCommandStream{ nullptr };
         keyvaluedatabase::KeyValueDatabase      *mDatabase{ nullptr };
         uint32_t                                mMultiCommandCount{ 0 };
-        simplebuffer::SimpleBuffer              *mMultiBuffer{ nullptr };
+        simplebuffer::SimpleBuffer              *mMultiBuffer{ nullptr };  // commands queued by MULTI, as RESP
+        simplebuffer::SimpleBuffer              *mInputBuffer{ nullptr };  // input which arrived as lines or raw bytes rather than parsed frames
+        respparser::RespParser                  *mInputParser{ nullptr };
+        respparser::RespParser                  *mMultiParser{ nullptr };
         RedisScanPool                           mScanPool;
+        uint32_t                                mKeysRemaining{ 0 };        // Keys still to come in the KEYS reply being written
+        Callback                                *mStreamCallback{ nullptr };
+        std::vector< const void * >             mListValues;        // values of the list push being issued
+        std::vector< uint32_t >                 mListValueLengths;
+        std::vector< const char * >             mKeyList;           // keys of the multi key command being issued
+        eventloop::EventLoop                    *mEventLoop{ nullptr };
+        eventloop::EventLoopCallback            *mEventOwner{ nullptr };
 #if USE_LOG_FILE
         FILE                                    *mLogFile{ nullptr };
 #endif
@@ -11,6 +11,17 @@ namespace keyvaluedatabase
     class KeyValueDatabase;
 }
 
+namespace eventloop
+{
+    class EventLoop;
+    class EventLoopCallback;
+}
+
+namespace respparser
+{
+    class RespElement;
+}
+
 namespace redisproxy
 {
 
@@ -20,8 +31,8 @@ public:
     class Callback
     {
     public:
-        virtual void receiveRedisMessage(const char *msg) = 0;
-        virtual void receiveRedisMessage(const void *data, uint32_t dataLen) = 0;
+        // One or more complete replies, already encoded as RESP.  They are sent to the client exactly as given.
+        virtual void receiveRedisResponse(const void *data, uint32_t dataLen) = 0;
     };
     // Provides the *shared* keyvalue database that all connections talk to.
     // If 'database' is null, then a new unique data base per connection will be created
@@ -31,8 +42,25 @@ public:
 	virtual bool fromClient(const char *message) = 0;
     virtual bool fromClient(const void *data, uint32_t dataLen) = 0;
 
+    // A complete command frame, parsed in place in the client's receive buffer (see respparser::RespParser).
+    // The elements are only valid for the duration of this call.
+    virtual bool fromClient(const respparser::RespElement *elements, uint32_t elementCount) = 0;
+
+    // Hands every reply which is ready to 'c' as a single contiguous block.  Replies are always in
+    // the order the commands arrived, even when some of them wait on a backend database.
 	virtual void getToClient(Callback *c) = 0;
 
+    // Attach the proxy to the event loop which services its client connection.
+    // Whenever new responses become available (for example when a backend reply arrives) the
+    // proxy schedules 'owner' on the loop, so the owner knows to call 'getToClient'.
+    // Any backend connections owned by the proxy are registered with the loop as well.
+    virtual void setEventLoop(eventloop::EventLoop *loop, eventloop::EventLoopCallback *owner) = 0;
+
+    // Where a reply too big to hold whole (KEYS) is sent a piece at a time, along with any replies
+    // ready ahead of it, while it is still being written.  Without one it is held until the next
+    // 'getToClient'.
+    virtual void setStreamCallback(Callback *c) = 0;
+
 	virtual void release(void) = 0;
 protected:
 	virtual ~RedisProxy(void)
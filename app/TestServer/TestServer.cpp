@@ -4,7 +4,9 @@
 #include "InputLine.h"
 #include "RedisProxy.h"
 #include "KeyValueDatabase.h"
+#include "KeyValueDatabasePool.h"
 #include "InParser.h"
+#include "EventLoop.h"
 #include "Timer.h"
 #include "wplatform.h"
 
@@ -14,13 +16,18 @@
 #include <stdlib.h>
 #include <string>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #ifdef _MSC_VER
 #pragma warning(disable:4100)
 #endif
 
-#define USE_MONITOR 1
+// -monitor: every client gets its own monitored connection to redis instead of a pooled one
+static bool gUseMonitor = false;
 
+// -inmemory: serve every client from one in memory database shared by the workers instead of redis
 keyvaluedatabase::KeyValueDatabase::Provider gProvider = keyvaluedatabase::KeyValueDatabase::Provider::REDIS;
 
 typedef std::vector< std::string > StringVector;
@@ -28,20 +35,63 @@ typedef std::vector< std::string > StringVector;
 //#define PORT_NUMBER 6379    // Redis port number
 #define PORT_NUMBER 3010    // test port number
 
+#define IDLE_WAIT_TIMEOUT 100   // milliseconds; how long the event loop sleeps before checking console input
+
+#define MAX_ACCEPT_BATCH 64     // Connections accepted per call to pollServer; the accept queue is drained in batches of this size
+
+#define DEFAULT_BACKEND_CONNECTIONS 8    // Connections to the Redis backend, shared by every client and spread across the workers
+
+#define MAX_CLIENT_OUTPUT (32*1024*1024)  // A client with more than this waiting to be sent is dropped, as with Redis's client-output-buffer-limit
+
+#define LOG_CLIENT_TRAFFIC 0    // Echo every message sent to a client on the console; stdout is a lock shared by every worker thread
+
 using socketchat::SocketChat;
 
 
+// Print each line of a block of replies; anything which is not printable is shown as hex
+static void printResponse(const void *data, uint32_t dataLen)
+{
+    const uint8_t *scan = (const uint8_t *)data;
+    bool startOfLine = true;
+    for (uint32_t i = 0; i < dataLen; i++)
+    {
+        uint8_t c = scan[i];
+        if (startOfLine)
+        {
+            printf("FromRedis:");
+            startOfLine = false;
+        }
+        if (c == 13 && (i + 1) < dataLen && scan[i + 1] == 10)
+        {
+            printf("\r\n");
+            startOfLine = true;
+            i++;
+        }
+        else if (c >= 32 && c <= 127)
+        {
+            printf("%c", c);
+        }
+        else
+        {
+            printf("$%02X", c);
+        }
+    }
+}
+
 class SendFile : public IN_PARSER::InPlaceParserInterface, public redisproxy::RedisProxy::Callback
 {
 public:
     SendFile(void)
     {
-#if !USE_MONITOR
-        mDatabase = keyvaluedatabase::KeyValueDatabase::create(gProvider);
-        mRedisProxy = redisproxy::RedisProxy::create(mDatabase);
-#else
-        mRedisProxy = redisproxy::RedisProxy::createMonitor();
-#endif
+        if (gUseMonitor)
+        {
+            mRedisProxy = redisproxy::RedisProxy::createMonitor();
+        }
+        else
+        {
+            mDatabase = keyvaluedatabase::KeyValueDatabase::create(gProvider);
+            mRedisProxy = redisproxy::RedisProxy::create(mDatabase);
+        }
     }
 
     virtual ~SendFile(void)
@@ -104,46 +154,9 @@ public:
         return true;
     }
 
-    virtual void receiveRedisMessage(const char *msg) override final
-    {
-#if 0
-        static uint32_t gCount = 0;
-        gCount++;
-        if ( (gCount%1000) == 0 )
-        {
-            printf("Received: %d message from Redis\r\n", gCount);
-        }
-#else
-        printf("FromRedis:%s\r\n", msg);
-#endif
-    }
-
-    virtual void receiveRedisMessage(const void *msg, uint32_t dataLen)
+    virtual void receiveRedisResponse(const void *data, uint32_t dataLen) override final
     {
-#if 0
-        static uint32_t gCount = 0;
-        gCount++;
-        if ((gCount % 1000) == 0)
-        {
-            printf("Received: %d message from Redis\r\n", gCount);
-        }
-#elise
-        printf("FromRedis:");
-        const uint8_t *scan = (const uint8_t *)msg;
-        for (uint32_t i = 0; i < dataLen; i++)
-        {
-            uint8_t c = scan[i];
-            if (c >= 32 && c <= 127)
-            {
-                printf("%c", c);
-            }
-            else
-            {
-                printf("$%02X", c);
-            }
-        }
-        printf("\r\n");
-#endif
+        printResponse(data, dataLen);
     }
 
     uint32_t                            mIndex{ 0 };
@@ -152,21 +165,44 @@ public:
     redisproxy::RedisProxy              *mRedisProxy{ nullptr };
 };
 
-class ClientConnection : public socketchat::SocketChatCallback, public redisproxy::RedisProxy::Callback
+class ClientConnection;
+
+typedef std::vector< ClientConnection * > ClientConnectionVector;
+
+// A client connection is only pumped when the event loop reports activity on its socket,
+// or when its redis proxy schedules it because new responses are ready.
+class ClientConnection : public socketchat::SocketChatFrameCallback, public redisproxy::RedisProxy::Callback, public eventloop::EventLoopCallback
 {
 public:
-	ClientConnection(wsocket::Wsocket *client,uint32_t id,keyvaluedatabase::KeyValueDatabase *dataBase) : mId(id), mDatabase(dataBase)
+	ClientConnection(wsocket::Wsocket *client,uint32_t id,keyvaluedatabase::KeyValueDatabase *dataBase,eventloop::EventLoop *eventLoop,ClientConnectionVector &closed) : mId(id), mDatabase(dataBase), mEventLoop(eventLoop), mClosed(closed)
 	{
 		mClient = socketchat::SocketChat::create(client);
-#if !USE_MONITOR
-        mRedisProxy = redisproxy::RedisProxy::create(mDatabase);
-#else
-        mRedisProxy = redisproxy::RedisProxy::createMonitor();
-#endif
+        if (gUseMonitor)
+        {
+            mRedisProxy = redisproxy::RedisProxy::createMonitor();
+        }
+        else
+        {
+            mRedisProxy = redisproxy::RedisProxy::create(mDatabase);
+        }
+        if (mEventLoop && mClient)
+        {
+            mEventLoop->addSocket(mClient->getSocket(), this);
+            mRedisProxy->setEventLoop(mEventLoop, this);
+        }
+        mRedisProxy->setStreamCallback(this);
 	}
 
 	virtual ~ClientConnection(void)
 	{
+        if (mEventLoop)
+        {
+            if (mClient)
+            {
+                mEventLoop->removeSocket(mClient->getSocket());
+            }
+            mEventLoop->cancel(this);
+        }
 		delete mClient;
         if (mRedisProxy)
         {
@@ -179,41 +215,69 @@ public:
 		return mId;
 	}
 
-    virtual void receiveRedisMessage(const char *msg) override final
+    // Also called part way through a long reply, such as KEYS, each time a chunk of it is ready
+    virtual void receiveRedisResponse(const void *data, uint32_t dataLen) override final
     {
-        printf("Sending: %s\r\n", msg);
-        mClient->sendText(msg);
+        if (!isConnected())
+        {
+            return; // dropped; the rest of the reply goes nowhere
+        }
+#if LOG_CLIENT_TRAFFIC
+        printResponse(data, dataLen);
+#endif
+        mClient->sendRaw(data, dataLen);
+        flushClient();
     }
 
-    virtual void receiveRedisMessage(const void *data, uint32_t dataLen) override final
+    // A client which does not read its replies would otherwise have them pile up without limit
+    void flushClient(void)
     {
-        printf("Sending:");
-        const uint8_t *scan = (const uint8_t *)data;
-        for (uint32_t i = 0; i < dataLen; i++)
+        mClient->flush();
+        if (mClient->getTransmitBufferSize() > MAX_CLIENT_OUTPUT)
         {
-            uint8_t c = scan[i];
-            if (c >= 32 && c <= 127)
-            {
-                printf("%c", c);
-            }
-            else
-            {
-                printf("$%02X", c);
-            }
+            printf("Client %d has more than %d bytes of replies unread; dropping it.\r\n", mId, MAX_CLIENT_OUTPUT);
+            mClient->abort();
         }
-        printf("\r\n");
-        mClient->sendBinary(data, dataLen);
     }
 
+    // Run every complete command which has arrived, then send all of the replies which are ready
+    // with a single write
     void pump(void)
 	{
 		if (mClient)
 		{
-            mRedisProxy->getToClient(this);
-			mClient->poll(this, 1);
+			mClient->pollFrames(this, 0);
+            flushResponses();
 		}
 	}
 
+    void flushResponses(void)
+    {
+        if (mClient)
+        {
+            mRedisProxy->getToClient(this);
+            flushClient();
+        }
+    }
+
+    // Socket activity, or our proxy has responses waiting to be sent
+    virtual void onEvent(uint32_t events) override final
+    {
+        if (events)
+        {
+            pump();
+        }
+        else
+        {
+            flushResponses(); // scheduled by the proxy; there is nothing new to read
+        }
+        if (!isConnected() && !mIsClosed)
+        {
+            mIsClosed = true;
+            mClosed.push_back(this); // the worker deletes it once the event loop has finished dispatching
+        }
+    }
+
 	void sendText(const char *str)
 	{
 		if (mClient)
@@ -222,15 +286,18 @@ public:
 		}
 	}
 
-	virtual void receiveMessage(const char *message) override final
-	{
-        mRedisProxy->fromClient(message);
-	}
-
+    virtual void receiveFrame(const respparser::RespElement *elements, uint32_t elementCount) override final
+    {
+        mRedisProxy->fromClient(elements, elementCount);
+    }
 
-    virtual void receiveBinaryMessage(const void *data, uint32_t dataLen) override final
+    // Flush any responses which are already queued, then report the error; the connection is closed after it is sent
+    virtual void receiveProtocolError(const char *error) override final
     {
-        mRedisProxy->fromClient(data, dataLen);
+        mRedisProxy->getToClient(this);
+        char scratch[512];
+        snprintf(scratch, sizeof(scratch), "-ERR %s", error);
+        mClient->sendText(scratch);
     }
 
 	bool isConnected(void)
@@ -247,26 +314,331 @@ public:
 
 	socketchat::SocketChat	            *mClient{ nullptr };
 	uint32_t				            mId{ 0 };
+    uint32_t                            mSlot{ 0 };         // index of this connection in the worker's client list
+    bool                                mIsClosed{ false };
     redisproxy::RedisProxy              *mRedisProxy{ nullptr };
     keyvaluedatabase::KeyValueDatabase  *mDatabase{ nullptr };
+    eventloop::EventLoop                *mEventLoop{ nullptr };
+    ClientConnectionVector              &mClosed;
 };
 
-typedef std::vector< ClientConnection * > ClientConnectionVector;
+typedef std::vector< wsocket::Wsocket * > WsocketVector;
+
+static std::atomic<uint32_t> gClientCount{ 0 };    // used to hand out client connection ids
+
+// A worker thread owns its own event loop and every client connection handed to it.
+// With the REDIS provider each worker also owns its own pool of backend connections, which
+// its clients share, so requests never touch state belonging to another worker. A client
+// started with -monitor bypasses the pool and opens a redis connection of its own.
+// A worker may also own a listening socket (SO_REUSEPORT mode), in which case it accepts
+// its own connections and the kernel balances them across the workers.
+class ProxyWorker : public eventloop::EventLoopCallback
+{
+public:
+    // Without a shared database, the worker's clients are multiplexed onto its own pool of
+    // 'backendConnections' connections to the backend
+    ProxyWorker(uint32_t index, keyvaluedatabase::KeyValueDatabase *sharedDatabase, uint32_t backendConnections, wsocket::Wsocket *listener) : mIndex(index), mListener(listener)
+    {
+        mEventLoop = eventloop::EventLoop::create();
+        if (mEventLoop && mListener)
+        {
+            mEventLoop->addSocket(mListener, this);
+        }
+        mDatabase = sharedDatabase;
+        // A monitored client opens its own redis connection, so it has no use for the pool
+        if (mDatabase == nullptr && !gUseMonitor)
+        {
+            mDatabasePool = keyvaluedatabasepool::KeyValueDatabasePool::create(backendConnections);
+            if (mEventLoop)
+            {
+                mDatabasePool->setEventLoop(mEventLoop);
+            }
+        }
+        mThread = new std::thread([this]()
+        {
+            run();
+        });
+    }
+
+    virtual ~ProxyWorker(void)
+    {
+        if (mThread)
+        {
+            mExit = true;
+            if (mEventLoop)
+            {
+                mEventLoop->wakeup();
+            }
+            mThread->join();
+            delete mThread;
+        }
+        for (auto &i : mClients)
+        {
+            destroyConnection(i);
+        }
+        for (auto &i : mPending)
+        {
+            i.mSocket->release();
+        }
+        if (mListener)
+        {
+            if (mEventLoop)
+            {
+                mEventLoop->removeSocket(mListener);
+            }
+            mListener->release();
+        }
+        if (mDatabasePool)
+        {
+            mDatabasePool->release();
+        }
+        if (mEventLoop)
+        {
+            mEventLoop->release();
+        }
+    }
+
+    // Called by the accepting thread; the connection is created on the worker thread itself
+    void addClient(wsocket::Wsocket *socket, uint32_t id)
+    {
+        mConnectionCount++;
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            PendingClient pc;
+            pc.mSocket = socket;
+            pc.mId = id;
+            mPending.push_back(pc);
+        }
+        mHavePending = true;
+        if (mEventLoop)
+        {
+            mEventLoop->wakeup();
+        }
+    }
+
+    uint32_t getConnectionCount(void) const
+    {
+        return mConnectionCount;
+    }
+
+    uint32_t getIndex(void) const
+    {
+        return mIndex;
+    }
+
+    // Our listening socket is readable; drain its accept queue
+    virtual void onEvent(uint32_t events) override final
+    {
+        wsocket::Wsocket *clients[MAX_ACCEPT_BATCH];
+        uint32_t count;
+        while (mListener && (count = mListener->pollServer(clients, MAX_ACCEPT_BATCH)) != 0)
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                uint32_t index = ++gClientCount;
+                printf("New client connection (%d) established on worker %d.\r\n", index, mIndex);
+                mConnectionCount++;
+                addConnection(clients[i], index);
+            }
+        }
+    }
+
+private:
+    class PendingClient
+    {
+    public:
+        wsocket::Wsocket    *mSocket{ nullptr };
+        uint32_t            mId{ 0 };
+    };
+
+    typedef std::vector< PendingClient > PendingClientVector;
+
+    void run(void)
+    {
+        while (!mExit)
+        {
+            if (mEventLoop)
+            {
+                mEventLoop->wait(IDLE_WAIT_TIMEOUT);
+            }
+            else
+            {
+                // No event loop available; fall back to polling every connection
+                onEvent(eventloop::EventLoop::READABLE);
+                for (auto &i : mClients)
+                {
+                    i->onEvent(eventloop::EventLoop::READABLE);
+                }
+                wplatform::sleepNano(1000);
+            }
+            // Also when every connection is idle, so keys keep expiring
+            if (mDatabase)
+            {
+                mDatabase->pump();
+            }
+            addPendingClients();
+            reapClosedConnections();
+        }
+    }
+
+    void addPendingClients(void)
+    {
+        if (!mHavePending)
+        {
+            return;
+        }
+        PendingClientVector pending;
+        {
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            pending.swap(mPending);
+            mHavePending = false;
+        }
+        for (auto &i : pending)
+        {
+            addConnection(i.mSocket, i.mId);
+        }
+    }
+
+    // A client is turned away if there is no backend connection for it, rather than given a
+    // connection of its own, so a backend which is down is not flooded with attempts
+    void addConnection(wsocket::Wsocket *socket, uint32_t id)
+    {
+        keyvaluedatabase::KeyValueDatabase *database = mDatabasePool ? mDatabasePool->acquireDatabase() : mDatabase;
+        if (mDatabasePool && database == nullptr)
+        {
+            printf("No backend connection for client: %d\r\n", id);
+            socket->release();
+            mConnectionCount--;
+            return;
+        }
+        ClientConnection *cc = new ClientConnection(socket, id, database, mEventLoop, mClosed);
+        cc->mSlot = uint32_t(mClients.size());
+        mClients.push_back(cc);
+    }
+
+    // The connection cancels its pending backend callbacks as it is destroyed; only then can
+    // its pooled connection be handed to someone else
+    void destroyConnection(ClientConnection *cc)
+    {
+        keyvaluedatabase::KeyValueDatabase *database = cc->mDatabase;
+        delete cc;
+        if (mDatabasePool && database)
+        {
+            mDatabasePool->releaseDatabase(database);
+        }
+    }
+
+    // Delete any connections which were closed while dispatching events
+    void reapClosedConnections(void)
+    {
+        for (auto &cc : mClosed)
+        {
+            printf("Lost connection to client: %d\r\n", cc->getId());
+            ClientConnection *last = mClients.back();
+            mClients[cc->mSlot] = last;
+            last->mSlot = cc->mSlot;
+            mClients.pop_back();
+            destroyConnection(cc);
+            mConnectionCount--;
+        }
+        mClosed.clear();
+    }
+
+    uint32_t                            mIndex{ 0 };
+    std::thread                         *mThread{ nullptr };
+    std::atomic<bool>                   mExit{ false };
+    std::atomic<uint32_t>               mConnectionCount{ 0 };  // connections owned or pending; used for load balancing
+    std::atomic<bool>                   mHavePending{ false };
+    std::mutex                          mPendingMutex;
+    PendingClientVector                 mPending;               // sockets accepted but not yet picked up by this thread
+    eventloop::EventLoop                *mEventLoop{ nullptr };
+    wsocket::Wsocket                    *mListener{ nullptr };  // only in SO_REUSEPORT mode
+    keyvaluedatabase::KeyValueDatabase  *mDatabase{ nullptr };      // shared in memory database
+    keyvaluedatabasepool::KeyValueDatabasePool *mDatabasePool{ nullptr };  // this worker's backend connections
+    ClientConnectionVector              mClients;
+    ClientConnectionVector              mClosed;                // connections which dropped during the last wait
+};
 
-class SimpleServer : public redisproxy::RedisProxy::Callback
+typedef std::vector< ProxyWorker * > ProxyWorkerVector;
+
+class SimpleServer : public redisproxy::RedisProxy::Callback, public eventloop::EventLoopCallback
 {
 public:
-	SimpleServer(void)
+	SimpleServer(uint32_t workerCount,bool reusePort,uint32_t backendConnections,uint64_t maxMemory,keyvaluedatabase::EvictionPolicy policy,bool keyIndex,uint32_t databaseCount)
 	{
-		mServerSocket = wsocket::Wsocket::create(SOCKET_SERVER, PORT_NUMBER);
+        if (workerCount == 0)
+        {
+            workerCount = 1;
+        }
+        // In SO_REUSEPORT mode every worker gets its own listener; if any of them cannot be
+        // opened we fall back to a single listener which hands connections to the workers.
+        WsocketVector listeners;
+        if (reusePort)
+        {
+            for (uint32_t i = 0; i < workerCount; i++)
+            {
+                wsocket::Wsocket *listener = wsocket::Wsocket::create(SOCKET_SERVER_REUSEPORT, PORT_NUMBER);
+                if (listener == nullptr)
+                {
+                    printf("Unable to open a SO_REUSEPORT listener; using a single listening socket.\r\n");
+                    for (auto &l : listeners)
+                    {
+                        l->release();
+                    }
+                    listeners.clear();
+                    break;
+                }
+                listeners.push_back(listener);
+            }
+        }
+        if (listeners.empty())
+        {
+            mServerSocket = wsocket::Wsocket::create(SOCKET_SERVER, PORT_NUMBER);
+        }
 		mInputLine = inputline::InputLine::create();
-        mDatabase = keyvaluedatabase::KeyValueDatabase::create(gProvider);
-#if USE_MONITOR
-        mRedisProxy = redisproxy::RedisProxy::createMonitor();
-#else
-        mRedisProxy = redisproxy::RedisProxy::create(mDatabase);
-#endif
-		printf("Redis proxy server started.\r\n");
+        mEventLoop = eventloop::EventLoop::create();
+        mDatabase = keyvaluedatabase::KeyValueDatabase::create(gProvider, databaseCount);
+        if (maxMemory || policy != keyvaluedatabase::EvictionPolicy::NO_EVICTION)
+        {
+            mDatabase->setMaxMemory(maxMemory, policy);
+        }
+        if (keyIndex)
+        {
+            mDatabase->setKeyIndex(true);
+        }
+        // The in memory database is shared by every worker, otherwise each worker gets its own backend connection
+        keyvaluedatabase::KeyValueDatabase *shared = gProvider == keyvaluedatabase::KeyValueDatabase::IN_MEMORY ? mDatabase : nullptr;
+        // Backend connections belong to the thread which uses them, so the pool is split between
+        // the workers; every worker needs at least one
+        if (backendConnections < workerCount)
+        {
+            backendConnections = workerCount;
+        }
+        for (uint32_t i = 0; i < workerCount; i++)
+        {
+            uint32_t connections = backendConnections / workerCount + (i < (backendConnections % workerCount) ? 1 : 0);
+            mWorkers.push_back(new ProxyWorker(i, shared, connections, listeners.empty() ? nullptr : listeners[i]));
+        }
+        if (mEventLoop)
+        {
+            if (mServerSocket)
+            {
+                mEventLoop->addSocket(mServerSocket, this);
+            }
+            if (mDatabase)
+            {
+                mDatabase->setEventLoop(mEventLoop);
+            }
+        }
+        if (gUseMonitor)
+        {
+            mRedisProxy = redisproxy::RedisProxy::createMonitor();
+        }
+        else
+        {
+            mRedisProxy = redisproxy::RedisProxy::create(mDatabase);
+        }
+		printf("Redis proxy server started with %d worker threads%s.\r\n", workerCount, listeners.empty() ? "" : " (SO_REUSEPORT)");
 		printf("Type 'bye', 'quit', or 'exit' to stop the server.\r\n");
 		printf("Type anything else to send as a broadcast message to all current client connections.\r\n");
 	}
@@ -281,20 +653,67 @@ public:
 		{
 			mInputLine->release();
 		}
-		for (auto &i : mClients)
+		for (auto &i : mWorkers)
 		{
 			delete i;
 		}
 		if (mServerSocket)
 		{
+            if (mEventLoop)
+            {
+                mEventLoop->removeSocket(mServerSocket);
+            }
 			mServerSocket->release();
 		}
         if (mDatabase)
         {
             mDatabase->release();
         }
+        if (mEventLoop)
+        {
+            mEventLoop->release();
+        }
 	}
 
+    // The listening socket is readable; accept every pending connection since
+    // we will not be notified again until a new one arrives.
+    virtual void onEvent(uint32_t events) override final
+    {
+        wsocket::Wsocket *clients[MAX_ACCEPT_BATCH];
+        uint32_t count;
+        while (mServerSocket && (count = mServerSocket->pollServer(clients, MAX_ACCEPT_BATCH)) != 0)
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                uint32_t index = ++gClientCount;
+                ProxyWorker *worker = getLeastLoadedWorker();
+                printf("New client connection (%d) established on worker %d.\r\n", index, worker->getIndex());
+                worker->addClient(clients[i], index);
+            }
+        }
+    }
+
+    // Hand connections to the worker with the fewest; ties are broken round robin
+    ProxyWorker *getLeastLoadedWorker(void)
+    {
+        uint32_t count = uint32_t(mWorkers.size());
+        uint32_t start = mNextWorker;
+        mNextWorker = (mNextWorker + 1) % count;
+        ProxyWorker *ret = mWorkers[start];
+        uint32_t best = ret->getConnectionCount();
+        for (uint32_t i = 1; i < count && best; i++)
+        {
+            ProxyWorker *w = mWorkers[(start + i) % count];
+            uint32_t c = w->getConnectionCount();
+            if (c < best)
+            {
+                best = c;
+                ret = w;
+            }
+        }
+        return ret;
+    }
+
 	void run(void)
 	{
 		bool exit = false;
@@ -302,18 +721,18 @@ public:
         SendFile *sf = nullptr;
 		while (!exit)
 		{
-			if (mServerSocket)
-			{
-				wsocket::Wsocket *clientSocket = mServerSocket->pollServer();
-
-				if (clientSocket)
-				{
-					uint32_t index = uint32_t(mClients.size()) + 1;
-					ClientConnection *cc = new ClientConnection(clientSocket, index,mDatabase);
-					printf("New client connection (%d) established.\r\n", index);
-					mClients.push_back(cc);
-				}
-			}
+            if (mEventLoop)
+            {
+                // Sleeps until a socket has activity; only ready connections get pumped
+                mEventLoop->wait(sf ? 0 : IDLE_WAIT_TIMEOUT);
+            }
+            else
+            {
+                // No event loop available; fall back to polling the listener
+                onEvent(eventloop::EventLoop::READABLE);
+                wplatform::sleepNano(1000);
+            }
+            mDatabase->pump();
 
 			if (mInputLine)
 			{
@@ -363,76 +782,112 @@ public:
             }
 
             mRedisProxy->getToClient(this);
-
-			// See if any clients have dropped connection
-			bool killed = true;
-			while (killed)
-			{
-				killed = false;
-				for (ClientConnectionVector::iterator i = mClients.begin(); i != mClients.end(); ++i)
-				{
-					if (!(*i)->isConnected() )
-					{
-						killed = true;
-						ClientConnection *cc = (*i);
-						printf("Lost connection to client: %d\r\n", cc->getId());
-						delete cc;
-						mClients.erase(i);
-						break;
-					}
-				}
-			}
-
-			// For each active client connection..
-			// we see if that client has received a new message
-			// If we have received a message from a client, then we echo that message back to
-			// all currently connected clients
-			for (auto &i : mClients)
-			{
-                i->pump();
-			}
 		}
         delete sf;
 	}
 
-    virtual void receiveRedisMessage(const char *msg) override final
+    virtual void receiveRedisResponse(const void *data, uint32_t dataLen) override final
     {
-        printf("FromRedis:%s\r\n", msg);
-    }
-
-    virtual void receiveRedisMessage(const void *data, uint32_t dataLen) override final
-    {
-        printf("FromRedis:");
-        const uint8_t *scan = (const uint8_t *)data;
-        for (uint32_t i = 0; i < dataLen; i++)
-        {
-            uint8_t c = scan[i];
-            if (c >= 32 && c <= 127)
-            {
-                printf("%c", c);
-            }
-            else
-            {
-                printf("$%02X", c);
-            }
-        }
-        printf("\r\n");
+        printResponse(data, dataLen);
     }
 
     redisproxy::RedisProxy              *mRedisProxy{ nullptr };
 	wsocket::Wsocket		            *mServerSocket{ nullptr };
 	inputline::InputLine	            *mInputLine{ nullptr };
-	ClientConnectionVector	            mClients;
+    eventloop::EventLoop                *mEventLoop{ nullptr };
+    uint32_t                            mNextWorker{ 0 };
+    ProxyWorkerVector                   mWorkers;
     keyvaluedatabase::KeyValueDatabase  *mDatabase{ nullptr };
 };
 
 
-int main()
+int main(int argc,const char **argv)
 {
+    uint32_t workerCount = std::thread::hardware_concurrency();
+    bool reusePort = false;
+    uint32_t backendConnections = DEFAULT_BACKEND_CONNECTIONS;
+    uint64_t maxMemory = 0;
+    keyvaluedatabase::EvictionPolicy policy = keyvaluedatabase::EvictionPolicy::NO_EVICTION;
+    bool keyIndex = false;
+    uint32_t databaseCount = KVD_DEFAULT_DATABASES;
+    bool usage = false;
+    for (int i = 1; i < argc && !usage; i++)
+    {
+        if (strcmp(argv[i], "-workers") == 0 && (i + 1) < argc)
+        {
+            i++;
+            workerCount = uint32_t(atoi(argv[i]));
+        }
+        else if (strcmp(argv[i], "-reuseport") == 0)
+        {
+            reusePort = true;
+        }
+        else if (strcmp(argv[i], "-monitor") == 0)
+        {
+            gUseMonitor = true;
+        }
+        else if (strcmp(argv[i], "-inmemory") == 0)
+        {
+            gProvider = keyvaluedatabase::KeyValueDatabase::Provider::IN_MEMORY;
+        }
+        else if (strcmp(argv[i], "-backends") == 0 && (i + 1) < argc)
+        {
+            i++;
+            backendConnections = uint32_t(atoi(argv[i]));
+        }
+        else if (strcmp(argv[i], "-maxmemory") == 0 && (i + 1) < argc)
+        {
+            i++;
+            usage = !keyvaluedatabase::parseMemorySize(argv[i], maxMemory);
+        }
+        else if (strcmp(argv[i], "-maxmemory-policy") == 0 && (i + 1) < argc)
+        {
+            i++;
+            usage = !keyvaluedatabase::getEvictionPolicy(argv[i], policy);
+        }
+        else if (strcmp(argv[i], "-keyindex") == 0)
+        {
+            keyIndex = true;
+        }
+        else if (strcmp(argv[i], "-databases") == 0 && (i + 1) < argc)
+        {
+            i++;
+            databaseCount = uint32_t(atoi(argv[i]));
+            usage = databaseCount == 0;
+        }
+        else
+        {
+            usage = true;
+        }
+    }
+    // Redis enforces its own memory limit and has no key index, and a monitored client never reaches the database at all
+    bool inMemory = gProvider == keyvaluedatabase::KeyValueDatabase::Provider::IN_MEMORY;
+    if (!usage && !inMemory && (maxMemory || policy != keyvaluedatabase::EvictionPolicy::NO_EVICTION))
+    {
+        printf("-maxmemory and -maxmemory-policy require -inmemory.\r\n");
+        usage = true;
+    }
+    if (!usage && inMemory && gUseMonitor)
+    {
+        printf("-monitor forwards to redis and cannot be combined with -inmemory.\r\n");
+        usage = true;
+    }
+    if (!usage && !inMemory && keyIndex)
+    {
+        printf("-keyindex requires -inmemory.\r\n");
+        usage = true;
+    }
+    if (usage)
+    {
+        printf("Usage: TestServer [-workers <count>] [-reuseport] [-monitor] [-backends <count>] [-inmemory] [-maxmemory <bytes>] [-maxmemory-policy <policy>] [-keyindex] [-databases <count>]\r\n");
+        printf("Policies: noeviction, allkeys-lru, allkeys-lfu, volatile-ttl, allkeys-random\r\n");
+        return 1;
+    }
+
 	socketchat::socketStartup();
 	// Run the simple server
 	{
-		SimpleServer ss;
+		SimpleServer ss(workerCount, reusePort, backendConnections, maxMemory, policy, keyIndex, databaseCount);
 		ss.run();
 	}
 
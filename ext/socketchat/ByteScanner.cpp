@@ -0,0 +1,260 @@
+#include "ByteScanner.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define USE_X86_SIMD 1  // SSE2 is part of the x86-64 baseline; AVX2 is detected at run time
+#else
+#define USE_X86_SIMD 0
+#endif
+
+#if USE_X86_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define CR 13
+#define LF 10
+#define FIRST_PRINTABLE 32  // Anything below this (or with the high bit set) is treated as binary
+
+namespace bytescanner
+{
+
+    typedef bool (*FindLineEndFunction)(const uint8_t *data, uint32_t dataLen, uint32_t &offset, bool &isBinary);
+    typedef bool (*IsBinaryFunction)(const uint8_t *data, uint32_t dataLen);
+
+    class Implementation
+    {
+    public:
+        const char          *mName{ nullptr };
+        FindLineEndFunction mFindLineEnd{ nullptr };
+        IsBinaryFunction    mIsBinary{ nullptr };
+    };
+
+    static bool findLineEndPortable(const uint8_t *data, uint32_t dataLen, uint32_t &offset, bool &isBinary)
+    {
+        uint32_t i = offset;
+        // A CR in the last byte might be the start of a line end whose LF has not arrived yet,
+        // so it is left for the next search
+        for (; (i + 1) < dataLen; i++)
+        {
+            uint8_t c = data[i];
+            if (c == CR && data[i + 1] == LF)
+            {
+                offset = i;
+                return true;
+            }
+            else if (c < FIRST_PRINTABLE || c > 127)
+            {
+                isBinary = true;
+            }
+        }
+        offset = i;
+        return false;
+    }
+
+    static bool isBinaryPortable(const uint8_t *data, uint32_t dataLen)
+    {
+        for (uint32_t i = 0; i < dataLen; i++)
+        {
+            uint8_t c = data[i];
+            if (c < FIRST_PRINTABLE || c > 127)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+#if USE_X86_SIMD
+
+    static inline uint32_t countTrailingZeros(uint32_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, v);
+        return uint32_t(index);
+#else
+        return uint32_t(__builtin_ctz(v));
+#endif
+    }
+
+    // Each block compares the bytes at i and i+1, so a CR/LF pair which straddles two blocks is
+    // still found.  Bytes compare as signed, which puts everything with the high bit set below 32.
+    static bool findLineEndSSE2(const uint8_t *data, uint32_t dataLen, uint32_t &offset, bool &isBinary)
+    {
+        const __m128i cr = _mm_set1_epi8(CR);
+        const __m128i lf = _mm_set1_epi8(LF);
+        const __m128i printable = _mm_set1_epi8(FIRST_PRINTABLE);
+        uint32_t i = offset;
+        while ((i + 17) <= dataLen)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128i next = _mm_loadu_si128((const __m128i *)(data + i + 1));
+            uint32_t lineEnd = uint32_t(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(next, lf))));
+            uint32_t binary = uint32_t(_mm_movemask_epi8(_mm_cmplt_epi8(v, printable)));
+            if (lineEnd)
+            {
+                uint32_t bit = countTrailingZeros(lineEnd);
+                if (binary & ((1u << bit) - 1))
+                {
+                    isBinary = true;
+                }
+                offset = i + bit;
+                return true;
+            }
+            if (binary)
+            {
+                isBinary = true;
+            }
+            i += 16;
+        }
+        offset = i;
+        return findLineEndPortable(data, dataLen, offset, isBinary);
+    }
+
+    static bool isBinarySSE2(const uint8_t *data, uint32_t dataLen)
+    {
+        const __m128i printable = _mm_set1_epi8(FIRST_PRINTABLE);
+        uint32_t i = 0;
+        for (; (i + 16) <= dataLen; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+            if (_mm_movemask_epi8(_mm_cmplt_epi8(v, printable)))
+            {
+                return true;
+            }
+        }
+        return isBinaryPortable(data + i, dataLen - i);
+    }
+
+    TARGET_AVX2 static bool findLineEndAVX2(const uint8_t *data, uint32_t dataLen, uint32_t &offset, bool &isBinary)
+    {
+        const __m256i cr = _mm256_set1_epi8(CR);
+        const __m256i lf = _mm256_set1_epi8(LF);
+        const __m256i printable = _mm256_set1_epi8(FIRST_PRINTABLE);
+        uint32_t i = offset;
+        while ((i + 33) <= dataLen)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i next = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+            uint32_t lineEnd = uint32_t(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(next, lf))));
+            uint32_t binary = uint32_t(_mm256_movemask_epi8(_mm256_cmpgt_epi8(printable, v)));
+            if (lineEnd)
+            {
+                uint32_t bit = countTrailingZeros(lineEnd);
+                if (binary & ((1u << bit) - 1))
+                {
+                    isBinary = true;
+                }
+                offset = i + bit;
+                return true;
+            }
+            if (binary)
+            {
+                isBinary = true;
+            }
+            i += 32;
+        }
+        offset = i;
+        return findLineEndSSE2(data, dataLen, offset, isBinary);
+    }
+
+    TARGET_AVX2 static bool isBinaryAVX2(const uint8_t *data, uint32_t dataLen)
+    {
+        const __m256i printable = _mm256_set1_epi8(FIRST_PRINTABLE);
+        uint32_t i = 0;
+        for (; (i + 32) <= dataLen; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+            if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(printable, v)))
+            {
+                return true;
+            }
+        }
+        return isBinarySSE2(data + i, dataLen - i);
+    }
+
+    static bool haveAVX2(void)
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        __cpuid(info, 1);
+        const int osxsave = (1 << 27);
+        const int avx = (1 << 28);
+        if ((info[2] & (osxsave | avx)) != (osxsave | avx))
+        {
+            return false;
+        }
+        // The operating system must save the upper halves of the vector registers
+        if ((_xgetbv(0) & 6) != 6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+
+#endif
+
+    static Implementation selectImplementation(void)
+    {
+        Implementation ret;
+        ret.mName = "portable";
+        ret.mFindLineEnd = findLineEndPortable;
+        ret.mIsBinary = isBinaryPortable;
+#if USE_X86_SIMD
+        if (haveAVX2())
+        {
+            ret.mName = "avx2";
+            ret.mFindLineEnd = findLineEndAVX2;
+            ret.mIsBinary = isBinaryAVX2;
+        }
+        else
+        {
+            ret.mName = "sse2";
+            ret.mFindLineEnd = findLineEndSSE2;
+            ret.mIsBinary = isBinarySSE2;
+        }
+#endif
+        return ret;
+    }
+
+    static const Implementation &getImplementation(void)
+    {
+        static const Implementation gImplementation = selectImplementation();
+        return gImplementation;
+    }
+
+    bool findLineEnd(const uint8_t *data, uint32_t dataLen, uint32_t &offset, bool &isBinary)
+    {
+        return getImplementation().mFindLineEnd(data, dataLen, offset, isBinary);
+    }
+
+    bool isBinary(const uint8_t *data, uint32_t dataLen)
+    {
+        return getImplementation().mIsBinary(data, dataLen);
+    }
+
+    const char *getImplementationName(void)
+    {
+        return getImplementation().mName;
+    }
+
+}
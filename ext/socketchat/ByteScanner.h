@@ -0,0 +1,25 @@
+#pragma once
+
+// Vectorized scanning of received data for line ends (CR/LF pairs) and non printable bytes.
+// Uses AVX2 or SSE2 when the processor supports it (chosen once, at run time) and a portable
+// byte at a time loop everywhere else.
+#include <stdint.h>
+
+namespace bytescanner
+{
+
+	// Searches for the first CR/LF pair in 'data', starting at 'offset'.
+	// Returns true if one was found, with 'offset' set to the position of the CR.
+	// Otherwise 'offset' is set to the position the search should resume from once more data
+	// has arrived, so a partial line is never scanned twice.
+	// 'isBinary' is set (never cleared) if any byte scanned ahead of the line end is a control
+	// character or has the high bit set.
+	bool findLineEnd(const uint8_t *data, uint32_t dataLen, uint32_t &offset, bool &isBinary);
+
+	// Returns true if any byte in 'data' is a control character or has the high bit set
+	bool isBinary(const uint8_t *data, uint32_t dataLen);
+
+	// Name of the implementation selected for this processor ("avx2", "sse2" or "portable")
+	const char *getImplementationName(void);
+
+}
@@ -0,0 +1,404 @@
+#include "EventLoop.h"
+#include "wsocket.h"
+#include "wplatform.h"
+
+#include <assert.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#elif defined(_WIN32)
+#ifndef FD_SETSIZE
+#define FD_SETSIZE 1024
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <WinSock2.h>
+#else
+#include <sys/select.h>
+#include <sys/time.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define MAX_EVENTS_PER_WAIT 256     // Maximum number of socket events collected by a single wait
+#define MAX_SCHEDULE_ROUNDS 16      // Scheduled callbacks may schedule more work; bound how many rounds we run per wait
+#define FALLBACK_MAX_WAIT 10        // Without a wakeup handle, never block in select longer than this (milliseconds)
+
+namespace eventloop
+{
+
+    class ReadyEvent
+    {
+    public:
+        EventLoopCallback   *mCallback{ nullptr };
+        uint32_t            mEvents{ 0 };
+    };
+
+    typedef std::vector< ReadyEvent > ReadyEventVector;
+    typedef std::vector< EventLoopCallback * > EventLoopCallbackVector;
+
+    // Dispatch logic shared by every platform implementation
+    class EventLoopBase : public EventLoop
+    {
+    public:
+        virtual void schedule(EventLoopCallback *callback) override final
+        {
+            mScheduled.push_back(callback);
+        }
+
+        virtual void cancel(EventLoopCallback *callback) override final
+        {
+            for (auto &i : mScheduled)
+            {
+                if (i == callback)
+                {
+                    i = nullptr;
+                }
+            }
+            for (auto &i : mDispatching)
+            {
+                if (i == callback)
+                {
+                    i = nullptr;
+                }
+            }
+            for (uint32_t i = mReadyIndex; i < uint32_t(mReady.size()); i++)
+            {
+                if (mReady[i].mCallback == callback)
+                {
+                    mReady[i].mCallback = nullptr;
+                }
+            }
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+    protected:
+        // Dispatch the socket events collected by the platform specific wait, followed by
+        // any scheduled callbacks.
+        uint32_t dispatch(void)
+        {
+            uint32_t ret = 0;
+            // 'cancel' may clear entries ahead of us, so walk by index
+            for (mReadyIndex = 0; mReadyIndex < uint32_t(mReady.size()); mReadyIndex++)
+            {
+                ReadyEvent &e = mReady[mReadyIndex];
+                if (e.mCallback)
+                {
+                    e.mCallback->onEvent(e.mEvents);
+                    ret++;
+                }
+            }
+            mReady.clear();
+            mReadyIndex = 0;
+
+            for (uint32_t round = 0; round < MAX_SCHEDULE_ROUNDS && !mScheduled.empty(); round++)
+            {
+                mDispatching.swap(mScheduled); // callbacks are allowed to schedule more work
+                for (size_t i = 0; i < mDispatching.size(); i++)
+                {
+                    EventLoopCallback *callback = mDispatching[i];
+                    if (callback)
+                    {
+                        mDispatching[i] = nullptr;
+                        callback->onEvent(0);
+                        ret++;
+                    }
+                }
+                mDispatching.clear();
+            }
+            return ret;
+        }
+
+        // If there is scheduled work left over we must not block
+        int32_t getTimeout(int32_t timeout) const
+        {
+            return mScheduled.empty() ? timeout : 0;
+        }
+
+        ReadyEventVector        mReady;
+        uint32_t                mReadyIndex{ 0 };
+        EventLoopCallbackVector mScheduled;
+        EventLoopCallbackVector mDispatching;
+    };
+
+#ifdef __linux__
+
+    class EventLoopEpoll : public EventLoopBase
+    {
+    public:
+        EventLoopEpoll(void)
+        {
+            mEpoll = epoll_create1(EPOLL_CLOEXEC);
+            mWakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (mEpoll >= 0 && mWakeup >= 0)
+            {
+                epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN | EPOLLET;
+                ev.data.ptr = nullptr; // a null callback identifies the wakeup handle
+                epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWakeup, &ev);
+            }
+        }
+
+        virtual ~EventLoopEpoll(void)
+        {
+            if (mWakeup >= 0)
+            {
+                ::close(mWakeup);
+            }
+            if (mEpoll >= 0)
+            {
+                ::close(mEpoll);
+            }
+        }
+
+        bool isValid(void) const
+        {
+            return mEpoll >= 0 && mWakeup >= 0;
+        }
+
+        virtual bool addSocket(wsocket::Wsocket *socket, EventLoopCallback *callback) override final
+        {
+            bool ret = false;
+
+            int64_t handle = socket ? socket->getNativeHandle() : -1;
+            if (handle >= 0)
+            {
+                epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                // Always ask for both directions; with edge triggering we only hear about EPOLLOUT
+                // when a full send buffer drains, so there is no need to toggle interest.
+                ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                ev.data.ptr = callback;
+                int r = epoll_ctl(mEpoll, EPOLL_CTL_ADD, int(handle), &ev);
+                if (r != 0 && errno == EEXIST)
+                {
+                    r = epoll_ctl(mEpoll, EPOLL_CTL_MOD, int(handle), &ev);
+                }
+                ret = r == 0;
+            }
+
+            return ret;
+        }
+
+        virtual void removeSocket(wsocket::Wsocket *socket) override final
+        {
+            // A closed socket reports no handle; the kernel already dropped it from the epoll set,
+            // and the descriptor number may have been reused by a newer connection.
+            int64_t handle = socket ? socket->getNativeHandle() : -1;
+            if (handle >= 0)
+            {
+                epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                epoll_ctl(mEpoll, EPOLL_CTL_DEL, int(handle), &ev);
+            }
+        }
+
+        virtual uint32_t wait(int32_t timeout) override final
+        {
+            epoll_event events[MAX_EVENTS_PER_WAIT];
+            int count = epoll_wait(mEpoll, events, MAX_EVENTS_PER_WAIT, getTimeout(timeout));
+            for (int i = 0; i < count; i++)
+            {
+                const epoll_event &ev = events[i];
+                if (ev.data.ptr == nullptr)
+                {
+                    uint64_t value;
+                    while (::read(mWakeup, &value, sizeof(value)) > 0)
+                    {
+                    }
+                    continue;
+                }
+                ReadyEvent e;
+                e.mCallback = (EventLoopCallback *)ev.data.ptr;
+                if (ev.events & (EPOLLIN | EPOLLPRI))
+                {
+                    e.mEvents |= READABLE;
+                }
+                if (ev.events & EPOLLOUT)
+                {
+                    e.mEvents |= WRITABLE;
+                }
+                if (ev.events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+                {
+                    // Report hangup as readable too, so the connection reads the EOF and closes itself
+                    e.mEvents |= HANGUP | READABLE;
+                }
+                mReady.push_back(e);
+            }
+            return dispatch();
+        }
+
+        virtual void wakeup(void) override final
+        {
+            uint64_t one = 1;
+            ssize_t r = ::write(mWakeup, &one, sizeof(one));
+            (void)r;
+        }
+
+        int     mEpoll{ -1 };
+        int     mWakeup{ -1 };
+    };
+
+    EventLoop *EventLoop::create(void)
+    {
+        auto ret = new EventLoopEpoll;
+        if (!ret->isValid())
+        {
+            delete ret;
+            ret = nullptr;
+        }
+        return static_cast<EventLoop *>(ret);
+    }
+
+#else
+
+    class RegisteredSocket
+    {
+    public:
+        wsocket::Wsocket    *mSocket{ nullptr };
+        EventLoopCallback   *mCallback{ nullptr };
+    };
+
+    typedef std::vector< RegisteredSocket > RegisteredSocketVector;
+
+    // Portable fallback built on 'select'.  Select is level triggered and we have no way to know
+    // which connections have pending sends, so every registered socket is dispatched on each wait
+    // (flagged READABLE only if it actually has data).  The wait itself still sleeps until data
+    // arrives, so an idle server does not spin.
+    class EventLoopSelect : public EventLoopBase
+    {
+    public:
+        virtual bool addSocket(wsocket::Wsocket *socket, EventLoopCallback *callback) override final
+        {
+            bool ret = false;
+            if (socket && socket->getNativeHandle() >= 0)
+            {
+                RegisteredSocket rs;
+                rs.mSocket = socket;
+                rs.mCallback = callback;
+                mSockets.push_back(rs);
+                ret = true;
+            }
+            return ret;
+        }
+
+        virtual void removeSocket(wsocket::Wsocket *socket) override final
+        {
+            for (size_t i = 0; i < mSockets.size(); i++)
+            {
+                if (mSockets[i].mSocket == socket)
+                {
+                    mSockets[i] = mSockets.back();
+                    mSockets.pop_back();
+                    break;
+                }
+            }
+        }
+
+        virtual uint32_t wait(int32_t timeout) override final
+        {
+            timeout = getTimeout(timeout);
+            if (timeout < 0 || timeout > FALLBACK_MAX_WAIT)
+            {
+                timeout = FALLBACK_MAX_WAIT;
+            }
+            if (mWakeupPending.exchange(false))
+            {
+                timeout = 0;
+            }
+            fd_set rfds;
+            FD_ZERO(&rfds);
+            int64_t maxHandle = -1;
+            uint32_t selectCount = 0;
+            for (auto &i : mSockets)
+            {
+                int64_t handle = i.mSocket->getNativeHandle();
+                if (canSelect(handle) && selectCount < FD_SETSIZE)
+                {
+                    FD_SET(socket_handle(handle), &rfds);
+                    selectCount++;
+                    if (handle > maxHandle)
+                    {
+                        maxHandle = handle;
+                    }
+                }
+            }
+            if (selectCount)
+            {
+                timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+                ::select(int(maxHandle + 1), &rfds, nullptr, nullptr, &tv);
+            }
+            else if (timeout > 0)
+            {
+                wplatform::sleepNano(uint64_t(timeout) * 1000000);
+            }
+            for (auto &i : mSockets)
+            {
+                ReadyEvent e;
+                e.mCallback = i.mCallback;
+                e.mEvents = WRITABLE;
+                int64_t handle = i.mSocket->getNativeHandle();
+                if (selectCount && canSelect(handle) && FD_ISSET(socket_handle(handle), &rfds))
+                {
+                    e.mEvents |= READABLE;
+                }
+                mReady.push_back(e);
+            }
+            return dispatch();
+        }
+
+        virtual void wakeup(void) override final
+        {
+            mWakeupPending = true;
+        }
+
+#ifdef _WIN32
+        static SOCKET socket_handle(int64_t h)
+        {
+            return SOCKET(h);
+        }
+
+        static bool canSelect(int64_t h)
+        {
+            return h >= 0;
+        }
+#else
+        static int socket_handle(int64_t h)
+        {
+            return int(h);
+        }
+
+        // Descriptors beyond FD_SETSIZE cannot be placed in an fd_set
+        static bool canSelect(int64_t h)
+        {
+            return h >= 0 && h < FD_SETSIZE;
+        }
+#endif
+
+        RegisteredSocketVector  mSockets;
+        std::atomic<bool>       mWakeupPending{ false };
+    };
+
+    EventLoop *EventLoop::create(void)
+    {
+        auto ret = new EventLoopSelect;
+        return static_cast<EventLoop *>(ret);
+    }
+
+#endif
+
+}
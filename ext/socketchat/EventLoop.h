@@ -0,0 +1,70 @@
+#pragma once
+
+// A readiness driven event loop for Wsocket connections.
+// On Linux this is built on edge triggered epoll, so a wait only returns the connections
+// which actually have data to read or room to write.  Other platforms fall back to 'select'.
+#include <stdint.h>
+
+namespace wsocket
+{
+	class Wsocket;
+}
+
+namespace eventloop
+{
+
+// Pure virtual callback interface to receive socket readiness and scheduled calls
+class EventLoopCallback
+{
+public:
+	// 'events' is a combination of EventLoop::EventFlags.  It is zero when this call
+	// is the result of 'schedule' rather than socket activity.
+	virtual void onEvent(uint32_t events) = 0;
+};
+
+class EventLoop
+{
+public:
+	enum EventFlags : uint32_t
+	{
+		READABLE	= (1 << 0),
+		WRITABLE	= (1 << 1),
+		HANGUP		= (1 << 2),
+	};
+
+	static EventLoop *create(void);
+
+	// Register a socket with the loop.  Notifications are edge triggered, so the callback must
+	// read (and write) until the socket would block or it will not be notified again.
+	// Returns false if the socket has no OS handle (shared memory, playback) or registration failed.
+	virtual bool addSocket(wsocket::Wsocket *socket, EventLoopCallback *callback) = 0;
+
+	// Remove a socket from the loop.  Safe to call on a socket which has already been closed.
+	virtual void removeSocket(wsocket::Wsocket *socket) = 0;
+
+	// Queue a call to this callback (with zero events) after the current batch of socket events has
+	// been dispatched.  Used to flush work which was produced by some other connection's activity.
+	virtual void schedule(EventLoopCallback *callback) = 0;
+
+	// Drops any pending socket events or scheduled calls for this callback.
+	// Must be called before a callback is destroyed.
+	virtual void cancel(EventLoopCallback *callback) = 0;
+
+	// Wait up to 'timeout' milliseconds for socket activity, then dispatch all ready sockets and
+	// scheduled callbacks.  A negative timeout waits indefinitely.
+	// Returns the number of callbacks dispatched.
+	virtual uint32_t wait(int32_t timeout) = 0;
+
+	// Interrupts a thread which is blocked in 'wait'.  This is the only method which may be
+	// called from a thread other than the one running the loop.
+	virtual void wakeup(void) = 0;
+
+	virtual void release(void) = 0;
+
+protected:
+	virtual ~EventLoop(void)
+	{
+	}
+};
+
+}
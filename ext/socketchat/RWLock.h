@@ -0,0 +1,89 @@
+#pragma once
+
+// A reader/writer lock: any number of readers may hold it at once, or a single writer.
+// A thin wrapper over the platform lock (SRWLOCK on Windows, pthread_rwlock elsewhere), since
+// std::shared_mutex is not available in C++11.
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace rwlock
+{
+
+class RWLock
+{
+public:
+	RWLock(void)
+	{
+#ifdef _MSC_VER
+		InitializeSRWLock(&mLock);
+#else
+		pthread_rwlockattr_t attributes;
+		pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+		// glibc prefers readers by default, which lets a steady stream of GETs starve every SET
+		pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+		pthread_rwlock_init(&mLock, &attributes);
+		pthread_rwlockattr_destroy(&attributes);
+#endif
+	}
+
+	~RWLock(void)
+	{
+#ifndef _MSC_VER
+		pthread_rwlock_destroy(&mLock);
+#endif
+	}
+
+	RWLock(const RWLock &) = delete;
+	RWLock &operator=(const RWLock &) = delete;
+
+	void lockRead(void)
+	{
+#ifdef _MSC_VER
+		AcquireSRWLockShared(&mLock);
+#else
+		pthread_rwlock_rdlock(&mLock);
+#endif
+	}
+
+	void unlockRead(void)
+	{
+#ifdef _MSC_VER
+		ReleaseSRWLockShared(&mLock);
+#else
+		pthread_rwlock_unlock(&mLock);
+#endif
+	}
+
+	void lockWrite(void)
+	{
+#ifdef _MSC_VER
+		AcquireSRWLockExclusive(&mLock);
+#else
+		pthread_rwlock_wrlock(&mLock);
+#endif
+	}
+
+	void unlockWrite(void)
+	{
+#ifdef _MSC_VER
+		ReleaseSRWLockExclusive(&mLock);
+#else
+		pthread_rwlock_unlock(&mLock);
+#endif
+	}
+
+private:
+#ifdef _MSC_VER
+	SRWLOCK				mLock;
+#else
+	pthread_rwlock_t	mLock;
+#endif
+};
+
+}
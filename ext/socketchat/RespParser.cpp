@@ -0,0 +1,467 @@
+#include "RespParser.h"
+
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define MAX_INLINE_LENGTH (1024*64)             // Longest inline command or header line we will wait for (same as redis)
+#define MAX_BULK_LENGTH (1024*1024*512)         // Largest bulk string we accept (redis 'proto-max-bulk-len' default)
+#define MAX_FRAME_ELEMENTS (1024*1024*16)       // Most elements a single frame may contain
+#define MAX_NESTING_DEPTH 128                   // Deepest nesting of aggregates we accept
+
+namespace respparser
+{
+
+    // An aggregate which is still waiting for some of its children
+    class OpenAggregate
+    {
+    public:
+        uint32_t    mRemaining{ 0 };        // children still to come
+        bool        mIsAttribute{ false };  // attributes annotate the value which follows them, and do not occupy a slot of their own
+    };
+
+    typedef std::vector< RespElement > RespElementVector;
+    typedef std::vector< uint32_t > OffsetVector;
+    typedef std::vector< OpenAggregate > OpenAggregateVector;
+
+    class RespParserImpl : public RespParser
+    {
+    public:
+        virtual Result parse(uint8_t *data, uint32_t dataLen, uint32_t &frameLen) override final
+        {
+            frameLen = 0;
+            if (mFrameComplete)
+            {
+                reset();
+            }
+            while (mOffset < dataLen)
+            {
+                uint8_t type = data[mOffset];
+                // A frame which does not start with a RESP type byte is an inline command
+                if (mOffset == 0 && mElements.empty() && !isRespType(type))
+                {
+                    return parseInline(data, dataLen, frameLen);
+                }
+                uint32_t lineEnd;
+                Result r = findLineEnd(data, dataLen, lineEnd);
+                if (r != Result::FRAME)
+                {
+                    return r;
+                }
+                uint32_t lineStart = mOffset + 1;
+                uint32_t lineLen = lineEnd - lineStart;
+                uint32_t next = lineEnd + 2;        // where the next element starts
+                switch (type)
+                {
+                    case '+':
+                    case '-':
+                    case ':':
+                    case ',':
+                    case '#':
+                    case '(':
+                        addElement(typeOf(type), lineStart, lineLen, 0);
+                        break;
+                    case '_':
+                        if (lineLen)
+                        {
+                            return protocolError("Protocol error: invalid null");
+                        }
+                        addElement(RespType::NIL, 0, 0, 0);
+                        break;
+                    case '$':
+                    case '!':
+                    case '=':
+                        {
+                            int64_t len;
+                            if (!parseInteger(data + lineStart, lineLen, len) || len < -1 || len > MAX_BULK_LENGTH)
+                            {
+                                return protocolError("Protocol error: invalid bulk length");
+                            }
+                            if (len == -1)
+                            {
+                                addElement(RespType::NIL, 0, 0, 0);
+                            }
+                            else
+                            {
+                                uint32_t payloadLen = uint32_t(len);
+                                // Wait for the whole payload; the header is short so re-reading it costs nothing
+                                if (uint64_t(next) + payloadLen + 2 > dataLen)
+                                {
+                                    mSearchFrom = mOffset;
+                                    return Result::INCOMPLETE;
+                                }
+                                if (data[next + payloadLen] != '\r' || data[next + payloadLen + 1] != '\n')
+                                {
+                                    return protocolError("Protocol error: bulk string is not terminated by CRLF");
+                                }
+                                addElement(typeOf(type), next, payloadLen, 0);
+                                next += payloadLen + 2;
+                            }
+                        }
+                        break;
+                    case '*':
+                    case '%':
+                    case '~':
+                    case '|':
+                    case '>':
+                        {
+                            int64_t count;
+                            if (!parseInteger(data + lineStart, lineLen, count) || count < -1 || count > MAX_FRAME_ELEMENTS)
+                            {
+                                return protocolError("Protocol error: invalid multibulk length");
+                            }
+                            if (count == -1)
+                            {
+                                addElement(RespType::NIL, 0, 0, 0);
+                            }
+                            else
+                            {
+                                RespType t = typeOf(type);
+                                uint32_t children = uint32_t(count);
+                                if (t == RespType::MAP || t == RespType::ATTRIBUTE)
+                                {
+                                    children *= 2;
+                                }
+                                if (mElements.size() + children > MAX_FRAME_ELEMENTS || mOpen.size() >= MAX_NESTING_DEPTH)
+                                {
+                                    return protocolError("Protocol error: frame too large");
+                                }
+                                mElements.push_back(RespElement());
+                                mOffsets.push_back(0);
+                                RespElement &e = mElements.back();
+                                e.mType = t;
+                                e.mCount = children;
+                                mOffset = next;
+                                mSearchFrom = next;
+                                if (children)
+                                {
+                                    OpenAggregate a;
+                                    a.mRemaining = children;
+                                    a.mIsAttribute = t == RespType::ATTRIBUTE;
+                                    mOpen.push_back(a);
+                                    continue;
+                                }
+                                if (t == RespType::ATTRIBUTE)
+                                {
+                                    continue; // an empty attribute; the value it annotates is still to come
+                                }
+                                if (valueComplete())
+                                {
+                                    return frameComplete(data, frameLen);
+                                }
+                                continue;
+                            }
+                        }
+                        break;
+                    default:
+                        return protocolError("Protocol error: unknown type");
+                }
+                mOffset = next;
+                mSearchFrom = next;
+                if (valueComplete())
+                {
+                    return frameComplete(data, frameLen);
+                }
+            }
+            return Result::INCOMPLETE;
+        }
+
+        virtual const RespElement *getElements(uint32_t &elementCount) const override final
+        {
+            const RespElement *ret = nullptr;
+            elementCount = 0;
+            if (mFrameComplete && !mElements.empty())
+            {
+                ret = &mElements[0];
+                elementCount = uint32_t(mElements.size());
+            }
+            return ret;
+        }
+
+        virtual const char *getError(void) const override final
+        {
+            return mError ? mError : "";
+        }
+
+        virtual void reset(void) override final
+        {
+            mElements.clear();
+            mOffsets.clear();
+            mOpen.clear();
+            mOffset = 0;
+            mSearchFrom = 0;
+            mFrameComplete = false;
+            mError = nullptr;
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+    private:
+        static bool isRespType(uint8_t c)
+        {
+            switch (c)
+            {
+                case '+': case '-': case ':': case '$': case '*': case '_': case ',': case '#':
+                case '(': case '!': case '=': case '%': case '~': case '|': case '>':
+                    return true;
+            }
+            return false;
+        }
+
+        static RespType typeOf(uint8_t c)
+        {
+            switch (c)
+            {
+                case '+': return RespType::SIMPLE_STRING;
+                case '-': return RespType::ERROR;
+                case ':': return RespType::INTEGER;
+                case '$': return RespType::BULK_STRING;
+                case '*': return RespType::ARRAY;
+                case '_': return RespType::NIL;
+                case ',': return RespType::DOUBLE;
+                case '#': return RespType::BOOLEAN;
+                case '(': return RespType::BIG_NUMBER;
+                case '!': return RespType::BULK_ERROR;
+                case '=': return RespType::VERBATIM_STRING;
+                case '%': return RespType::MAP;
+                case '~': return RespType::SET;
+                case '|': return RespType::ATTRIBUTE;
+                case '>': return RespType::PUSH;
+            }
+            return RespType::NONE;
+        }
+
+        static bool parseInteger(const uint8_t *str, uint32_t len, int64_t &value)
+        {
+            bool negative = false;
+            uint32_t i = 0;
+            if (len && str[0] == '-')
+            {
+                negative = true;
+                i = 1;
+            }
+            if (i == len || (len - i) > 18)   // 18 digits can not overflow
+            {
+                return false;
+            }
+            int64_t v = 0;
+            for (; i < len; i++)
+            {
+                uint8_t c = str[i];
+                if (c < '0' || c > '9')
+                {
+                    return false;
+                }
+                v = v * 10 + (c - '0');
+            }
+            value = negative ? -v : v;
+            return true;
+        }
+
+        // Locate the CRLF which ends the header line starting at 'mOffset'.
+        // 'mSearchFrom' remembers how far a previous call got, so a partial line is not searched twice.
+        Result findLineEnd(const uint8_t *data, uint32_t dataLen, uint32_t &lineEnd)
+        {
+            uint32_t start = mSearchFrom > mOffset ? mSearchFrom : mOffset;
+            const uint8_t *cr = (const uint8_t *)memchr(data + start, '\r', dataLen - start);
+            if (cr == nullptr || uint32_t(cr - data) + 1 >= dataLen)
+            {
+                mSearchFrom = cr ? uint32_t(cr - data) : dataLen;
+                if (mSearchFrom - mOffset > MAX_INLINE_LENGTH)
+                {
+                    return protocolError("Protocol error: too big header line");
+                }
+                return Result::INCOMPLETE;
+            }
+            lineEnd = uint32_t(cr - data);
+            if (cr[1] != '\n')
+            {
+                return protocolError("Protocol error: expected CRLF");
+            }
+            return Result::FRAME;
+        }
+
+        void addElement(RespType type, uint32_t offset, uint32_t length, uint32_t count)
+        {
+            RespElement e;
+            e.mType = type;
+            e.mLength = length;
+            e.mCount = count;
+            mElements.push_back(e);
+            mOffsets.push_back(offset);
+        }
+
+        // A value was completed; close any aggregates it completes.  Returns true if the frame is done.
+        bool valueComplete(void)
+        {
+            while (!mOpen.empty())
+            {
+                OpenAggregate &a = mOpen.back();
+                a.mRemaining--;
+                if (a.mRemaining)
+                {
+                    return false;
+                }
+                bool isAttribute = a.mIsAttribute;
+                mOpen.pop_back();
+                if (isAttribute)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Resolve the element offsets into pointers and zero terminate every payload
+        Result frameComplete(uint8_t *data, uint32_t &frameLen)
+        {
+            for (size_t i = 0; i < mElements.size(); i++)
+            {
+                RespElement &e = mElements[i];
+                if (e.mType != RespType::NIL && e.mType != RespType::ARRAY && e.mType != RespType::MAP &&
+                    e.mType != RespType::SET && e.mType != RespType::ATTRIBUTE && e.mType != RespType::PUSH)
+                {
+                    uint8_t *payload = data + mOffsets[i];
+                    payload[e.mLength] = 0;     // overwrites the CR
+                    e.mData = (const char *)payload;
+                }
+            }
+            frameLen = mOffset;
+            mFrameComplete = true;
+            return Result::FRAME;
+        }
+
+        static bool isWhitespace(uint8_t c)
+        {
+            return c == ' ' || c == '\t';
+        }
+
+        static uint8_t hexValue(uint8_t c)
+        {
+            if (c >= '0' && c <= '9') return uint8_t(c - '0');
+            if (c >= 'a' && c <= 'f') return uint8_t(c - 'a' + 10);
+            if (c >= 'A' && c <= 'F') return uint8_t(c - 'A' + 10);
+            return 0xFF;
+        }
+
+        // An inline command is a single line of space separated words terminated by LF (or CRLF).
+        // Words may be quoted, in which case the usual escapes are decoded in place.
+        Result parseInline(uint8_t *data, uint32_t dataLen, uint32_t &frameLen)
+        {
+            uint32_t start = mSearchFrom;
+            const uint8_t *lf = (const uint8_t *)memchr(data + start, '\n', dataLen - start);
+            if (lf == nullptr)
+            {
+                mSearchFrom = dataLen;
+                if (dataLen > MAX_INLINE_LENGTH)
+                {
+                    return protocolError("Protocol error: too big inline request");
+                }
+                return Result::INCOMPLETE;
+            }
+            uint32_t lineEnd = uint32_t(lf - data);
+            uint32_t next = lineEnd + 1;
+            if (lineEnd && data[lineEnd - 1] == '\r')
+            {
+                lineEnd--;
+            }
+            uint32_t i = 0;
+            while (i < lineEnd)
+            {
+                while (i < lineEnd && isWhitespace(data[i]))
+                {
+                    i++;
+                }
+                if (i == lineEnd)
+                {
+                    break;
+                }
+                uint32_t wordStart = i;
+                uint32_t out = i;       // decoded quoted strings are never longer than their source
+                if (data[i] == '"' || data[i] == '\'')
+                {
+                    uint8_t quote = data[i++];
+                    bool closed = false;
+                    while (i < lineEnd)
+                    {
+                        uint8_t c = data[i++];
+                        if (c == quote)
+                        {
+                            closed = true;
+                            break;
+                        }
+                        if (c == '\\' && quote == '"' && i < lineEnd)
+                        {
+                            c = data[i++];
+                            switch (c)
+                            {
+                                case 'n': c = '\n'; break;
+                                case 'r': c = '\r'; break;
+                                case 't': c = '\t'; break;
+                                case 'b': c = '\b'; break;
+                                case 'a': c = '\a'; break;
+                                case 'x':
+                                    if (i + 1 < lineEnd && hexValue(data[i]) != 0xFF && hexValue(data[i + 1]) != 0xFF)
+                                    {
+                                        c = uint8_t((hexValue(data[i]) << 4) | hexValue(data[i + 1]));
+                                        i += 2;
+                                    }
+                                    break;
+                            }
+                        }
+                        else if (c == '\\' && quote == '\'' && i < lineEnd && data[i] == '\'')
+                        {
+                            c = data[i++];
+                        }
+                        data[out++] = c;
+                    }
+                    // a closing quote must be followed by a space (or the end of the line)
+                    if (!closed || (i < lineEnd && !isWhitespace(data[i])))
+                    {
+                        return protocolError("Protocol error: unbalanced quotes in request");
+                    }
+                }
+                else
+                {
+                    while (i < lineEnd && !isWhitespace(data[i]))
+                    {
+                        i++;
+                    }
+                    out = i;
+                }
+                addElement(RespType::INLINE, wordStart, out - wordStart, 0);
+                i++;    // step over the separator (or the terminator at the end of the line)
+            }
+            mOffset = next;
+            return frameComplete(data, frameLen);
+        }
+
+        Result protocolError(const char *error)
+        {
+            mError = error;
+            return Result::PROTOCOL_ERROR;
+        }
+
+        RespElementVector   mElements;              // Elements of the current frame
+        OffsetVector        mOffsets;               // Payload offset of each element from the start of the frame; the buffer may move between calls
+        OpenAggregateVector mOpen;                  // Aggregates which are still waiting for children
+        uint32_t            mOffset{ 0 };           // Start of the next element to parse
+        uint32_t            mSearchFrom{ 0 };       // How far we have already searched for the end of the current line
+        bool                mFrameComplete{ false };
+        const char          *mError{ nullptr };
+    };
+
+RespParser *RespParser::create(void)
+{
+    auto ret = new RespParserImpl;
+    return static_cast<RespParser *>(ret);
+}
+
+}
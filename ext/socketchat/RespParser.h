@@ -0,0 +1,88 @@
+#pragma once
+
+// Incremental, zero copy parser for the Redis serialization protocol (RESP2 and RESP3) as
+// well as inline commands ("GET foo\r\n").
+//
+// The parser works directly on the bytes of a receive buffer.  Each element of a parsed frame
+// is returned as a view (pointer and length) into that buffer; nothing is copied.  The parser
+// overwrites the byte following each payload (the CR of its CRLF) with a zero byte, so payloads
+// may also be used as C strings.
+//
+// A frame which has only partially arrived is remembered; the next call to 'parse' resumes
+// from the last complete element rather than parsing the frame again from the start.
+#include <stdint.h>
+
+namespace respparser
+{
+
+enum class RespType : uint8_t
+{
+	NONE,
+	SIMPLE_STRING,		// +OK
+	ERROR,				// -ERR message
+	INTEGER,			// :1000
+	BULK_STRING,		// $3 foo
+	ARRAY,				// *2
+	NIL,				// RESP3 '_', or the RESP2 null bulk string / null array ($-1 / *-1)
+	DOUBLE,				// ,3.14
+	BOOLEAN,			// #t
+	BIG_NUMBER,			// (3492890328409238509324850943850943825024385
+	BULK_ERROR,			// !21 SYNTAX invalid syntax
+	VERBATIM_STRING,	// =15 txt:Some string
+	MAP,				// %2
+	SET,				// ~3
+	ATTRIBUTE,			// |1
+	PUSH,				// >2
+	INLINE,				// One word of an inline command
+};
+
+// A view of one element of a frame.  Aggregates (ARRAY, MAP, SET, ATTRIBUTE, PUSH) have no
+// payload; 'mCount' is the number of child elements which immediately follow them in the element
+// list (for MAP and ATTRIBUTE that counts keys and values separately).
+class RespElement
+{
+public:
+	const char	*mData{ nullptr };			// Payload; zero byte terminated.  Null for aggregates and NIL
+	uint32_t	mLength{ 0 };				// Payload length in bytes, not counting the terminator
+	uint32_t	mCount{ 0 };				// Number of children, for aggregates
+	RespType	mType{ RespType::NONE };
+};
+
+class RespParser
+{
+public:
+	enum class Result
+	{
+		INCOMPLETE,			// The frame has not fully arrived yet
+		FRAME,				// A complete frame was parsed
+		PROTOCOL_ERROR,		// The data is not valid RESP; the connection should be dropped
+	};
+
+	static RespParser *create(void);
+
+	// Parse the frame at the start of 'data'.  After INCOMPLETE, the next call must pass the same
+	// frame again (the buffer may have moved or grown in the mean time) plus whatever has arrived since.
+	// On FRAME, 'frameLen' is set to the number of bytes the frame occupies; the caller consumes
+	// them once it is finished with the elements.
+	virtual Result parse(uint8_t *data, uint32_t dataLen, uint32_t &frameLen) = 0;
+
+	// The elements of the last complete frame, in depth first order.  An empty inline command
+	// (a blank line) is a frame with zero elements.
+	// The views are valid until the receive buffer is modified or 'parse' is called again.
+	virtual const RespElement *getElements(uint32_t &elementCount) const = 0;
+
+	// A description of the problem after a PROTOCOL_ERROR result
+	virtual const char *getError(void) const = 0;
+
+	// Discard any partially parsed frame
+	virtual void reset(void) = 0;
+
+	virtual void release(void) = 0;
+
+protected:
+	virtual ~RespParser(void)
+	{
+	}
+};
+
+}
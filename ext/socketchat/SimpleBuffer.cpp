@@ -105,7 +105,7 @@ namespace simplebuffer
                 uint32_t keepSize = getSize();
                 if (keepSize)
                 {
-                    memcpy(mBuffer, &mBuffer[mStartLoc], keepSize);
+                    memmove(mBuffer, &mBuffer[mStartLoc], keepSize); // the regions may overlap
                 }
                 mStartLoc = 0;              // Reset the current read location to zero
                 mEndLoc = keepSize;         // The current end location is the active buffer size
@@ -7,6 +7,8 @@
 #include "wplatform.h"
 #include "wsocket.h"
 #include "SimpleBuffer.h"
+#include "RespParser.h"
+#include "ByteScanner.h"
 #include "Timer.h"
 
 
@@ -18,6 +20,7 @@
 #define DEFAULT_RECEIVE_BUFFER_SIZE (1024*16)	// Default transmit buffer size is 16k
 #define DEFAULT_MAX_READ_SIZE (1024*4)			// Maximum size of a single read operation
 #define DEFAULT_MAXIMUM_BUFFER_SIZE (1024*1024)*512  // Don't ever cache more than 64 mb of data (for the moment...)
+#define MAX_BULK_LENGTH (1024*1024)*512          // Largest bulk string payload the line based poll will wait for
 
 #define CONNECTION_TIME_OUT 60	// wait no more than this number of seconds for connection to complete
 
@@ -83,6 +86,10 @@ namespace socketchat
 			{
 				mTransmitBuffer->release();
 			}
+            if (mParser)
+            {
+                mParser->release();
+            }
 #if USE_LOGGING
             if (mLogFile)
             {
@@ -98,14 +105,31 @@ namespace socketchat
 
     virtual void poll(SocketChatCallback *callback, int timeout) override final
     { // timeout in milliseconds
-        if (!mSocket) return;
+        if (_pollSocket(timeout) && callback)
+        {
+            _dispatchBinary(callback);
+        }
+    }
+
+    virtual void pollFrames(SocketChatFrameCallback *callback, int32_t timeout) override final
+    {
+        if (_pollSocket(timeout) && callback)
+        {
+            _dispatchFrames(callback);
+        }
+    }
+
+    // Performs all pending receives and sends; returns true if the connection is still open
+    bool _pollSocket(int32_t timeout)
+    {
+        if (!mSocket) return false;
         if (mReadyState == CLOSED)
         {
             if (timeout > 0)
             {
                 mSocket->nullSelect(timeout);
             }
-            return;
+            return false;
         }
         while (true)
         {
@@ -136,8 +160,14 @@ namespace socketchat
         }
         if (mReadyState == CLOSED)
         {
-            return;
+            return false;
         }
+        return _sendPending();
+    }
+
+    // Send as much of the transmit buffer as the socket will take; returns true if the connection is still open
+    bool _sendPending(void)
+    {
         while (mTransmitBuffer->getSize())
         {
             uint32_t dataLen;
@@ -161,16 +191,53 @@ namespace socketchat
         }
         if (mReadyState == SocketChat::CLOSED)
         {
-            return;
+            return false;
         }
         if (!mTransmitBuffer->getSize() && mReadyState == CLOSING)
         {
             mSocket->close();
             mReadyState = CLOSED;
         }
-        if (callback)
+        return mReadyState != CLOSED;
+    }
+
+    // Hand every complete frame in the receive buffer to the callback, without copying it
+    void _dispatchFrames(SocketChatFrameCallback *callback)
+    {
+        if (mParser == nullptr)
         {
-            _dispatchBinary(callback);
+            mParser = respparser::RespParser::create();
+        }
+        while (mReadyState == OPEN)
+        {
+            uint32_t dataLen;
+            uint8_t *data = mReceiveBuffer->getData(dataLen);
+            if (dataLen == 0)
+            {
+                break;
+            }
+            uint32_t frameLen;
+            respparser::RespParser::Result r = mParser->parse(data, dataLen, frameLen);
+            if (r == respparser::RespParser::Result::INCOMPLETE)
+            {
+                break;
+            }
+            if (r == respparser::RespParser::Result::PROTOCOL_ERROR)
+            {
+                callback->receiveProtocolError(mParser->getError());
+                mReceiveBuffer->clear();
+                mParser->reset();
+                close();
+                _sendPending(); // there may be no further activity on this socket to flush the error
+                break;
+            }
+            uint32_t elementCount;
+            const respparser::RespElement *elements = mParser->getElements(elementCount);
+            if (elementCount)
+            {
+                callback->receiveFrame(elements, elementCount);
+            }
+            mReceiveBuffer->consume(frameLen);
         }
     }
 
@@ -181,33 +248,49 @@ namespace socketchat
         {
             uint32_t dataLen;
             uint8_t *data = mReceiveBuffer->getData(dataLen);
-            if (dataLen < 2)
+            if (mBulkLength >= 0)
             {
-                break;
-            }
-            bool isBinary = false;
-            bool haveMessage = false;
-            uint32_t messageEnd = 0;
-            for (uint32_t i = 0; i < (dataLen - 1); i++)
-            {
-                uint8_t c = data[i];
-                if (c == 13 &&
-                    data[i+1] == 10)
+                // The payload of a bulk string is exactly 'mBulkLength' bytes followed by a CR/LF;
+                // it may itself contain CR/LF pairs or zero bytes, so it is never scanned for a line end
+                uint32_t payloadLen = uint32_t(mBulkLength);
+                if (dataLen < (payloadLen + 2))
                 {
-                    haveMessage = true;
-                    messageEnd = i;
                     break;
                 }
-                else if (c < 32 || c > 127)
+                mBulkLength = -1;
+                bool isBinary = bytescanner::isBinary(data, payloadLen);
+                data[payloadLen] = 0;
+                if (isBinary)
+                {
+                    callback->receiveBinaryMessage(data, payloadLen);
+                }
+                else
                 {
-                    isBinary = true;
+                    callback->receiveMessage((const char *)data);
                 }
+                mReceiveBuffer->consume(payloadLen + 2);
+                continue;
             }
-            if (!haveMessage)
+            // Resume the search where the last poll left off, rather than rescanning a partial line
+            if (!bytescanner::findLineEnd(data, dataLen, mScanOffset, mScanBinary))
             {
                 break;
             }
+            uint32_t messageEnd = mScanOffset;
+            bool isBinary = mScanBinary;
+            mScanOffset = 0;
+            mScanBinary = false;
             data[messageEnd] = 0;
+            // A '$<len>' header announces a bulk string payload on the following line(s)
+            if (data[0] == '$' && messageEnd > 1 && !isBinary)
+            {
+                char *endp = nullptr;
+                long long len = strtoll((const char *)&data[1], &endp, 10);
+                if (endp == (const char *)&data[messageEnd] && len >= 0 && len <= MAX_BULK_LENGTH)
+                {
+                    mBulkLength = int64_t(len);
+                }
+            }
             if (isBinary)
             {
                 callback->receiveBinaryMessage(data, messageEnd);
@@ -227,6 +310,19 @@ namespace socketchat
         mTransmitBuffer->addBuffer("\r\n", 2);
     }
 
+    virtual void sendRaw(const void *data, uint32_t dataLen) override final
+    {
+        mTransmitBuffer->addBuffer(data, dataLen);
+    }
+
+    virtual void flush(void) override final
+    {
+        if (mSocket && (mReadyState == OPEN || mReadyState == CLOSING))
+        {
+            _sendPending();
+        }
+    }
+
 		virtual void sendText(const char *str) override final
 		{
             size_t len = str ? strlen(str) : 0;
@@ -296,6 +392,16 @@ namespace socketchat
             }
 		}
 
+		virtual void abort(void) override final
+		{
+			if (mSocket && mReadyState != CLOSED)
+			{
+				mSocket->close();
+			}
+			mReadyState = CLOSED;
+			mTransmitBuffer->clear();
+		}
+
 		bool isValid(void) const
 		{
 			bool ret = mSocket ? true : false;
@@ -348,13 +454,22 @@ namespace socketchat
 #endif
         }
 
+        virtual wsocket::Wsocket *getSocket(void) const override final
+        {
+            return mSocket;
+        }
+
 	private:
         SocketChatCallback           *mCallback{ nullptr };
 		simplebuffer::SimpleBuffer	*mReceiveBuffer{ nullptr };		// receive buffer
 		simplebuffer::SimpleBuffer	*mTransmitBuffer{ nullptr };	// transmit buffer
+        respparser::RespParser      *mParser{ nullptr };            // only created if the connection is polled for frames
 		wsocket::Wsocket			*mSocket{ nullptr };
 		ReadyStateValues			mReadyState{ CLOSED };
 		bool						mIsServerClient{ false }; // We are a server and this is a connection to a remote client
+        int64_t                     mBulkLength{ -1 };              // Length of the bulk string payload expected next by 'poll', or -1 for a line
+        uint32_t                    mScanOffset{ 0 };               // How far 'poll' has searched the partial line at the start of the receive buffer
+        bool                        mScanBinary{ false };           // Whether the part of the line searched so far holds binary data
         uint32_t                    mSendCount{ 0 };
         uint32_t                    mReceiveCount{ 0 };
 #if USE_LOGGING
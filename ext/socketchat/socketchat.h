@@ -10,6 +10,11 @@ namespace wsocket
 	class Wsocket;
 }
 
+namespace respparser
+{
+	class RespElement;
+}
+
 namespace socketchat 
 {
 
@@ -22,6 +27,16 @@ public:
     virtual void receiveBinaryMessage(const void *data, uint32_t dataLen) = 0;
 };
 
+// Pure virtual callback interface to receive complete RESP frames, parsed in place in the receive buffer
+class SocketChatFrameCallback
+{
+public:
+	// The elements point directly into the receive buffer and are only valid for the duration of this call
+	virtual void receiveFrame(const respparser::RespElement *elements, uint32_t elementCount) = 0;
+	// The incoming data is not valid RESP.  The connection is closed once any pending sends have been flushed.
+	virtual void receiveProtocolError(const char *error) = 0;
+};
+
 class SocketChat 
 {
 public:
@@ -52,15 +67,29 @@ public:
 	// it will send incoming messages back through that interface
 	virtual void poll(SocketChatCallback *callback,int32_t timeout = 0) = 0; // timeout in milliseconds
 
+	// Same as 'poll', but incoming data is parsed as RESP frames (or inline commands) rather than
+	// split into lines.  The frames are not copied out of the receive buffer.
+	virtual void pollFrames(SocketChatFrameCallback *callback, int32_t timeout = 0) = 0; // timeout in milliseconds
+
 	// Send a text message to the server.  Assumed zero byte terminated ASCIIZ string
 	virtual void sendText(const char *str) = 0;
 
     // Send as binary data, still has a CR/LF appended after the binary content
     virtual void sendBinary(const void *data, uint32_t dataLen) = 0;
 
+	// Queue data to be sent exactly as given; nothing is appended
+	virtual void sendRaw(const void *data, uint32_t dataLen) = 0;
+
+	// Send as much of the queued data as the socket will take right now, without receiving anything.
+	// Lets a caller reply to everything it read in one 'poll' with a single write.
+	virtual void flush(void) = 0;
+
 	// Close the connection
 	virtual void close() = 0;
 
+	// Close the connection at once, throwing away anything not yet sent
+	virtual void abort(void) = 0;
+
 	// Retrieve the current state of the connection
 	virtual ReadyStateValues getReadyState() const = 0;
 
@@ -76,6 +105,9 @@ public:
     // Log all sends and receives
     virtual bool setLogFile(const char *fileName) = 0;
 
+    // Returns the underlying socket so it can be registered with an event loop
+    virtual wsocket::Wsocket *getSocket(void) const = 0;
+
 
 };
 
@@ -79,6 +79,21 @@ public:
 		return ret;
 	}
 
+	// There is only ever one shared memory connection to accept
+	virtual uint32_t pollServer(Wsocket **clients, uint32_t maxClients) override final
+	{
+		uint32_t ret = 0;
+		if (maxClients)
+		{
+			clients[0] = pollServer();
+			if (clients[0])
+			{
+				ret = 1;
+			}
+		}
+		return ret;
+	}
+
 	// performs the select operation on this socket
 	virtual void select(int32_t timeOut, size_t txBufSize) override final
 	{
@@ -149,6 +164,12 @@ public:
 		// nothing to do
 	}
 
+	// Shared memory connections have no OS socket to wait on
+	virtual int64_t getNativeHandle(void) const override final
+	{
+		return -1;
+	}
+
 	// Close the socket and release this class
 	virtual void release(void) override final
 	{
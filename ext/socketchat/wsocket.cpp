@@ -97,9 +97,14 @@ public:
 
 	WsocketImpl(const char *hostName, int32_t port)
 	{
-		if (strcmp(hostName, "server") == 0)
+		if (strcmp(hostName, SOCKET_SERVER) == 0)
 		{
-			mSocket = server_connect(port);
+			mSocket = server_connect(port, false);
+			mIsServer = true;
+		}
+		else if (strcmp(hostName, SOCKET_SERVER_REUSEPORT) == 0)
+		{
+			mSocket = server_connect(port, true);
 			mIsServer = true;
 		}
 		else
@@ -197,6 +202,16 @@ public:
 #endif
 	}
 
+	virtual int64_t getNativeHandle(void) const override final
+	{
+		int64_t ret = -1;
+		if (mSocket && mSocket != INVALID_SOCKET)
+		{
+			ret = int64_t(mSocket);
+		}
+		return ret;
+	}
+
 	virtual void release(void) override final
 	{
 		delete this;
@@ -226,12 +241,26 @@ public:
 		return socketerrno == SOCKET_EAGAIN_EINPROGRESS;
 	}
 
-	socket_t server_connect(int port)
+	socket_t server_connect(int port, bool reusePort)
 	{
 		socket_t listenSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
 		if (listenSocket == INVALID_SOCKET)
 			return INVALID_SOCKET;
 
+		if (reusePort)
+		{
+			// Every listener bound with SO_REUSEPORT gets its own accept queue and the kernel
+			// spreads incoming connections across them.
+#ifdef SO_REUSEPORT
+			int flag = 1;
+			if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, (char*)&flag, sizeof(flag)) != 0)
+#endif
+			{
+				closesocket(listenSocket);
+				return INVALID_SOCKET;
+			}
+		}
+
 		sockaddr_in addr = { 0 };
 		addr.sin_family = AF_INET;
 		addr.sin_port = htons(u_short(port));
@@ -305,20 +334,64 @@ public:
 	virtual Wsocket *pollServer(void) override final
 	{
 		Wsocket *ret = nullptr;
+		pollServer(&ret, 1);
+		return ret;
+	}
+
+	virtual uint32_t pollServer(Wsocket **clients, uint32_t maxClients) override final
+	{
+		uint32_t ret = 0;
 
 		if (mIsServer && mSocket != INVALID_SOCKET)
 		{
-			socket_t clientSocket = ::accept(mSocket, 0, 0);
-			if (clientSocket != INVALID_SOCKET)
+			while (ret < maxClients)
 			{
+				socket_t clientSocket = acceptClient();
+				if (clientSocket == INVALID_SOCKET)
+				{
+					break;
+				}
 				WsocketImpl *w = new WsocketImpl(clientSocket);
-				ret = static_cast<Wsocket *>(w);
+				clients[ret] = static_cast<Wsocket *>(w);
+				ret++;
 			}
 		}
 
 		return ret;
 	}
 
+	// Returns the next pending connection in non-blocking mode, or INVALID_SOCKET if there are none
+	socket_t acceptClient(void)
+	{
+		for (;;)
+		{
+#ifdef __linux__
+			// accept4 returns the socket already non-blocking, saving two fcntl calls per connection
+			socket_t clientSocket = ::accept4(mSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+			socket_t clientSocket = ::accept(mSocket, 0, 0);
+			if (clientSocket != INVALID_SOCKET)
+			{
+				// Accepted sockets do not inherit non-blocking mode on every platform; the client
+				// connection drains the socket until it would block, so it must never block.
+				setBlockingInternal(clientSocket, false);
+			}
+#endif
+			if (clientSocket != INVALID_SOCKET)
+			{
+				return clientSocket;
+			}
+#ifndef _WIN32
+			// The peer gave up before we got to it, or we were interrupted; move on to the next one
+			if (errno == ECONNABORTED || errno == EINTR)
+			{
+				continue;
+			}
+#endif
+			return INVALID_SOCKET;
+		}
+	}
+
 	void setBlockingInternal(socket_t socket, bool blocking)
 	{
 #ifdef _MSC_VER
@@ -433,6 +506,12 @@ public:
 
     }
 
+    // There is no OS socket behind a playback file
+    virtual int64_t getNativeHandle(void) const override final
+    {
+        return -1;
+    }
+
     // Close the socket and release this class
     virtual void release(void) override final
     {
@@ -452,6 +531,11 @@ public:
 		return nullptr;
 	}
 
+	virtual uint32_t pollServer(Wsocket **clients, uint32_t maxClients) override final
+	{
+		return 0;
+	}
+
 
     FILE    *mPlaybackFile{ nullptr };
 };
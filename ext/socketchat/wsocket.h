@@ -9,6 +9,7 @@
 #define SHARED_SERVER "sharedserver"	// Open a server connection using shared memory
 #define SHARED_CLIENT "sharedclient"	// Open a client connection using shared memory
 #define SOCKET_SERVER "server"			// Open a socket connection as a server
+#define SOCKET_SERVER_REUSEPORT "reuseportserver"	// Open a server socket which may share its port with other listeners (SO_REUSEPORT); fails where unsupported
 
 namespace wsocket
 {
@@ -32,6 +33,11 @@ public:
 	// It is the caller's responsibility to release it when finished
 	virtual Wsocket *pollServer(void) = 0;
 
+	// Accepts up to 'maxClients' pending connections in one call, storing them in 'clients'.
+	// Returns the number of connections accepted; zero once the accept queue is empty.
+	// Accepted sockets are already non-blocking.
+	virtual uint32_t pollServer(Wsocket **clients, uint32_t maxClients) = 0;
+
 	// performs the select operation on this socket
 	virtual void select(int32_t timeOut,size_t txBufSize) = 0;
 
@@ -58,6 +64,10 @@ public:
 	// Not sure what this is, but it's in the original code so making it available now.
 	virtual void disableNaglesAlgorithm(void) = 0;
 
+	// Returns the operating system handle for this socket so it can be registered with an event loop.
+	// Returns -1 if the socket is closed or is not backed by an OS socket (shared memory, playback)
+	virtual int64_t getNativeHandle(void) const = 0;
+
 	// Close the socket and release this class
 	virtual void release(void) = 0;
 protected:
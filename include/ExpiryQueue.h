@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+// A priority queue of expiry times, earliest first.  A four way min heap kept in one array, so
+// adding, removing or rescheduling an entry is O(log n) and finding the earliest is O(1); nothing
+// ever has to walk all of the entries to find the ones which are due.
+//
+// The queue does not own its entries.  Each entry remembers its own position in the heap, so it
+// can be removed or rescheduled without being searched for.
+// Not thread safe; the owner provides any locking.
+
+namespace expiryqueue
+{
+
+class ExpiryEntry
+{
+public:
+    int64_t     mWhen{ 0 };     // Set with 'add' or 'update'
+    uint32_t    mIndex{ 0 };    // Position in the heap; belongs to the queue
+};
+
+class ExpiryQueue
+{
+public:
+    static ExpiryQueue *create(void);
+
+    virtual void add(ExpiryEntry *e, int64_t when) = 0;
+
+    // The entry must be in the queue
+    virtual void remove(ExpiryEntry *e) = 0;
+    virtual void update(ExpiryEntry *e, int64_t when) = 0;
+
+    // The entry with the earliest time, or null if the queue is empty
+    virtual ExpiryEntry *peek(void) const = 0;
+
+    virtual uint32_t size(void) const = 0;
+
+    // Bytes allocated for the heap itself
+    virtual uint64_t getMemoryUsed(void) const = 0;
+
+    virtual void release(void) = 0;
+
+protected:
+    virtual ~ExpiryQueue(void)
+    {
+    }
+};
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+// An open addressing hash table from keys (arbitrary bytes) to values, in the style of a
+// Swiss table.  Each slot has a one byte tag holding seven bits of the key's hash; a lookup
+// compares the tags of a whole group of 16 slots at once (with SSE2 where available) and only
+// compares keys where the tag matches.  Short keys are stored inside the slot itself, so most
+// lookups touch one cache line of tags and one slot.
+//
+// Keys are looked up by pointer and length; no temporary copy of the key is made.  The caller
+// hashes the key with 'hashKey' and passes the hash along, so a caller which needs the hash for
+// its own purposes (such as picking a shard) only computes it once.
+// The table stores values as plain pointers and never owns them.
+//
+// The table resizes incrementally, as a Redis dict does.  When it fills up, a new array of slots
+// is allocated and each insert or remove moves a few keys over from the old one, so no single
+// call pays for moving every key.  Until all of them have moved, lookups check both arrays.
+// The owner may also move keys along with 'rehash' while the table is idle.
+// Not thread safe; the owner provides any locking.  Only insert, remove and rehash modify the
+// table, so any number of readers may call find at once.
+
+namespace keyhashtable
+{
+
+// The hash every table uses for this key.  The table itself uses the low 32 bits or so; the
+// highest bits are free for the caller.
+uint64_t hashKey(const char *key, uint32_t keyLen);
+
+// Called by 'scan' for each key it visits.  The key is zero byte terminated.
+typedef void (*ScanCallback)(void *userPtr, const char *key, uint32_t keyLen, void *value);
+
+class KeyHashTable
+{
+public:
+    static KeyHashTable *create(void);
+
+    // Returns the value stored under this key, or null if the key is not present
+    virtual void *find(const char *key, uint32_t keyLen, uint64_t hash) const = 0;
+
+    // Returns the location of the value stored under this key.  If the key was not present it
+    // is added, with a null value which the caller is expected to fill in, and 'added' is set.
+    // The location is only valid until the table is next modified.
+    virtual void **insert(const char *key, uint32_t keyLen, uint64_t hash, bool &added) = 0;
+
+    // Removes the key and returns the value which was stored under it, or null if the key was
+    // not present
+    virtual void *remove(const char *key, uint32_t keyLen, uint64_t hash) = 0;
+
+    // Number of keys in the table
+    virtual uint32_t size(void) const = 0;
+
+    // The slots may be walked in index order, from 0 to getSlotCount()-1, to visit every key.
+    // Returns false if the slot is empty.  The key is zero byte terminated.
+    // While resizing, the slots of the old array are followed by those of the new one; a key
+    // may only change slots when the table is modified.
+    virtual uint32_t getSlotCount(void) const = 0;
+    virtual bool getSlot(uint32_t index, const char *&key, uint32_t &keyLen, void *&value) const = 0;
+
+    // Visits the keys at one cursor position and returns the next cursor; start with 0, and the
+    // scan is complete when 0 comes back.  The cursor counts through the groups of slots with its
+    // bits reversed, as Redis's dictScan does, so a key which is in the table for the whole scan
+    // is visited at least once even if the table is resized between calls.  A key may be visited
+    // more than once if it is.
+    virtual uint64_t scan(uint64_t cursor, void *userPtr, ScanCallback callback) const = 0;
+
+    // True while keys are still being moved to a new array of slots
+    virtual bool isResizing(void) const = 0;
+
+    // Moves the keys in up to 'slotCount' slots of the old array to the new one; returns true
+    // if the table is still resizing
+    virtual bool rehash(uint32_t slotCount) = 0;
+
+    // Bytes allocated by the table itself, including keys too long to be stored inline
+    virtual uint64_t getMemoryUsed(void) const = 0;
+
+    virtual void release(void) = 0;
+
+protected:
+    virtual ~KeyHashTable(void)
+    {
+    }
+};
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+// An ordered set of keys, kept beside a hash table of the same keys so that the keys starting
+// with a given prefix can be visited without looking at any of the others.  Keys are compared
+// byte by byte, as memcmp does, and a key sorts before any longer key it is a prefix of.
+//
+// The keys are packed into sorted blocks of up to 128 keys, with a sorted array of the blocks
+// above them; a B+ tree of two levels.  Finding where a key belongs is a binary search of the
+// blocks' first keys followed by one within the block, and walking on from there is a scan
+// through the packed keys.
+// Not thread safe; the owner provides any locking.
+
+namespace keyindex
+{
+
+// Called by 'walk' for each key in order; return false to stop the walk.  The key is zero byte
+// terminated.
+typedef bool (*WalkCallback)(void *userPtr, const char *key, uint32_t keyLen);
+
+class KeyIndex
+{
+public:
+    static KeyIndex *create(void);
+
+    // The key must not already be in the index
+    virtual void insert(const char *key, uint32_t keyLen) = 0;
+
+    // Does nothing if the key is not in the index
+    virtual void remove(const char *key, uint32_t keyLen) = 0;
+
+    virtual uint32_t size(void) const = 0;
+
+    // Visits the keys which start with the prefix, in order.  If 'after' is not null, the walk
+    // starts from the first of them which sorts after it.
+    virtual void walk(const char *prefix, uint32_t prefixLen, const char *after, uint32_t afterLen, void *userPtr, WalkCallback callback) const = 0;
+
+    // Bytes allocated by the index, including its copies of the keys
+    virtual uint64_t getMemoryUsed(void) const = 0;
+
+    virtual void release(void) = 0;
+
+protected:
+    virtual ~KeyIndex(void)
+    {
+    }
+};
+
+}
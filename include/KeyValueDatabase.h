@@ -3,6 +3,11 @@
 #include <stdint.h>
 // Interface for a generic key value database
 
+namespace eventloop
+{
+    class EventLoop;
+}
+
 namespace keyvaluedatabase
 {
 
@@ -12,11 +17,58 @@ namespace keyvaluedatabase
 #define KVD_ABI
 #endif
 
+// Why an increment failed
+enum class IncrementError : int32_t
+{
+    NONE,
+    NOT_AN_INTEGER,     // The value (or the increment) is not a 64 bit integer
+    NOT_A_FLOAT,        // The value (or the increment) is not a number
+    WOULD_OVERFLOW,     // The result does not fit in 64 bits
+    NOT_FINITE,         // The result of a floating point increment is NaN or infinite
+};
+
+// Which key the in memory database deletes when it is over its memory limit, as Redis's
+// maxmemory-policy.  The key is chosen from a small random sample of keys, not from all of them.
+enum class EvictionPolicy : int32_t
+{
+    NO_EVICTION,    // Nothing; commands which may add data fail instead
+    ALLKEYS_LRU,    // The key used least recently
+    ALLKEYS_LFU,    // The key used least often
+    VOLATILE_TTL,   // The key with an expiry which is due soonest
+    ALLKEYS_RANDOM, // Any key
+};
+
 typedef void (KVD_ABI *KVD_standardCallback)(bool ok, void* userPtr);
-typedef void (KVD_ABI *KVD_returnCodeCallback)(bool commandOk,int32_t returnCode, void* userPtr);
+typedef void (KVD_ABI *KVD_returnCodeCallback)(bool commandOk,int64_t returnCode, void* userPtr);
+// The text of a floating point increment's result, or null with the reason it failed
+typedef void (KVD_ABI *KVD_incrementFloatCallback)(void *userPtr, const char *text, uint32_t textLen, IncrementError error);
+// Values are length delimited and may contain any bytes (including zero bytes and CR/LF).
+// A 'nullptr' for 'data' means the key does not exist.
 typedef void (KVD_ABI *KVD_dataCallback)(void* userPtr,const void *data,uint32_t dataLen);
-// A 'nullptr' for 'key' means the scan operation is complete!
-typedef void (KVD_ABI *KVD_scanCallback)(void *userPtr, const char *key,uint32_t scanIndex);
+// Called once for each key found, then once more with a 'nullptr' for 'key' and the cursor
+// to continue the scan from (0 if the scan is complete).
+typedef void (KVD_ABI *KVD_scanCallback)(void *userPtr, const char *key,uint64_t cursor);
+// Called first with a 'nullptr' for 'key' and the number of keys found as 'keyLen', then once
+// for each of those keys, with its length
+typedef void (KVD_ABI *KVD_keysCallback)(void *userPtr, const char *key, uint32_t keyLen);
+// Replies to list commands which return elements.  Called first with 'data' null, where 'count' is
+// the number of elements which follow (-1 if the key holds a value which is not a list).  Then
+// called once for each element, with the same 'count' and the element's position in 'index'.
+// 'data' is never null for an element, even an empty one.
+typedef void (KVD_ABI *KVD_listCallback)(void *userPtr, int32_t count, uint32_t index, const void *data, uint32_t dataLen);
+
+#define KVD_DEFAULT_DATABASES 16 // Logical databases, as Redis's 'databases' setting
+
+// Milliseconds since the Unix epoch; the clock key expiry times are measured against
+int64_t getTimeMilliseconds(void);
+
+// The policy's name as CONFIG uses it ("allkeys-lru" and so on), and back again
+const char *getEvictionPolicyName(EvictionPolicy policy);
+bool getEvictionPolicy(const char *name, EvictionPolicy &policy);
+
+// Parses a number of bytes as Redis writes maxmemory: digits, optionally followed by k, kb, m,
+// mb, g or gb (k is 1000 bytes, kb is 1024)
+bool parseMemorySize(const char *text, uint64_t &bytes);
 
 class KeyValueDatabase
 {
@@ -27,37 +79,144 @@ public:
         REDIS,          // Use redis as the keyvalue provider
     };
 
-	static KeyValueDatabase *create(Provider p);
+    // The Redis provider has however many logical databases the server is configured with
+	static KeyValueDatabase *create(Provider p, uint32_t databaseCount = KVD_DEFAULT_DATABASES);
 
-    virtual void select(uint32_t index, void *userPointer, KVD_standardCallback callback) = 0;
+    // Logical databases are numbered from 0.  Every command on keys names the one it applies to;
+    // which one a client has selected is up to the client, so many clients may share a database
+    // object each with a different one selected.
+
+    // How many databases there are; a client may SELECT any index below this.  Known up front,
+    // so a SELECT can be checked before any command which follows it is issued.
+    virtual uint32_t getDatabaseCount(void) const = 0;
+
+    // Swaps the contents of two databases (SWAPDB); fails if either index is out of range
+    virtual void swapDatabases(uint32_t a, uint32_t b, void *userPointer, KVD_standardCallback callback) = 0;
+
+    // Deletes every key in the database (FLUSHDB).  With 'async' the keys are gone at once but
+    // their memory may be reclaimed later, in the background (FLUSHDB ASYNC).
+    virtual void flushDatabase(uint32_t db, bool async, void *userPointer, KVD_standardCallback callback) = 0;
+
+    // Deletes every key in every database (FLUSHALL); 'async' as for flushDatabase
+    virtual void flushAll(bool async, void *userPointer, KVD_standardCallback callback) = 0;
 
     // Give up a timeslice to the database system
     virtual void pump(void) = 0;
 
+    // Register any backend connections with this event loop.  The database then pumps itself
+    // whenever a backend connection becomes readable, rather than waiting to be polled.
+    // Pass null to detach from the loop.
+    virtual void setEventLoop(eventloop::EventLoop *loop) = 0;
+
     // Returns a list of keys which match this wildcard.  If 'match' is null, then it returns
     // all keys in the database
-    virtual void scan(uint32_t scanIndex,uint32_t maxScan,const char *match,void *userPtr, KVD_scanCallback callback) = 0;
+    // Like Redis's SCAN, the cursor starts at 0 and each call returns the cursor for the next.
+    // A key which exists for the whole scan is returned at least once, however the database
+    // changes in between.  'maxScan' is how many keys to look at, before 'match' filters them.
+    virtual void scan(uint32_t db, uint64_t cursor,uint32_t maxScan,const char *match,void *userPtr, KVD_scanCallback callback) = 0;
+
+    // Keeps the keys in order as well as hashed (off to begin with), so a scan whose 'match'
+    // starts with literal characters only visits the keys which start with them.  The index
+    // costs memory and a little time on every key added or deleted.  Returns false if the
+    // provider has no such index.
+    virtual bool setKeyIndex(bool enable) = 0;
+
+    // Returns every key which matches this wildcard (KEYS); if 'match' is null, every key in the
+    // database.  The number of keys comes first, so the reply can be sent on as the keys are
+    // handed over, one at a time, rather than gathered up first.  The database holds no locks
+    // while the callback runs.
+    virtual void keys(uint32_t db, const char *match, void *userPtr, KVD_keysCallback callback) = 0;
+
+    // Returns the number of keys in the database (DBSIZE).  As in Redis, keys which have expired
+    // but have not been deleted yet are counted.
+    virtual void dbSize(uint32_t db, void *userPointer, KVD_returnCodeCallback callback) = 0;
+
+    virtual void get(uint32_t db, const char *key,void *userPointer, KVD_dataCallback callback) = 0;
 
-    virtual void get(const char *key,void *userPointer, KVD_dataCallback callback) = 0;
+    virtual void del(uint32_t db, const char *key, void *userPointer,KVD_returnCodeCallback callback) = 0;
 
-    virtual void del(const char *key, void *userPointer,KVD_returnCodeCallback callback) = 0;
+    // Deletes the keys like 'del', but a large value's memory may be reclaimed later, in the
+    // background (UNLINK).  Returns how many of the keys existed.
+    virtual void unlink(uint32_t db, uint32_t keyCount, const char **keys, void *userPointer, KVD_returnCodeCallback callback) = 0;
 
-    virtual void exists(const char *key,void *userPointer, KVD_returnCodeCallback callback) = 0;
+    virtual void exists(uint32_t db, const char *key,void *userPointer, KVD_returnCodeCallback callback) = 0;
 
-    virtual void set(const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_standardCallback callback) = 0;
-    virtual void setnx(const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) = 0;
+    virtual void set(uint32_t db, const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_standardCallback callback) = 0;
+    virtual void setnx(uint32_t db, const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) = 0;
 
-    // append to an existing or new record; returns size of the list or -1 if unable to do a push
-    virtual void push(const char *key, const void *data, uint32_t dataLen,void *userPointer, KVD_returnCodeCallback callback) = 0;
+    // Expiry.  Times are in milliseconds since the Unix epoch (see getTimeMilliseconds).  A key
+    // whose time has passed no longer exists.  Replacing a key's value with 'set' removes its expiry.
 
-    virtual void increment(const char *key,int32_t value,void *userPointer,KVD_returnCodeCallback callback) = 0;
+    // Sets the value and the time it expires (SETEX/PSETEX)
+    virtual void setExpire(uint32_t db, const char *key, const void *data, uint32_t dataLen, int64_t when, void *userPointer, KVD_standardCallback callback) = 0;
+
+    // Sets the time the key expires; a time already past deletes it.  Returns 1, or 0 if the key
+    // does not exist.
+    virtual void expireAt(uint32_t db, const char *key, int64_t when, void *userPointer, KVD_returnCodeCallback callback) = 0;
+
+    // Milliseconds until the key expires; -1 if it has no expiry, -2 if it does not exist (PTTL)
+    virtual void timeToLive(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) = 0;
+
+    // Removes the key's expiry.  Returns 1, or 0 if the key does not exist or has no expiry.
+    virtual void persist(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) = 0;
+
+    // Lists.  A list which has had its last element removed no longer exists.
+    // Indices are zero based; negative indices count back from the end of the list (-1 is the last element).
+
+    // Adds the values, in order, to the head (LPUSH) or tail (RPUSH) of a new or existing list;
+    // returns the length of the list or -1 if the key holds a value which is not a list
+    virtual void push(uint32_t db, const char *key, bool toHead, uint32_t valueCount, const void **values, const uint32_t *valueLengths, void *userPointer, KVD_returnCodeCallback callback) = 0;
+
+    // Removes and returns the first (LPOP) or last (RPOP) element; no elements if the key does not exist
+    virtual void pop(uint32_t db, const char *key, bool fromHead, void *userPointer, KVD_listCallback callback) = 0;
+
+    // Returns the elements from 'start' to 'stop' inclusive (LRANGE)
+    virtual void listRange(uint32_t db, const char *key, int64_t start, int64_t stop, void *userPointer, KVD_listCallback callback) = 0;
+
+    // Returns the element at this index (LINDEX); no elements if it is out of range
+    virtual void listIndex(uint32_t db, const char *key, int64_t index, void *userPointer, KVD_listCallback callback) = 0;
+
+    // Returns the length of the list (LLEN); 0 if the key does not exist, -1 if it is not a list
+    virtual void listLength(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) = 0;
+
+    // Keeps only the elements from 'start' to 'stop' inclusive (LTRIM); fails if the key is not a list
+    virtual void listTrim(uint32_t db, const char *key, int64_t start, int64_t stop, void *userPointer, KVD_standardCallback callback) = 0;
+
+    // Adds to a 64 bit integer value (INCRBY); a key which does not exist counts as zero.
+    // Returns the new value, or on failure the IncrementError as the return code.
+    virtual void increment(uint32_t db, const char *key,int64_t value,void *userPointer,KVD_returnCodeCallback callback) = 0;
+
+    // Adds to a numeric value (INCRBYFLOAT); the result is stored as text
+    virtual void incrementFloat(uint32_t db, const char *key, long double value, void *userPointer, KVD_incrementFloatCallback callback) = 0;
 
 
     // not use fully implemented
-    virtual void watch(uint32_t keyCount,const char **keys,void *userData,KVD_standardCallback callback) = 0;
+    virtual void watch(uint32_t db, uint32_t keyCount,const char **keys,void *userData,KVD_standardCallback callback) = 0;
 
     virtual void unwatch(void *userData, KVD_standardCallback callback) = 0;
 
+    // Limits the memory the database may use (maxmemory); zero means no limit.  Keys, values and
+    // the tables which hold them all count against the limit.  Returns false if the provider
+    // manages its own memory, as Redis does with its own maxmemory setting.
+    virtual bool setMaxMemory(uint64_t maxMemory, EvictionPolicy policy) = 0;
+    virtual void getMaxMemory(uint64_t &maxMemory, EvictionPolicy &policy) = 0;
+
+    // Called before each command which may add data.  While the database is over its memory
+    // limit, deletes keys as the eviction policy says.  Returns false if it could not get back
+    // under the limit, in which case the command should be refused.
+    virtual bool freeMemoryIfNeeded(void) = 0;
+
+    // The 'memory' section of INFO, as the text Redis replies with ("name:value" lines)
+    virtual void memoryInfo(void *userPointer, KVD_dataCallback callback) = 0;
+
+    // Forget the callbacks of any commands issued with this user pointer which are still waiting
+    // on a reply.  A database shared by many clients must be told before a client goes away.
+    virtual void cancelCallbacks(void *userPointer) = 0;
+
+    // False once the connection to the backend has been lost, after which every command fails.
+    // The in memory database is always connected.
+    virtual bool isConnected(void) const = 0;
+
 	virtual void release(void) = 0;
 
 protected:
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+// A fixed number of connections to the Redis backend, shared by any number of clients.
+// Each client is bound to one connection for as long as it holds it, so its commands are
+// answered in the order it sent them, while the commands of every client bound to the same
+// connection are pipelined together on it.
+// Like the connections themselves, a pool is only used from a single thread.
+
+namespace eventloop
+{
+    class EventLoop;
+}
+
+namespace keyvaluedatabase
+{
+    class KeyValueDatabase;
+}
+
+namespace keyvaluedatabasepool
+{
+
+class KeyValueDatabasePool
+{
+public:
+    // Connections which can not be established are left out of the pool, and tried again later
+    static KeyValueDatabasePool *create(uint32_t connectionCount);
+
+    // Binds a new client to the connection with the fewest clients.  Connections which have been
+    // lost are dropped from the pool first; their clients' commands fail until they reconnect.
+    // If connections are missing they are tried again, though no more than once every
+    // RECONNECT_INTERVAL, so a backend which is down does not see an attempt for every client.
+    // Returns null if the pool still has no connections.
+    virtual keyvaluedatabase::KeyValueDatabase *acquireDatabase(void) = 0;
+
+    // The client bound to this connection has gone away.  It must already have cancelled any
+    // callbacks still pending on the connection (see KeyValueDatabase::cancelCallbacks)
+    virtual void releaseDatabase(keyvaluedatabase::KeyValueDatabase *database) = 0;
+
+    // Registers every connection with this event loop
+    virtual void setEventLoop(eventloop::EventLoop *loop) = 0;
+
+    virtual uint32_t getConnectionCount(void) const = 0;
+
+    virtual void release(void) = 0;
+
+protected:
+    virtual ~KeyValueDatabasePool(void)
+    {
+    }
+};
+
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <assert.h>
+#include <new>
+#include <type_traits>
 
 namespace objectpool
 {
@@ -12,7 +14,9 @@ private:
 	class ObjectPoolNode
 	{
 	public:
-		PoolType object;
+		// Raw storage; the object is only constructed while the node is allocated, so
+		// freeing a chunk does not destroy objects which were already deallocated
+		typename std::aligned_storage< sizeof(PoolType), alignof(PoolType) >::type object;
 		ObjectPoolNode* previous;
 		ObjectPoolNode* next;
 	};
@@ -53,13 +57,13 @@ public:
 		/// node.
 		inline PoolType& operator*()
 		{
-			return node->object;
+			return *reinterpret_cast< PoolType* >(&node->object);
 		}
 		/// Returns a pointer to the object referenced by the
 		/// iterator's current node.
 		inline PoolType* operator->()
 		{
-			return &node->object;
+			return reinterpret_cast< PoolType* >(&node->object);
 		}
 
 	private:
@@ -138,6 +142,10 @@ ObjectPool< PoolType >::ObjectPool(int _chunk_size, bool _grow)
 template < typename PoolType >
 ObjectPool< PoolType >::~ObjectPool()
 {
+	// Objects still allocated are destroyed along with the pool
+	Iterator i = Begin();
+	while (i)
+		DeallocateObject(i);
     ReclaimMemory();
 }
 
@@ -225,7 +233,7 @@ void ObjectPool< PoolType >::DeallocateObject(Iterator& iterator)
 	--num_allocated_objects;
 
 	ObjectPoolNode* object = iterator.node;
-	object->object.~PoolType();
+	reinterpret_cast< PoolType* >(&object->object)->~PoolType();
 
 	// Get the previous and next pointers now, because they will be overwritten
 	// before we're finished.
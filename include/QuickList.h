@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+// The storage for a list value.  A doubly linked chain of nodes, each of which packs many
+// elements into one contiguous block of memory (up to 8k), in the style of the Redis quicklist.
+//
+// Within a node each element is stored as its length (a variable length integer), its bytes, and
+// its length once more, encoded so that it can be read backwards from the end of the element.
+// That lets the node be walked in either direction.
+//
+// Pushing and popping at either end is O(1); finding an element by index skips whole nodes by
+// their element counts, starting from whichever end is nearer.
+// The list and its nodes come from the slab allocator it is created with, so they are counted
+// with the rest of the database's memory.
+// Not thread safe; the owner provides any locking.
+
+namespace slaballocator
+{
+    class SlabAllocator;
+}
+
+namespace quicklist
+{
+
+// Called for each element visited by 'forEach'.  'index' is the position of the element relative
+// to the first one visited.  'data' is never null, even for an empty element.
+typedef void (*QL_elementCallback)(void *userPtr, uint32_t index, const void *data, uint32_t dataLen);
+
+class QuickList
+{
+public:
+    static QuickList *create(slaballocator::SlabAllocator *allocator);
+
+    // Adds an element to the head or the tail of the list; returns the new length
+    virtual uint32_t push(bool toHead, const void *data, uint32_t dataLen) = 0;
+
+    // Removes the element at the head or the tail.  Returns false if the list is empty.
+    virtual bool pop(bool fromHead) = 0;
+
+    // Number of elements in the list
+    virtual uint32_t size(void) const = 0;
+
+    // Finds the element at this index; negative indices count back from the tail (-1 is the last
+    // element).  Returns false if the index is out of range.
+    // The element is valid until the list is next modified.
+    virtual bool getElement(int64_t index, const void *&data, uint32_t &dataLen) const = 0;
+
+    // Visits 'count' elements in order, starting at 'start'.  Both must be within the list.
+    virtual void forEach(uint32_t start, uint32_t count, void *userPtr, QL_elementCallback callback) const = 0;
+
+    // Keeps only the 'count' elements starting at 'start', freeing the rest.  Both must be within
+    // the list.
+    virtual void trim(uint32_t start, uint32_t count) = 0;
+
+    // Bytes allocated for the list's nodes
+    virtual uint64_t getMemoryUsed(void) const = 0;
+
+    virtual void release(void) = 0;
+
+protected:
+    virtual ~QuickList(void)
+    {
+    }
+};
+
+}
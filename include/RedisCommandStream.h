@@ -5,6 +5,11 @@
 // This class manages a simple state machine for Redis commands
 // Sometimes redis commands come in as a single ASICII string, but sometimes
 
+namespace respparser
+{
+    class RespElement;
+}
+
 namespace rediscommandstream
 {
 
@@ -330,6 +335,12 @@ public:
     // it will also set 'argc' to the number of attributes found with this command
 	virtual RedisCommand addStream(const char *cmd,uint32_t &argc) = 0;
 
+    // Add a complete frame parsed by respparser::RespParser; either an array of bulk strings or the
+    // words of an inline command.  The arguments point directly at the frame's data rather than being
+    // copied, so they are only valid for as long as the frame is.
+    // Returns the command and sets 'argc'; 'NONE' if the command is unknown or the frame is not a command.
+    virtual RedisCommand addFrame(const respparser::RespElement *elements, uint32_t elementCount, uint32_t &argc) = 0;
+
     // Semaphore indicating that all of the attributes have been processed and we can reset back to initial state
     virtual void resetAttributes(void) = 0;
     
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+// A size class allocator for the small blocks the database stores, in the style of the memcached
+// slab allocator.  Requests are rounded up to one of a fixed set of chunk sizes (each about 25%
+// larger than the last), and every chunk size carves its chunks out of its own pages.  A size
+// class's pages start at 64k and double up to 1MB, so a class which is barely used stays small.
+// Freed chunks are reused for the next request of the same size class and pages are never handed
+// back, so a workload which keeps overwriting values of similar sizes settles at a fixed footprint
+// rather than fragmenting the general heap.
+//
+// Each thread allocates and frees through a small cache of chunks for every size class, and only
+// takes the size class's lock to refill or drain its cache in batches.
+// Blocks larger than the largest chunk size go straight to malloc.
+// Thread safe.
+
+namespace slaballocator
+{
+
+// Totals across every size class.  Chunks are counted as in use from the moment they are
+// allocated until they are freed; chunks sitting in the thread caches count as free.
+class SlabStats
+{
+public:
+    uint64_t    mRequestedBytes{ 0 };   // Bytes asked for by the blocks currently allocated
+    uint64_t    mUsedBytes{ 0 };        // Chunk bytes behind those blocks (requests rounded up to their size class)
+    uint64_t    mFreeBytes{ 0 };        // Chunk bytes carved from pages which are free for reuse
+    uint64_t    mPageBytes{ 0 };        // Bytes of pages allocated, whether carved into chunks yet or not
+    uint64_t    mLargeBytes{ 0 };       // Bytes of blocks too large for any size class
+    uint64_t    mLargeCount{ 0 };
+};
+
+// One size class
+class SlabClassStats
+{
+public:
+    uint32_t    mChunkSize{ 0 };
+    uint32_t    mPageCount{ 0 };
+    uint64_t    mPageBytes{ 0 };
+    uint64_t    mUsedChunks{ 0 };       // Chunks currently allocated
+    uint64_t    mFreeChunks{ 0 };       // Chunks carved and free, in the class or in thread caches
+    uint64_t    mRequestedBytes{ 0 };   // Bytes asked for by the chunks currently allocated
+};
+
+class SlabAllocator
+{
+public:
+    static SlabAllocator *create(void);
+
+    // Returns a block of at least 'size' bytes (zero is allowed).  It must be freed with the same
+    // size it was allocated with.
+    virtual void *allocate(uint32_t size) = 0;
+    virtual void deallocate(void *p, uint32_t size) = 0;
+
+    virtual void getStats(SlabStats &stats) = 0;
+
+    // Bytes of chunks and large blocks currently allocated; the same as mUsedBytes plus
+    // mLargeBytes, but cheap enough to check on every command
+    virtual uint64_t getUsedBytes(void) const = 0;
+
+    // Size classes are numbered from 0 to getClassCount()-1, smallest first
+    virtual uint32_t getClassCount(void) const = 0;
+    virtual void getClassStats(uint32_t index, SlabClassStats &stats) = 0;
+
+    virtual void release(void) = 0;
+
+protected:
+    virtual ~SlabAllocator(void)
+    {
+    }
+};
+
+}
@@ -1,13 +1,26 @@
 #pragma  once
 
+#include <stdint.h>
+
+// Matches strings against a Redis style glob pattern, as SCAN and KEYS use: '*' matches any run
+// of characters, '?' any one character, '[abc]', '[a-z]' and '[^x]' one character from (or not
+// from) a set, and '\' makes the next character literal.  The pattern is compiled once into a
+// short list of steps, so matching a key does not parse the pattern or allocate anything.
+
 namespace wildcard
 {
         class WildCard
         {
         public:
             static WildCard *create(const char *str);
+            // False if the pattern only matches one string
             virtual bool    isWild(void) const = 0;
+            // The literal characters every matching string starts with; empty if the pattern
+            // starts with a wildcard
+            virtual const char *getPrefix(uint32_t &len) const = 0;
             virtual bool    isMatch(const char *str) const = 0;
+            // The string may contain zero bytes
+            virtual bool    isMatch(const char *str, uint32_t len) const = 0;
 
             virtual void release(void) = 0;
         protected:
@@ -15,4 +28,4 @@ namespace wildcard
         };
 
 
-} 
\ No newline at end of file
+}
@@ -0,0 +1,145 @@
+#include "ExpiryQueue.h"
+#include <assert.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define HEAP_ARITY 4    // Children per node; a shallower tree whose siblings share a cache line
+
+namespace expiryqueue
+{
+
+    class ExpiryQueueImpl : public ExpiryQueue
+    {
+    public:
+        ExpiryQueueImpl(void)
+        {
+        }
+
+        virtual ~ExpiryQueueImpl(void)
+        {
+        }
+
+        virtual void add(ExpiryEntry *e, int64_t when) override final
+        {
+            e->mWhen = when;
+            e->mIndex = uint32_t(mHeap.size());
+            mHeap.push_back(e);
+            siftUp(e->mIndex);
+        }
+
+        virtual void remove(ExpiryEntry *e) override final
+        {
+            uint32_t index = e->mIndex;
+            assert(index < mHeap.size() && mHeap[index] == e);
+            ExpiryEntry *last = mHeap.back();
+            mHeap.pop_back();
+            if (last != e)
+            {
+                // The last entry fills the hole and moves whichever way its time calls for
+                place(last, index);
+                siftUp(index);
+                siftDown(last->mIndex);
+            }
+        }
+
+        virtual void update(ExpiryEntry *e, int64_t when) override final
+        {
+            assert(e->mIndex < mHeap.size() && mHeap[e->mIndex] == e);
+            bool earlier = when < e->mWhen;
+            e->mWhen = when;
+            if (earlier)
+            {
+                siftUp(e->mIndex);
+            }
+            else
+            {
+                siftDown(e->mIndex);
+            }
+        }
+
+        virtual ExpiryEntry *peek(void) const override final
+        {
+            return mHeap.empty() ? nullptr : mHeap[0];
+        }
+
+        virtual uint32_t size(void) const override final
+        {
+            return uint32_t(mHeap.size());
+        }
+
+        virtual uint64_t getMemoryUsed(void) const override final
+        {
+            return uint64_t(mHeap.capacity()) * sizeof(ExpiryEntry *);
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+    private:
+        void place(ExpiryEntry *e, uint32_t index)
+        {
+            mHeap[index] = e;
+            e->mIndex = index;
+        }
+
+        void siftUp(uint32_t index)
+        {
+            ExpiryEntry *e = mHeap[index];
+            while (index > 0)
+            {
+                uint32_t parent = (index - 1) / HEAP_ARITY;
+                if (mHeap[parent]->mWhen <= e->mWhen)
+                {
+                    break;
+                }
+                place(mHeap[parent], index);
+                index = parent;
+            }
+            place(e, index);
+        }
+
+        void siftDown(uint32_t index)
+        {
+            ExpiryEntry *e = mHeap[index];
+            uint32_t count = uint32_t(mHeap.size());
+            for (;;)
+            {
+                uint32_t first = index * HEAP_ARITY + 1;
+                if (first >= count)
+                {
+                    break;
+                }
+                uint32_t last = first + HEAP_ARITY < count ? first + HEAP_ARITY : count;
+                uint32_t earliest = first;
+                for (uint32_t i = first + 1; i < last; i++)
+                {
+                    if (mHeap[i]->mWhen < mHeap[earliest]->mWhen)
+                    {
+                        earliest = i;
+                    }
+                }
+                if (e->mWhen <= mHeap[earliest]->mWhen)
+                {
+                    break;
+                }
+                place(mHeap[earliest], index);
+                index = earliest;
+            }
+            place(e, index);
+        }
+
+        std::vector< ExpiryEntry * >    mHeap;
+    };
+
+ExpiryQueue *ExpiryQueue::create(void)
+{
+    auto ret = new ExpiryQueueImpl;
+    return static_cast<ExpiryQueue *>(ret);
+}
+
+}
@@ -0,0 +1,544 @@
+#include "KeyHashTable.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define USE_SSE2 1  // Tags are compared sixteen at a time; SSE2 is part of the x86-64 baseline
+#else
+#define USE_SSE2 0
+#endif
+
+#if USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma warning(disable:4100)
+#endif
+
+#define GROUP_SIZE 16       // Slots whose tags are compared together
+#define INLINE_KEY_SIZE 20  // Keys shorter than this are stored inside the slot, with their terminator
+#define TAG_EMPTY 0x80      // A slot which has never been used since the table was last rebuilt
+#define TAG_DELETED 0xFE    // A slot whose key was removed; probing must continue past it
+#define REHASH_STEP GROUP_SIZE  // Slots moved to the new array by each insert or remove while the table is resized
+// A used slot's tag is the low seven bits of its key's hash, so the high bit marks empty and deleted slots alike
+
+namespace keyhashtable
+{
+
+    class Slot
+    {
+    public:
+        void        *mValue;
+        uint32_t    mKeyLength;
+        char        mKey[INLINE_KEY_SIZE]; // The key itself, or a pointer to a heap copy of it if it is too long
+    };
+
+    static_assert(sizeof(Slot) == 32, "Two slots should fit in a cache line");
+
+    static inline uint32_t countTrailingZeros(uint32_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, v);
+        return uint32_t(index);
+#else
+        return uint32_t(__builtin_ctz(v));
+#endif
+    }
+
+    static inline uint64_t read64(const char *p)
+    {
+        uint64_t ret;
+        memcpy(&ret, p, sizeof(ret));
+        return ret;
+    }
+
+    // Folds the full 128 bit product of two 64 bit values down to 64 bits
+    static inline uint64_t multiplyMix(uint64_t a, uint64_t b)
+    {
+#if defined(__SIZEOF_INT128__)
+        __uint128_t r = __uint128_t(a) * b;
+        return uint64_t(r) ^ uint64_t(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+        uint64_t high;
+        uint64_t low = _umul128(a, b, &high);
+        return low ^ high;
+#else
+        uint64_t r = a * b;
+        return r ^ (r >> 29) ^ ((a >> 32) * (b | 1));
+#endif
+    }
+
+    // Sixteen bytes per multiply; good enough mixing for a table whose keys come from clients
+    uint64_t hashKey(const char *key, uint32_t keyLen)
+    {
+        const uint64_t k0 = 0xa0761d6478bd642fULL;
+        const uint64_t k1 = 0xe7037ed1a0b428dbULL;
+        uint64_t seed = k0 ^ (uint64_t(keyLen) * k1);
+        uint32_t remaining = keyLen;
+        while (remaining > 16)
+        {
+            seed = multiplyMix(read64(key) ^ k1, read64(key + 8) ^ seed);
+            key += 16;
+            remaining -= 16;
+        }
+        uint64_t tail[2] = { 0, 0 };
+        memcpy(tail, key, remaining);
+        return multiplyMix(tail[0] ^ k1 ^ keyLen, multiplyMix(tail[1] ^ seed, k0));
+    }
+
+    // Bit i of each mask is set when slot i of the group matches
+    static inline uint32_t matchTag(const uint8_t *group, uint8_t tag)
+    {
+#if USE_SSE2
+        __m128i g = _mm_loadu_si128((const __m128i *)group);
+        return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(char(tag)))));
+#else
+        uint32_t ret = 0;
+        for (uint32_t i = 0; i < GROUP_SIZE; i++)
+        {
+            if (group[i] == tag)
+            {
+                ret |= 1u << i;
+            }
+        }
+        return ret;
+#endif
+    }
+
+    static inline uint32_t matchEmpty(const uint8_t *group)
+    {
+        return matchTag(group, TAG_EMPTY);
+    }
+
+    static inline uint32_t matchEmptyOrDeleted(const uint8_t *group)
+    {
+#if USE_SSE2
+        return uint32_t(_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group)));
+#else
+        uint32_t ret = 0;
+        for (uint32_t i = 0; i < GROUP_SIZE; i++)
+        {
+            if (group[i] & 0x80)
+            {
+                ret |= 1u << i;
+            }
+        }
+        return ret;
+#endif
+    }
+
+    static inline uint64_t reverseBits(uint64_t v)
+    {
+        v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+        v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+        v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+        v = ((v >> 8) & 0x00FF00FF00FF00FFULL) | ((v & 0x00FF00FF00FF00FFULL) << 8);
+        v = ((v >> 16) & 0x0000FFFF0000FFFFULL) | ((v & 0x0000FFFF0000FFFFULL) << 16);
+        return (v >> 32) | (v << 32);
+    }
+
+    // Adds one to the bits of the cursor under the mask, starting from the highest
+    static inline uint64_t nextCursor(uint64_t cursor, uint64_t mask)
+    {
+        return reverseBits(reverseBits(cursor | ~mask) + 1);
+    }
+
+    static inline const char *getKey(const Slot &s)
+    {
+        if (s.mKeyLength < INLINE_KEY_SIZE)
+        {
+            return s.mKey;
+        }
+        const char *ret;
+        memcpy(&ret, s.mKey, sizeof(ret));
+        return ret;
+    }
+
+    // One array of slots and their tags.  The slots and tags share one allocation; the tags
+    // follow the slots.
+    class SlotArray
+    {
+    public:
+        void allocate(uint32_t slotCount)
+        {
+            mSlotCount = slotCount;
+            mGroupMask = slotCount / GROUP_SIZE - 1;
+            mGrowthLimit = slotCount - slotCount / 8;
+            mSlots = (Slot *)malloc(size_t(slotCount) * (sizeof(Slot) + 1));
+            mTags = (uint8_t *)(mSlots + slotCount);
+            memset(mTags, TAG_EMPTY, slotCount);
+            mUsed = 0;
+            mDeleted = 0;
+        }
+
+        // Only frees the array; the keys in it belong to whoever has them now
+        void release(void)
+        {
+            free(mSlots);
+            *this = SlotArray();
+        }
+
+        bool isUsed(uint32_t index) const
+        {
+            return !(mTags[index] & 0x80);
+        }
+
+        // Whether the growth limit has been reached; it guarantees there is always a free slot
+        bool isFull(void) const
+        {
+            return (mUsed + mDeleted) >= mGrowthLimit;
+        }
+
+        // Groups are probed in triangular steps, which visits every group once when the group
+        // count is a power of two
+        bool findIndex(const char *key, uint32_t keyLen, uint64_t hash, uint32_t &index) const
+        {
+            uint8_t tag = uint8_t(hash & 0x7F);
+            uint32_t group = uint32_t(hash >> 7) & mGroupMask;
+            for (uint32_t step = 1;; step++)
+            {
+                const uint8_t *tags = &mTags[group * GROUP_SIZE];
+                uint32_t match = matchTag(tags, tag);
+                while (match)
+                {
+                    uint32_t i = group * GROUP_SIZE + countTrailingZeros(match);
+                    const Slot &s = mSlots[i];
+                    if (s.mKeyLength == keyLen && memcmp(getKey(s), key, keyLen) == 0)
+                    {
+                        index = i;
+                        return true;
+                    }
+                    match &= match - 1;
+                }
+                // The key would have been placed in this group if there were room
+                if (matchEmpty(tags))
+                {
+                    return false;
+                }
+                group = (group + step) & mGroupMask;
+            }
+        }
+
+        // Takes a free slot for a key with this hash; the caller fills it in
+        Slot &add(uint64_t hash)
+        {
+            uint32_t group = uint32_t(hash >> 7) & mGroupMask;
+            uint32_t match;
+            for (uint32_t step = 1;; step++)
+            {
+                match = matchEmptyOrDeleted(&mTags[group * GROUP_SIZE]);
+                if (match)
+                {
+                    break;
+                }
+                group = (group + step) & mGroupMask;
+            }
+            uint32_t index = group * GROUP_SIZE + countTrailingZeros(match);
+            if (mTags[index] == TAG_DELETED)
+            {
+                mDeleted--;
+            }
+            mTags[index] = uint8_t(hash & 0x7F);
+            mUsed++;
+            return mSlots[index];
+        }
+
+        // Visits the keys whose hash puts them in this group.  They are in the group itself or
+        // further along its probe sequence, up to the first group with an empty slot, as for
+        // findIndex; keys from other groups met on the way are skipped.
+        void scanGroup(uint32_t home, void *userPtr, ScanCallback callback) const
+        {
+            uint32_t group = home;
+            for (uint32_t step = 1;; step++)
+            {
+                const uint8_t *tags = &mTags[group * GROUP_SIZE];
+                uint32_t used = ~matchEmptyOrDeleted(tags) & ((1u << GROUP_SIZE) - 1);
+                while (used)
+                {
+                    const Slot &s = mSlots[group * GROUP_SIZE + countTrailingZeros(used)];
+                    const char *key = getKey(s);
+                    if ((uint32_t(hashKey(key, s.mKeyLength) >> 7) & mGroupMask) == home)
+                    {
+                        (*callback)(userPtr, key, s.mKeyLength, s.mValue);
+                    }
+                    used &= used - 1;
+                }
+                if (matchEmpty(tags))
+                {
+                    break;
+                }
+                group = (group + step) & mGroupMask;
+            }
+        }
+
+        void remove(uint32_t index)
+        {
+            // No probe has ever passed over a group which still has an empty slot, so a slot in
+            // such a group can be made empty again rather than left as a marker
+            if (matchEmpty(&mTags[index & ~(GROUP_SIZE - 1)]))
+            {
+                mTags[index] = TAG_EMPTY;
+            }
+            else
+            {
+                mTags[index] = TAG_DELETED;
+                mDeleted++;
+            }
+            mUsed--;
+        }
+
+        Slot        *mSlots{ nullptr };
+        uint8_t     *mTags{ nullptr };
+        uint32_t    mSlotCount{ 0 };
+        uint32_t    mGroupMask{ 0 };
+        uint32_t    mGrowthLimit{ 0 };     // Used plus deleted slots allowed before the table is resized
+        uint32_t    mUsed{ 0 };
+        uint32_t    mDeleted{ 0 };
+    };
+
+    class KeyHashTableImpl : public KeyHashTable
+    {
+    public:
+        KeyHashTableImpl(void)
+        {
+            mTables[0].allocate(GROUP_SIZE);
+        }
+
+        virtual ~KeyHashTableImpl(void)
+        {
+            for (auto &t : mTables)
+            {
+                for (uint32_t i = 0; i < t.mSlotCount; i++)
+                {
+                    if (t.isUsed(i))
+                    {
+                        releaseKey(t.mSlots[i]);
+                    }
+                }
+                t.release();
+            }
+        }
+
+        virtual void *find(const char *key, uint32_t keyLen, uint64_t hash) const override final
+        {
+            uint32_t index;
+            for (uint32_t i = 0; i < getTableCount(); i++)
+            {
+                if (mTables[i].findIndex(key, keyLen, hash, index))
+                {
+                    return mTables[i].mSlots[index].mValue;
+                }
+            }
+            return nullptr;
+        }
+
+        virtual void **insert(const char *key, uint32_t keyLen, uint64_t hash, bool &added) override final
+        {
+            if (isResizing())
+            {
+                rehash(REHASH_STEP);
+            }
+            uint32_t index;
+            for (uint32_t i = 0; i < getTableCount(); i++)
+            {
+                if (mTables[i].findIndex(key, keyLen, hash, index))
+                {
+                    added = false;
+                    return &mTables[i].mSlots[index].mValue;
+                }
+            }
+            // While resizing, new keys only go into the new array.  It can not fill up before
+            // the resize is done: every insert moves REHASH_STEP slots along, so it gets at most
+            // the old array's keys (7/8 of its slots, or 7/16 if it is the same size) plus one
+            // key for every REHASH_STEP slots of the old array.
+            assert(!(isResizing() && mTables[1].isFull()));
+            if (!isResizing() && mTables[0].isFull())
+            {
+                startResize();
+            }
+            Slot &s = mTables[isResizing() ? 1 : 0].add(hash);
+            s.mValue = nullptr;
+            s.mKeyLength = keyLen;
+            if (keyLen < INLINE_KEY_SIZE)
+            {
+                memcpy(s.mKey, key, keyLen);
+                s.mKey[keyLen] = 0;
+            }
+            else
+            {
+                char *copy = (char *)malloc(keyLen + 1);
+                memcpy(copy, key, keyLen);
+                copy[keyLen] = 0;
+                memcpy(s.mKey, &copy, sizeof(copy));
+                mHeapKeyBytes += keyLen + 1;
+            }
+            added = true;
+            return &s.mValue;
+        }
+
+        virtual void *remove(const char *key, uint32_t keyLen, uint64_t hash) override final
+        {
+            if (isResizing())
+            {
+                rehash(REHASH_STEP);
+            }
+            uint32_t index;
+            for (uint32_t i = 0; i < getTableCount(); i++)
+            {
+                SlotArray &t = mTables[i];
+                if (t.findIndex(key, keyLen, hash, index))
+                {
+                    void *ret = t.mSlots[index].mValue;
+                    releaseKey(t.mSlots[index]);
+                    t.remove(index);
+                    return ret;
+                }
+            }
+            return nullptr;
+        }
+
+        virtual uint32_t size(void) const override final
+        {
+            return mTables[0].mUsed + mTables[1].mUsed;
+        }
+
+        virtual uint32_t getSlotCount(void) const override final
+        {
+            return mTables[0].mSlotCount + mTables[1].mSlotCount;
+        }
+
+        virtual bool getSlot(uint32_t index, const char *&key, uint32_t &keyLen, void *&value) const override final
+        {
+            const SlotArray *t = &mTables[0];
+            if (index >= t->mSlotCount)
+            {
+                index -= t->mSlotCount;
+                t = &mTables[1];
+            }
+            if (index >= t->mSlotCount || !t->isUsed(index))
+            {
+                return false;
+            }
+            const Slot &s = t->mSlots[index];
+            key = getKey(s);
+            keyLen = s.mKeyLength;
+            value = s.mValue;
+            return true;
+        }
+
+        // While resizing, the cursor's group in the smaller array (the old one; tables only
+        // grow) is visited, then every group of the larger array which its keys may have moved
+        // to.  Those differ only in the cursor bits the smaller array's mask does not cover.
+        virtual uint64_t scan(uint64_t cursor, void *userPtr, ScanCallback callback) const override final
+        {
+            const SlotArray &t0 = mTables[0];
+            uint64_t mask0 = t0.mGroupMask;
+            t0.scanGroup(uint32_t(cursor & mask0), userPtr, callback);
+            if (!isResizing())
+            {
+                return nextCursor(cursor, mask0);
+            }
+            const SlotArray &t1 = mTables[1];
+            uint64_t mask1 = t1.mGroupMask;
+            assert(mask0 <= mask1);
+            do
+            {
+                t1.scanGroup(uint32_t(cursor & mask1), userPtr, callback);
+                cursor = nextCursor(cursor, mask1);
+            } while (cursor & (mask0 ^ mask1));
+            return cursor;
+        }
+
+        virtual bool isResizing(void) const override final
+        {
+            return mTables[1].mSlots != nullptr;
+        }
+
+        // Slots are moved as they are; long keys keep their heap copies.  A moved key's old slot
+        // is marked deleted, so probes for the keys still in the old array carry on past it.
+        virtual bool rehash(uint32_t slotCount) override final
+        {
+            if (!isResizing())
+            {
+                return false;
+            }
+            SlotArray &from = mTables[0];
+            SlotArray &to = mTables[1];
+            uint32_t end = from.mSlotCount - mRehashIndex > slotCount ? mRehashIndex + slotCount : from.mSlotCount;
+            for (uint32_t i = mRehashIndex; i < end; i++)
+            {
+                if (!from.isUsed(i))
+                {
+                    continue;
+                }
+                const Slot &s = from.mSlots[i];
+                to.add(hashKey(getKey(s), s.mKeyLength)) = s;
+                from.mTags[i] = TAG_DELETED;
+                from.mUsed--;
+                from.mDeleted++;
+            }
+            mRehashIndex = end;
+            if (mRehashIndex < from.mSlotCount)
+            {
+                return true;
+            }
+            from.release();
+            from = to;
+            to = SlotArray();
+            return false;
+        }
+
+        virtual uint64_t getMemoryUsed(void) const override final
+        {
+            return uint64_t(getSlotCount()) * (sizeof(Slot) + 1) + mHeapKeyBytes;
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+    private:
+        uint32_t getTableCount(void) const
+        {
+            return isResizing() ? 2 : 1;
+        }
+
+        // Only grow if the table is really filling up; a table which is mostly deleted slots is
+        // moved into a fresh array of the same size.  Each change to the table then moves a
+        // few of the keys along, so no single insert has to move them all.
+        void startResize(void)
+        {
+            const SlotArray &t = mTables[0];
+            uint32_t slotCount = (t.mUsed + 1) > (t.mSlotCount * 7 / 16) ? t.mSlotCount * 2 : t.mSlotCount;
+            mTables[1].allocate(slotCount);
+            mRehashIndex = 0;
+        }
+
+        void releaseKey(Slot &s)
+        {
+            if (s.mKeyLength >= INLINE_KEY_SIZE)
+            {
+                free((void *)getKey(s));
+                mHeapKeyBytes -= s.mKeyLength + 1;
+            }
+        }
+
+        // While resizing, keys move from the first array to the second; otherwise there is
+        // only the first
+        SlotArray   mTables[2];
+        uint32_t    mRehashIndex{ 0 };      // The next slot of the first array to move
+        uint64_t    mHeapKeyBytes{ 0 };
+    };
+
+KeyHashTable *KeyHashTable::create(void)
+{
+    auto ret = new KeyHashTableImpl;
+    return static_cast<KeyHashTable *>(ret);
+}
+
+}
@@ -0,0 +1,303 @@
+#include "KeyIndex.h"
+#include <string.h>
+#include <assert.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define BLOCK_KEYS 128              // A block which grows past this many keys is split in two
+#define MERGE_KEYS (BLOCK_KEYS / 4) // A block which shrinks below this many keys is merged with a neighbor, if they fit in one
+
+namespace keyindex
+{
+
+    static inline int compareKeys(const char *a, uint32_t aLen, const char *b, uint32_t bLen)
+    {
+        int c = memcmp(a, b, aLen < bLen ? aLen : bLen);
+        if (c == 0 && aLen != bLen)
+        {
+            c = aLen < bLen ? -1 : 1;
+        }
+        return c;
+    }
+
+    // Sorted keys, packed one after another as a length, the key and a zero byte.  New keys are
+    // added at the end of the bytes and only the offsets are kept in order; removed keys leave
+    // their bytes behind until they add up to half of the block.
+    class Block
+    {
+    public:
+        uint32_t size(void) const
+        {
+            return uint32_t(mOffsets.size());
+        }
+
+        const char *getKey(uint32_t index, uint32_t &keyLen) const
+        {
+            const char *p = &mBytes[mOffsets[index]];
+            memcpy(&keyLen, p, sizeof(keyLen));
+            return p + sizeof(keyLen);
+        }
+
+        bool isKey(uint32_t index, const char *key, uint32_t keyLen) const
+        {
+            uint32_t len;
+            const char *k = getKey(index, len);
+            return compareKeys(k, len, key, keyLen) == 0;
+        }
+
+        // The first position whose key is not less than this one or, if 'after' is set, the
+        // first whose key is greater
+        uint32_t find(const char *key, uint32_t keyLen, bool after) const
+        {
+            uint32_t lo = 0;
+            uint32_t hi = size();
+            while (lo < hi)
+            {
+                uint32_t mid = (lo + hi) / 2;
+                uint32_t len;
+                const char *k = getKey(mid, len);
+                int c = compareKeys(k, len, key, keyLen);
+                if (c < 0 || (after && c == 0))
+                {
+                    lo = mid + 1;
+                }
+                else
+                {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        void insert(uint32_t index, const char *key, uint32_t keyLen)
+        {
+            uint32_t offset = uint32_t(mBytes.size());
+            mBytes.resize(offset + sizeof(keyLen) + keyLen + 1);
+            char *p = &mBytes[offset];
+            memcpy(p, &keyLen, sizeof(keyLen));
+            memcpy(p + sizeof(keyLen), key, keyLen);
+            p[sizeof(keyLen) + keyLen] = 0;
+            mOffsets.insert(mOffsets.begin() + index, offset);
+        }
+
+        void remove(uint32_t index)
+        {
+            uint32_t keyLen;
+            getKey(index, keyLen);
+            mDeadBytes += uint32_t(sizeof(keyLen)) + keyLen + 1;
+            mOffsets.erase(mOffsets.begin() + index);
+            if (mDeadBytes * 2 > mBytes.size())
+            {
+                compact();
+            }
+        }
+
+        // Moves the keys from 'index' on to the end of the other block; every one of them must
+        // sort after the keys already there
+        void moveTail(uint32_t index, Block &to)
+        {
+            for (uint32_t i = index; i < size(); i++)
+            {
+                uint32_t keyLen;
+                const char *key = getKey(i, keyLen);
+                to.insert(to.size(), key, keyLen);
+                mDeadBytes += uint32_t(sizeof(keyLen)) + keyLen + 1;
+            }
+            mOffsets.resize(index);
+            compact();
+        }
+
+        uint64_t getMemoryUsed(void) const
+        {
+            return sizeof(Block) + mBytes.capacity() + mOffsets.capacity() * sizeof(uint32_t);
+        }
+
+    private:
+        void compact(void)
+        {
+            std::vector< char > bytes;
+            bytes.reserve(mBytes.size() - mDeadBytes);
+            for (auto &offset : mOffsets)
+            {
+                uint32_t keyLen;
+                memcpy(&keyLen, &mBytes[offset], sizeof(keyLen));
+                uint32_t entryLen = uint32_t(sizeof(keyLen)) + keyLen + 1;
+                uint32_t newOffset = uint32_t(bytes.size());
+                bytes.insert(bytes.end(), mBytes.begin() + offset, mBytes.begin() + offset + entryLen);
+                offset = newOffset;
+            }
+            mBytes.swap(bytes);
+            mDeadBytes = 0;
+        }
+
+        std::vector< char >     mBytes;
+        std::vector< uint32_t > mOffsets;       // Where each key starts in mBytes, in key order
+        uint32_t                mDeadBytes{ 0 };// Bytes of keys which have been removed
+    };
+
+    class KeyIndexImpl : public KeyIndex
+    {
+    public:
+        KeyIndexImpl(void)
+        {
+        }
+
+        virtual ~KeyIndexImpl(void)
+        {
+            for (auto &b : mBlocks)
+            {
+                delete b;
+            }
+        }
+
+        virtual void insert(const char *key, uint32_t keyLen) override final
+        {
+            if (mBlocks.empty())
+            {
+                Block *b = new Block;
+                b->insert(0, key, keyLen);
+                mBlocks.push_back(b);
+                mSize++;
+                return;
+            }
+            uint32_t blockIndex = findBlock(key, keyLen);
+            Block *b = mBlocks[blockIndex];
+            uint32_t index = b->find(key, keyLen, false);
+            assert(index == b->size() || !b->isKey(index, key, keyLen));
+            b->insert(index, key, keyLen);
+            mSize++;
+            if (b->size() > BLOCK_KEYS)
+            {
+                Block *split = new Block;
+                b->moveTail(b->size() / 2, *split);
+                mBlocks.insert(mBlocks.begin() + blockIndex + 1, split);
+            }
+        }
+
+        virtual void remove(const char *key, uint32_t keyLen) override final
+        {
+            if (mBlocks.empty())
+            {
+                return;
+            }
+            uint32_t blockIndex = findBlock(key, keyLen);
+            Block *b = mBlocks[blockIndex];
+            uint32_t index = b->find(key, keyLen, false);
+            if (index == b->size() || !b->isKey(index, key, keyLen))
+            {
+                return;
+            }
+            b->remove(index);
+            mSize--;
+            if (b->size() == 0)
+            {
+                delete b;
+                mBlocks.erase(mBlocks.begin() + blockIndex);
+            }
+            else if (b->size() < MERGE_KEYS)
+            {
+                // Merge into the block before, or else take in the block after
+                if (blockIndex > 0 && mBlocks[blockIndex - 1]->size() + b->size() <= BLOCK_KEYS)
+                {
+                    blockIndex--;
+                }
+                if (blockIndex + 1 < mBlocks.size() && mBlocks[blockIndex]->size() + mBlocks[blockIndex + 1]->size() <= BLOCK_KEYS)
+                {
+                    Block *next = mBlocks[blockIndex + 1];
+                    next->moveTail(0, *mBlocks[blockIndex]);
+                    delete next;
+                    mBlocks.erase(mBlocks.begin() + blockIndex + 1);
+                }
+            }
+        }
+
+        virtual uint32_t size(void) const override final
+        {
+            return mSize;
+        }
+
+        virtual void walk(const char *prefix, uint32_t prefixLen, const char *after, uint32_t afterLen, void *userPtr, WalkCallback callback) const override final
+        {
+            if (mBlocks.empty())
+            {
+                return;
+            }
+            // Start from whichever of the prefix and 'after' comes later
+            bool skipStart = after && compareKeys(after, afterLen, prefix, prefixLen) >= 0;
+            const char *start = skipStart ? after : prefix;
+            uint32_t startLen = skipStart ? afterLen : prefixLen;
+            uint32_t blockIndex = findBlock(start, startLen);
+            uint32_t index = mBlocks[blockIndex]->find(start, startLen, skipStart);
+            for (; blockIndex < mBlocks.size(); blockIndex++, index = 0)
+            {
+                const Block *b = mBlocks[blockIndex];
+                for (; index < b->size(); index++)
+                {
+                    uint32_t keyLen;
+                    const char *key = b->getKey(index, keyLen);
+                    // Past the last key with the prefix
+                    if (keyLen < prefixLen || memcmp(key, prefix, prefixLen) != 0)
+                    {
+                        return;
+                    }
+                    if (!(*callback)(userPtr, key, keyLen))
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+
+        virtual uint64_t getMemoryUsed(void) const override final
+        {
+            uint64_t ret = mBlocks.capacity() * sizeof(Block *);
+            for (auto &b : mBlocks)
+            {
+                ret += b->getMemoryUsed();
+            }
+            return ret;
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+    private:
+        // The block a key belongs in; the last one whose first key is not greater than it, or
+        // the first block if there is none
+        uint32_t findBlock(const char *key, uint32_t keyLen) const
+        {
+            uint32_t lo = 0;
+            uint32_t hi = uint32_t(mBlocks.size());
+            while (lo < hi)
+            {
+                uint32_t mid = (lo + hi) / 2;
+                uint32_t len;
+                const char *first = mBlocks[mid]->getKey(0, len);
+                if (compareKeys(first, len, key, keyLen) <= 0)
+                {
+                    lo = mid + 1;
+                }
+                else
+                {
+                    hi = mid;
+                }
+            }
+            return lo ? lo - 1 : 0;
+        }
+
+        std::vector< Block * >  mBlocks;    // In key order; none are empty
+        uint32_t                mSize{ 0 };
+    };
+
+KeyIndex *KeyIndex::create(void)
+{
+    auto ret = new KeyIndexImpl;
+    return static_cast<KeyIndex *>(ret);
+}
+
+}
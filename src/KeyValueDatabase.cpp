@@ -1,445 +1,2266 @@
 #include "KeyValueDatabase.h"
+#include "KeyHashTable.h"
+#include "KeyIndex.h"
+#include "QuickList.h"
+#include "ExpiryQueue.h"
+#include "SlabAllocator.h"
 #include "Wildcard.h"
-#include <mutex>
-#include <string>
+#include "RWLock.h"
+#include "itoa_jeaiii.h"
+#include <new>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <unordered_map>
+#include <ctype.h>
+#include <errno.h>
+#include <cmath>
 #include <assert.h>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 
 #ifdef _MSC_VER
 #pragma warning(disable:4100)
 #endif
 
+#define SHARD_BITS 6    // The keyspace is split into 1<<SHARD_BITS independently locked shards
+#define SHARD_COUNT (1<<SHARD_BITS)
+#define MAX_INTEGER_TEXT 20 // "-9223372036854775808"
+#define MAX_FLOAT_TEXT (5*1024) // Enough for any long double written out in full
+#define INLINE_VALUE_SIZE 20    // Strings up to this long are stored in the value itself, without an allocation
+#define ACTIVE_EXPIRE_CYCLE_PERIOD 10       // Milliseconds between active expiry (and rehash) cycles
+#define ACTIVE_EXPIRE_CYCLE_BUDGET 1000     // Microseconds a cycle may run before it stops and lets the next one carry on
+#define ACTIVE_EXPIRE_KEYS_PER_LOOP 20      // Keys expired under one hold of a shard's lock
+#define ACTIVE_REHASH_CYCLE_BUDGET 1000     // Microseconds a cycle may spend moving keys of tables which are resizing
+#define ACTIVE_REHASH_SLOTS 1024            // Slots moved under one hold of a shard's lock
+#define EVICTION_SAMPLES 5      // Keys sampled for each eviction, as Redis's maxmemory-samples
+#define EVICTION_POOL_SIZE 16   // The best candidates sampled so far, kept from one eviction to the next
+#define LFU_INIT_VAL 5          // A new key's use count, so it is not the first evicted before it has had a chance to be used
+#define LFU_LOG_FACTOR 10       // How slowly the logarithmic use count grows
+#define LFU_DECAY_TIME 1        // Minutes for a key's use count to drop by one
+#define SCAN_RESUME_SLOTS 1024  // Index scans in progress whose place is remembered between calls
+#define LAZYFREE_THRESHOLD 64   // UNLINK leaves lists with more elements than this to the lazy free thread
+
 namespace keyvaluedatabase
 {
 
-    class DataBlock
+    // Parses the text of a 64 bit integer, accepting only the form it would be written in: an
+    // optional minus sign and digits, without leading zeros
+    static bool parseInteger(const void *data, uint32_t dataLen, int64_t &value)
     {
-    public:
-        DataBlock * mNext{ nullptr };
-        uint32_t    mDataLen{ 0 };
-        void        *mData{ nullptr };
-    };
+        const char *str = (const char *)data;
+        if (dataLen == 0 || dataLen > MAX_INTEGER_TEXT)
+        {
+            return false;
+        }
+        bool negative = str[0] == '-';
+        uint32_t i = negative ? 1 : 0;
+        if (i == dataLen || str[i] < '0' || str[i] > '9' || (str[i] == '0' && dataLen > 1))
+        {
+            return false;
+        }
+        // Accumulate as unsigned so that INT64_MIN can be represented
+        uint64_t v = 0;
+        const uint64_t limit = negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX);
+        for (; i < dataLen; i++)
+        {
+            char c = str[i];
+            if (c < '0' || c > '9')
+            {
+                return false;
+            }
+            uint64_t digit = uint64_t(c - '0');
+            if (v > (limit - digit) / 10)
+            {
+                return false;
+            }
+            v = v * 10 + digit;
+        }
+        value = negative ? int64_t(0 - v) : int64_t(v);
+        return true;
+    }
 
+    // Parses a floating point number, which must make up all of the text; NaN is not a number
+    static bool parseNumber(const void *data, uint32_t dataLen, long double &value)
+    {
+        char scratch[MAX_FLOAT_TEXT + 1];
+        if (dataLen == 0 || dataLen > MAX_FLOAT_TEXT || isspace(((const uint8_t *)data)[0]))
+        {
+            return false;
+        }
+        memcpy(scratch, data, dataLen);
+        scratch[dataLen] = 0;
+        char *end;
+        errno = 0;
+        value = strtold(scratch, &end);
+        return end == (scratch + dataLen) && errno != ERANGE && !std::isnan(value);
+    }
 
-    class Value
+    // Writes a number as Redis does: in full, to 17 decimal places, without trailing zeros;
+    // returns the length of the text
+    static uint32_t formatNumber(long double value, char *text)
     {
-    public:
-        Value(const void *data, uint32_t dlen,bool isList)
+        int len = snprintf(text, MAX_FLOAT_TEXT + 1, "%.17Lf", value);
+        if (len <= 0 || len > MAX_FLOAT_TEXT)
+        {
+            len = snprintf(text, MAX_FLOAT_TEXT + 1, "%.17Lg", value);
+        }
+        if (strchr(text, '.'))
+        {
+            while (text[len - 1] == '0')
+            {
+                len--;
+            }
+            if (text[len - 1] == '.')
+            {
+                len--;
+            }
+            text[len] = 0;
+        }
+        if (strcmp(text, "-0") == 0)
         {
-            mIsList = isList;
-            getDataBlock(data, dlen);
+            strcpy(text, "0");
+            len = 1;
         }
+        return uint32_t(len);
+    }
 
-        ~Value(void)
+    // A string, a list, or an integer.  A string which is the text of a 64 bit integer is stored
+    // as the integer itself, so counters are updated in place and only turned into text when read.
+    // A string short enough to fit is stored in the value itself; a longer one is a block from the
+    // database's slab allocator, which is passed to every method which allocates or frees one.
+    // The value is packed into 24 bytes, with its pointer, integer or short string copied in and
+    // out of 'mStorage'.  The last two bytes record when or how often the key was used, for the
+    // eviction policy (see KeyValueDatabaseImpl::touch).
+    class Value
+    {
+    public:
+        Value(void)
         {
-            releaseDataBlocks();
         }
 
         bool isInteger(void) const
         {
-            bool ret = false;
+            return mType == ValueType::INTEGER;
+        }
 
-            if (mRoot)
-            {
-                const char *cptr = (const char *)mRoot->mData;
-                char c = *cptr;
-                if ((c >= '0' && c <= '9') || c == '+' || c == '-')
-                {
-                    ret = true;
-                }
-            }
+        int64_t getInteger(void) const
+        {
+            int64_t ret;
+            memcpy(&ret, mStorage, sizeof(ret));
             return ret;
         }
 
-        int32_t getInteger(void) const
+        void setInteger(slaballocator::SlabAllocator *allocator, int64_t v)
         {
-            int32_t ret = 0;
+            releaseData(allocator);
+            mType = ValueType::INTEGER;
+            memcpy(mStorage, &v, sizeof(v));
+        }
+
+        // Only valid when the value is already an integer
+        void updateInteger(int64_t v)
+        {
+            memcpy(mStorage, &v, sizeof(v));
+        }
 
-            if (mRoot && mRoot->mDataLen < 511)
+        // Gets the value as a number; false if it is a list or text which is not a number
+        bool getNumber(long double &value) const
+        {
+            if (mType == ValueType::INTEGER)
             {
-                char scratch[512];
-                memcpy(scratch, mRoot->mData, mRoot->mDataLen);
-                scratch[mRoot->mDataLen] = 0;
-                ret = atoi(scratch);
+                value = (long double)getInteger();
+                return true;
             }
+            char scratch[MAX_INTEGER_TEXT + 1];
+            const void *data;
+            uint32_t dataLen;
+            return getString(scratch, data, dataLen) && parseNumber(data, dataLen, value);
+        }
 
-            return ret;
+        // Gets the value as a string; false if it is a list.  The text of an integer is written
+        // to 'scratch'.
+        bool getString(char *scratch, const void *&data, uint32_t &dataLen) const
+        {
+            switch (mType)
+            {
+                case ValueType::INLINE_STRING:
+                    data = mStorage;
+                    dataLen = mInlineLength;
+                    return true;
+                case ValueType::STRING:
+                    data = getHeapData();
+                    memcpy(&dataLen, mStorage + sizeof(void *), sizeof(dataLen));
+                    return true;
+                case ValueType::INTEGER:
+                    i64toa_jeaiii(getInteger(), scratch);
+                    data = scratch;
+                    dataLen = uint32_t(strlen(scratch));
+                    return true;
+                default:
+                    return false;
+            }
         }
 
-        void newData(const void *data, uint32_t dlen)
+        // Replaces whatever the value held (string, integer or list) with this string
+        void newData(slaballocator::SlabAllocator *allocator, const void *data, uint32_t dlen)
         {
-            releaseDataBlocks();
-            getDataBlock(data, dlen);
+            releaseData(allocator);
+            setString(allocator, data, dlen);
         }
 
-        uint32_t push(const void *data, uint32_t dlen)
+        // Replaces whatever the value held with an empty list
+        void newList(slaballocator::SlabAllocator *allocator)
         {
-            getDataBlock(data, dlen);
-            return mBlockCount;
+            releaseData(allocator);
+            quicklist::QuickList *list = quicklist::QuickList::create(allocator);
+            memcpy(mStorage, &list, sizeof(list));
+            mType = ValueType::LIST;
         }
 
-        void releaseDataBlocks(void)
+        // Leaves the value an empty string
+        void releaseData(slaballocator::SlabAllocator *allocator)
         {
-            DataBlock *db = mRoot;
-            while (db)
+            if (mType == ValueType::STRING)
+            {
+                uint32_t dataLen;
+                memcpy(&dataLen, mStorage + sizeof(void *), sizeof(dataLen));
+                allocator->deallocate(getHeapData(), dataLen);
+            }
+            else if (mType == ValueType::LIST)
             {
-                DataBlock *next = db->mNext;
-                free(db);
-                db = next;
+                getList()->release();
             }
-            mRoot = nullptr;
-            mBlockCount = 0;
+            mType = ValueType::INLINE_STRING;
+            mInlineLength = 0;
         }
 
-        DataBlock *getDataBlock(const void *data, uint32_t dataLen)
+        // The value must have been released
+        void setString(slaballocator::SlabAllocator *allocator, const void *data, uint32_t dataLen)
         {
-            DataBlock *db = (DataBlock *)malloc(sizeof(DataBlock) + dataLen);
-            new (db) DataBlock;
-            db->mData = db + 1;
-            db->mDataLen = dataLen;
-            db->mNext = nullptr;
-            memcpy(db->mData, data, dataLen);
-            if (mRoot)
+            int64_t v;
+            if (parseInteger(data, dataLen, v))
             {
-                DataBlock *previous = mRoot;
-                while (previous && previous->mNext )
-                {
-                    previous = previous->mNext;
-                }
-                previous->mNext = db;
+                setInteger(allocator, v);
+            }
+            else if (dataLen <= INLINE_VALUE_SIZE)
+            {
+                memcpy(mStorage, data, dataLen);
+                mInlineLength = uint8_t(dataLen);
+                mType = ValueType::INLINE_STRING;
             }
             else
             {
-                mRoot = db;
+                void *heapData = allocator->allocate(dataLen);
+                memcpy(heapData, data, dataLen);
+                memcpy(mStorage, &heapData, sizeof(heapData));
+                memcpy(mStorage + sizeof(void *), &dataLen, sizeof(dataLen));
+                mType = ValueType::STRING;
             }
-            mBlockCount++;
-            return db;
         }
 
         bool isList(void) const
         {
-            return mIsList;
+            return mType == ValueType::LIST;
+        }
+
+        // Only valid when the value is a list
+        quicklist::QuickList *getList(void) const
+        {
+            quicklist::QuickList *ret;
+            memcpy(&ret, mStorage, sizeof(ret));
+            return ret;
+        }
+
+        // Readers record their use of a value while sharing its shard's lock, so these are atomic
+        uint16_t getAccess(void) const
+        {
+            return mAccess.load(std::memory_order_relaxed);
+        }
+
+        void setAccess(uint16_t access)
+        {
+            mAccess.store(access, std::memory_order_relaxed);
         }
 
-        uint32_t getBlockCount(void) const
+    private:
+        enum class ValueType : uint8_t
+        {
+            INLINE_STRING,  // The bytes themselves, in 'mStorage'
+            STRING,         // A pointer to the bytes and their length
+            INTEGER,
+            LIST,           // A pointer to the quicklist
+        };
+
+        void *getHeapData(void) const
         {
-            return mBlockCount;
+            void *ret;
+            memcpy(&ret, mStorage, sizeof(ret));
+            return ret;
         }
 
-        bool        mIsList{ false };
-        uint32_t    mBlockCount{ 0 };
-        DataBlock   *mRoot{ nullptr };
+        uint8_t     mStorage[INLINE_VALUE_SIZE];
+        uint8_t     mInlineLength{ 0 };
+        ValueType   mType{ ValueType::INLINE_STRING };
+        std::atomic< uint16_t > mAccess{ 0 };   // Seconds clock when last used (LRU), or minutes clock and use count (LFU)
     };
 
-    typedef std::unordered_map< std::string, Value * > KeyValueMap;
+    static_assert(sizeof(Value) == 24, "A value should fill the 24 byte size class");
 
-    class KeyValueDatabaseImpl : public KeyValueDatabase
+    // Converts an inclusive range of list indices, either of which may count back from the end,
+    // into a start and count within a list of this length.  Returns false if the range is empty.
+    static bool getListRange(uint32_t length, int64_t start, int64_t stop, uint32_t &first, uint32_t &count)
     {
-    public:
-        KeyValueDatabaseImpl(void)
+        int64_t len = int64_t(length);
+        if (start < 0)
+        {
+            start += len;
+        }
+        if (stop < 0)
+        {
+            stop += len;
+        }
+        if (start < 0)
+        {
+            start = 0;
+        }
+        if (stop >= len)
+        {
+            stop = len - 1;
+        }
+        if (start > stop)
         {
+            return false;
+        }
+        first = uint32_t(start);
+        count = uint32_t(stop - start + 1);
+        return true;
+    }
+
+    // Passes the elements of a list on to a list callback
+    class ListReply
+    {
+    public:
+        void            *mUserPointer{ nullptr };
+        KVD_listCallback mCallback{ nullptr };
+        int32_t         mCount{ 0 };
+    };
+
+    static void replyElement(void *userPtr, uint32_t index, const void *data, uint32_t dataLen)
+    {
+        ListReply *lr = (ListReply *)userPtr;
+        (*lr->mCallback)(lr->mUserPointer, lr->mCount, index, data, dataLen);
+    }
+
+    // A fast random number for sampling keys and for the LFU use count; each thread has its own
+    static uint64_t getRandom(void)
+    {
+        static thread_local uint64_t tState = uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+        tState ^= tState << 13;
+        tState ^= tState >> 7;
+        tState ^= tState << 17;
+        return tState;
+    }
+
+    // The LFU access bits hold the minutes clock (mod 256) when the use count was last decayed,
+    // over the count itself.  As in Redis, the count grows logarithmically, so eight bits go a
+    // long way, and drops by one for every LFU_DECAY_TIME minutes the key goes unused.
+    static uint32_t getLfuCount(uint16_t access, uint32_t seconds)
+    {
+        uint8_t elapsed = uint8_t(uint8_t(seconds / 60) - uint8_t(access >> 8));
+        uint32_t count = access & 0xFF;
+        uint32_t periods = elapsed / LFU_DECAY_TIME;
+        return periods > count ? 0 : count - periods;
+    }
+
+    static uint16_t makeLfuAccess(uint32_t count, uint32_t seconds)
+    {
+        return uint16_t((uint32_t(uint8_t(seconds / 60)) << 8) | count);
+    }
+
+    // A key which may be evicted, as in Redis's eviction pool
+    class EvictionCandidate
+    {
+    public:
+        uint64_t    mScore{ 0 };    // Higher is evicted first
+        uint32_t    mDatabase{ 0 };
+        std::string mKey;
+    };
 
+    // A key's expiry time, followed by a copy of the key so the active expiry cycle can find the
+    // key to delete
+    class KeyExpiry : public expiryqueue::ExpiryEntry
+    {
+    public:
+        char *getKey(void)
+        {
+            return (char *)(this + 1);
         }
 
-        virtual ~KeyValueDatabaseImpl(void)
+        uint32_t    mKeyLength{ 0 };
+    };
+
+    // What a shard holds.  As in Redis, keys with an expiry are also kept in a second table, so a
+    // shard without any costs nothing extra to look up in.  Their expiries are queued by time as
+    // well.  With the key index on, the keys are also kept in order, for scans of a prefix.
+    // SWAPDB and FLUSHDB swap or replace the tables whole.
+    class ShardTables
+    {
+    public:
+        keyhashtable::KeyHashTable  *mKeys{ nullptr };
+        keyhashtable::KeyHashTable  *mExpires{ nullptr };   // Key to its KeyExpiry
+        expiryqueue::ExpiryQueue    *mExpiryQueue{ nullptr };
+        keyindex::KeyIndex          *mIndex{ nullptr };     // The keys in order; only while the key index is on
+    };
+
+    // Each logical database is split into independently locked shards, chosen by the top bits of
+    // each key's hash, so commands on different keys from different worker threads rarely contend.
+    // Each shard has a reader/writer lock; commands which only read (GET, EXISTS) share it.
+    class Shard : public ShardTables
+    {
+    public:
+        rwlock::RWLock              mLock;
+        int64_t                     mTableBytes{ 0 };   // What the tables and queue took when last counted
+        uint32_t                    mDatabase{ 0 };     // The logical database the shard is part of
+        char                        mPad[64]; // Keeps neighboring shards' locks out of each other's cache lines
+    };
+
+    // Work for the lazy free thread: a value UNLINK took out of its database, or the tables a
+    // flush replaced
+    class LazyFreeJob
+    {
+    public:
+        LazyFreeJob     *mNext{ nullptr };
+        Value           *mValue{ nullptr };
+        ShardTables     mTables;        // Only when there is no value
+    };
+
+    // The key, its length and its hash, and the shard it belongs to
+    class KeyRef
+    {
+    public:
+        const char  *mKey{ nullptr };
+        uint32_t    mKeyLength{ 0 };
+        uint64_t    mHash{ 0 };
+        Shard       *mShard{ nullptr };
+    };
+
+    class KeyValueDatabaseImpl;
+
+    // Passed along by 'scan' and 'keys' to each key visited
+    class ScanState
+    {
+    public:
+        KeyValueDatabaseImpl    *mThis{ nullptr };
+        Shard                   *mShard{ nullptr };
+        wildcard::WildCard      *mMatch{ nullptr };
+        void                    *mUserPtr{ nullptr };
+        KVD_scanCallback        mCallback{ nullptr };
+        std::string             *mKeys{ nullptr };  // Set by 'keys' in place of mCallback; each key is copied here after its length
+        int64_t                 mNow{ 0 };          // Keys expiring at or before this are skipped
+        uint32_t                mSeen{ 0 };         // Keys visited, whether they matched or not
+        uint32_t                mMatched{ 0 };      // Keys handed to the caller (or copied)
+        uint32_t                mMaxSeen{ UINT32_MAX }; // A walk of the key index stops once this many are seen
+        std::string             mResumeKey;         // The last key seen by a walk which stopped early
+    };
+
+    // Where a scan through the key index stopped: the shard and the last key it returned.  The
+    // cursor handed back names the slot, along with an id in case the slot has been reused.
+    class ScanResume
+    {
+    public:
+        uint64_t    mId{ 0 };
+        uint32_t    mShard{ 0 };    // Index into mShards
+        std::string mKey;
+    };
+
+    class KeyValueDatabaseImpl : public KeyValueDatabase
+    {
+    public:
+        // The shards of every database are kept in one array, database by database
+        KeyValueDatabaseImpl(uint32_t databaseCount) : mDatabaseCount(databaseCount ? databaseCount : 1), mShards(mDatabaseCount * SHARD_COUNT), mKeyCounts(mDatabaseCount)
         {
-            for (auto &i : mDatabase)
+            mAllocator = slaballocator::SlabAllocator::create();
+            for (size_t i = 0; i < mShards.size(); i++)
             {
-                Value *v = i.second;
-                delete v;
+                Shard &s = mShards[i];
+                s.mDatabase = uint32_t(i / SHARD_COUNT);
+                createTables(s, false);
+                s.mTableBytes = getTableBytes(s);
+                mTableBytes += s.mTableBytes;
             }
+            mClock = uint32_t(getTimeMilliseconds() / 1000);
+            mEvictionPool.reserve(EVICTION_POOL_SIZE + 1);
+            mLazyFreeThread = new std::thread([this]()
+            {
+                lazyFree();
+            });
         }
 
-
-        virtual void del(const char *_key, void *userPointer,KVD_returnCodeCallback callback) override final
+        virtual ~KeyValueDatabaseImpl(void)
         {
-            bool ret = false;
-            lock();
-            std::string key(_key);
-            const auto &found = mDatabase.find(key);
-            if (found != mDatabase.end())
-            {
-                Value *v = (*found).second;
-                delete v;
-                mDatabase.erase(found);
-                ret = true;
+            {
+                std::lock_guard< std::mutex > lock(mLazyFreeLock);
+                mLazyFreeExit = true;
             }
-            unlock();
-            if (callback)
+            mLazyFreeSignal.notify_one();
+            mLazyFreeThread->join();
+            delete mLazyFreeThread;
+            for (auto &s : mShards)
             {
-                (*callback)(true,ret ? 1 : 0, userPointer);
+                freeTables(s);
             }
+            mAllocator->release();
         }
 
-        virtual void exists(const char *_key,void *userPointer, KVD_returnCodeCallback callback) override final
+        void createTables(ShardTables &t, bool keyIndex)
         {
-            bool ret = false;
-            lock();
-            std::string key(_key);
-            const auto &found = mDatabase.find(key);
-            if (found != mDatabase.end())
+            t.mKeys = keyhashtable::KeyHashTable::create();
+            t.mExpires = keyhashtable::KeyHashTable::create();
+            t.mExpiryQueue = expiryqueue::ExpiryQueue::create();
+            t.mIndex = keyIndex ? keyindex::KeyIndex::create() : nullptr;
+        }
+
+        // Frees every key, value and expiry in the tables, then the tables themselves
+        void freeTables(ShardTables &t)
+        {
+            for (uint32_t i = 0; i < t.mKeys->getSlotCount(); i++)
             {
-                ret = true;
+                const char *key;
+                uint32_t keyLen;
+                void *value;
+                if (t.mKeys->getSlot(i, key, keyLen, value))
+                {
+                    destroyValue(static_cast<Value *>(value));
+                }
             }
-            unlock();
-            if (callback)
+            t.mKeys->release();
+            for (uint32_t i = 0; i < t.mExpires->getSlotCount(); i++)
             {
-                (*callback)(true,ret ? 1 : 0, userPointer);
+                const char *key;
+                uint32_t keyLen;
+                void *e;
+                if (t.mExpires->getSlot(i, key, keyLen, e))
+                {
+                    destroyExpiry(static_cast<KeyExpiry *>(e));
+                }
+            }
+            t.mExpires->release();
+            t.mExpiryQueue->release();
+            if (t.mIndex)
+            {
+                t.mIndex->release();
             }
         }
 
-        virtual void get(const char *_key,void *userPointer, KVD_dataCallback callback) override final
+        // Runs on its own thread, freeing the values and tables queued by UNLINK and the
+        // asynchronous flushes, so no client waits while a big list or every key is walked.
+        // Anything still queued when the database is released is freed before the thread exits.
+        void lazyFree(void)
         {
-            lock();
-            std::string key(_key);
-            const auto &found = mDatabase.find(key);
-            if (found != mDatabase.end())
+            std::unique_lock< std::mutex > lock(mLazyFreeLock);
+            for (;;)
             {
-                Value *v = found->second;
-                if (v->mRoot)
+                while (mLazyFreeJobs.load(std::memory_order_acquire) == nullptr && !mLazyFreeExit)
                 {
-                    (*callback)(userPointer, v->mRoot->mData, v->mRoot->mDataLen);
+                    mLazyFreeSignal.wait(lock);
                 }
-                else
+                LazyFreeJob *job = mLazyFreeJobs.exchange(nullptr, std::memory_order_acquire);
+                if (job == nullptr)
+                {
+                    break;
+                }
+                lock.unlock();
+                while (job)
                 {
-                    (*callback)(userPointer, nullptr, 0);
+                    LazyFreeJob *next = job->mNext;
+                    uint64_t objectCount = 1;
+                    if (job->mValue)
+                    {
+                        destroyValue(job->mValue);
+                    }
+                    else
+                    {
+                        objectCount = job->mTables.mKeys->size();
+                        freeTables(job->mTables);
+                    }
+                    mLazyFreePending.fetch_sub(objectCount, std::memory_order_relaxed);
+                    delete job;
+                    job = next;
                 }
+                lock.lock();
             }
-            else
+        }
+
+        // Jobs are pushed onto a lock free stack, which the thread empties in one exchange, so a
+        // command queuing one never waits on the thread.  Only a push onto an empty stack can
+        // find the thread asleep, so only that one takes the lock to wake it.
+        void queueLazyFree(LazyFreeJob *job, uint64_t objectCount)
+        {
+            mLazyFreePending.fetch_add(objectCount, std::memory_order_relaxed);
+            LazyFreeJob *head = mLazyFreeJobs.load(std::memory_order_relaxed);
+            do
             {
-                (*callback)(userPointer, nullptr, 0);
+                job->mNext = head;
+            } while (!mLazyFreeJobs.compare_exchange_weak(head, job, std::memory_order_release, std::memory_order_relaxed));
+            if (head == nullptr)
+            {
+                {
+                    std::lock_guard< std::mutex > lock(mLazyFreeLock);
+                }
+                mLazyFreeSignal.notify_one();
             }
-            unlock();
         }
 
-        // append to an existing or new record; returns length of the list
-        virtual void push(const char *_key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) override final
+        // Frees a value taken out of its database.  Freeing a big list means walking all of its
+        // nodes, so that is left to the lazy free thread; anything else costs no more than
+        // queuing it would.
+        void lazyFreeValue(Value *v)
         {
-            int32_t ret = -1;
-            lock();
-            std::string key(_key);
-            const auto &found = mDatabase.find(key);
-            if (found == mDatabase.end())
+            if (v->isList() && v->getList()->size() > LAZYFREE_THRESHOLD)
             {
-                Value *v = new Value(data, dataLen,true);
-                mDatabase[key] = v;
-                ret = 1;
+                LazyFreeJob *job = new LazyFreeJob;
+                job->mValue = v;
+                queueLazyFree(job, 1);
             }
             else
             {
-                Value *v = found->second;
-                if (v->mIsList)
-                {
-                    ret = v->push(data, dataLen);
-                    mDatabase[key] = v;
-                }
+                destroyValue(v);
             }
-            unlock();
-
-            (*callback)(true,ret, userPointer);
-
         }
 
-        virtual void set(const char *_key, const void *data, uint32_t dataLen, void *userPointer, KVD_standardCallback callback) override final
+        // Takes the write lock of every shard of the database, in order
+        void lockDatabase(uint32_t db)
         {
-            lock();
-            std::string key(_key);
-            const auto &found = mDatabase.find(key);
-            if (found == mDatabase.end())
+            for (uint32_t i = 0; i < SHARD_COUNT; i++)
             {
-                Value *v = new Value(data, dataLen,false);
-                mDatabase[key] = v;
+                mShards[db * SHARD_COUNT + i].mLock.lockWrite();
             }
-            else
+        }
+
+        void unlockDatabase(uint32_t db)
+        {
+            for (uint32_t i = 0; i < SHARD_COUNT; i++)
             {
-                Value *v = found->second;
-                v->newData(data, dataLen);
+                unlockWrite(mShards[db * SHARD_COUNT + i]);
             }
-            unlock();
-            (*callback)(true, userPointer);
         }
 
-        virtual void release(void) override final
+        // Values come from the slab allocator, as do the blocks holding their strings
+        Value *createValue(const void *data, uint32_t dataLen)
         {
-            delete this;
+            Value *v = new (mAllocator->allocate(uint32_t(sizeof(Value)))) Value;
+            v->setString(mAllocator, data, dataLen);
+            initAccess(v);
+            return v;
         }
 
-        void lock(void)
+        Value *createValue(int64_t integer)
         {
-            mMutex.lock();
+            Value *v = new (mAllocator->allocate(uint32_t(sizeof(Value)))) Value;
+            v->setInteger(mAllocator, integer);
+            initAccess(v);
+            return v;
         }
 
-        void unlock(void)
+        Value *createList(void)
         {
-            mMutex.unlock();
+            Value *v = new (mAllocator->allocate(uint32_t(sizeof(Value)))) Value;
+            v->newList(mAllocator);
+            initAccess(v);
+            return v;
         }
 
-        bool isInteger(const char *key) 
+        // A new key starts out as just used
+        void initAccess(Value *v) const
         {
-            bool ret = false;
+            uint32_t seconds = mClock.load(std::memory_order_relaxed);
+            v->setAccess(mEvictionPolicy.load(std::memory_order_relaxed) == EvictionPolicy::ALLKEYS_LFU ? makeLfuAccess(LFU_INIT_VAL, seconds) : uint16_t(seconds));
+        }
 
-            const auto &found = mDatabase.find(std::string(key));
-            if (found != mDatabase.end())
+        // Records a use of the key for the LRU and LFU policies.  Under LRU the value only changes
+        // once a second, and under LFU rarely once the count is high, so keys which are read all
+        // the time do not have their cache lines written over and over.
+        void touch(Value *v) const
+        {
+            EvictionPolicy policy = mEvictionPolicy.load(std::memory_order_relaxed);
+            uint32_t seconds = mClock.load(std::memory_order_relaxed);
+            uint16_t access = v->getAccess();
+            uint16_t newAccess = access;
+            if (policy == EvictionPolicy::ALLKEYS_LRU)
             {
-                ret = found->second->isInteger();
+                newAccess = uint16_t(seconds);
+            }
+            else if (policy == EvictionPolicy::ALLKEYS_LFU)
+            {
+                uint32_t count = getLfuCount(access, seconds);
+                if (count < 255)
+                {
+                    double r = double(getRandom() >> 11) * (1.0 / 9007199254740992.0);
+                    double base = count > LFU_INIT_VAL ? double(count - LFU_INIT_VAL) : 0;
+                    if (r < 1.0 / (base * LFU_LOG_FACTOR + 1))
+                    {
+                        count++;
+                    }
+                }
+                newAccess = makeLfuAccess(count, seconds);
+            }
+            if (newAccess != access)
+            {
+                v->setAccess(newAccess);
             }
-
-            return ret;
         }
 
-        virtual void increment(const char *key,int32_t v, void *userPointer, KVD_returnCodeCallback callback) override final
+        void destroyValue(Value *v)
         {
-            int32_t ret = 0;
+            v->releaseData(mAllocator);
+            v->~Value();
+            mAllocator->deallocate(v, uint32_t(sizeof(Value)));
+        }
 
-            bool isOk = false;
+        KeyRef getKeyRef(uint32_t db, const char *key)
+        {
+            assert(db < mDatabaseCount);
+            KeyRef ret;
+            ret.mKey = key;
+            ret.mKeyLength = uint32_t(strlen(key));
+            ret.mHash = keyhashtable::hashKey(key, ret.mKeyLength);
+            ret.mShard = &mShards[db * SHARD_COUNT + (ret.mHash >> (64 - SHARD_BITS))];
+            return ret;
+        }
 
-            lock();
+        // The shard's lock must be held.  A key whose time has passed is not found, though it
+        // is only deleted once a writer comes across it (see expireIfNeeded).
+        Value *find(const KeyRef &k) const
+        {
+            Value *v = static_cast<Value *>(k.mShard->mKeys->find(k.mKey, k.mKeyLength, k.mHash));
+            if (v && isExpired(k))
+            {
+                v = nullptr;
+            }
+            if (v)
+            {
+                touch(v);
+            }
+            return v;
+        }
 
-            const auto &found = mDatabase.find(std::string(key));
-            if (found == mDatabase.end())
+        void **insert(const KeyRef &k, bool &added)
+        {
+            void **slot = k.mShard->mKeys->insert(k.mKey, k.mKeyLength, k.mHash, added);
+            if (!added)
             {
-                char scratch[512];
-                snprintf(scratch, 512, "%d", v);
-                Value *vstore = new Value(scratch, uint32_t(strlen(scratch)),false);
-                mDatabase[std::string(key)] = vstore;
-                isOk = true;
-                ret = v;
+                touch(static_cast<Value *>(*slot));
             }
             else
             {
-                Value *vv = found->second;
-                if (vv->isInteger())
+                mKeyCounts[k.mShard->mDatabase].fetch_add(1, std::memory_order_relaxed);
+                if (k.mShard->mIndex)
                 {
-                    int32_t cv = vv->getInteger();
-                    ret = cv + v;
-                    char scratch[512];
-                    snprintf(scratch, 512, "%d", ret);
-                    vv->newData(scratch, uint32_t(strlen(scratch)));
-                    isOk = true;
+                    k.mShard->mIndex->insert(k.mKey, k.mKeyLength);
                 }
             }
-            unlock();
-            (*callback)(isOk, ret, userPointer);
+            return slot;
         }
 
-        bool isList(const char *key)
+        static int64_t getTableBytes(const Shard &s)
         {
-            bool ret = false;
-
-            lock();
+            return int64_t(s.mKeys->getMemoryUsed() + s.mExpires->getMemoryUsed() + s.mExpiryQueue->getMemoryUsed() + (s.mIndex ? s.mIndex->getMemoryUsed() : 0));
+        }
 
-            const auto &found = mDatabase.find(std::string(key));
-            if (found != mDatabase.end())
+        // Every change to a shard ends here, so the memory its tables take is kept counted
+        // without having to visit every shard
+        void unlockWrite(Shard &s)
+        {
+            int64_t tableBytes = getTableBytes(s);
+            if (tableBytes != s.mTableBytes)
             {
-                Value *v = found->second;
-                ret = v->mIsList;
+                mTableBytes.fetch_add(tableBytes - s.mTableBytes, std::memory_order_relaxed);
+                s.mTableBytes = tableBytes;
             }
-
-            unlock();
-
-            return ret;
+            s.mLock.unlockWrite();
         }
 
-        // not use fully implemented
-        virtual void watch(uint32_t keyCount, const char **keys, void *userData, KVD_standardCallback callback) override final
+        // Bytes counted against the memory limit: every block the allocator has handed out
+        // (values, strings, lists and expiries, rounded up to their chunk sizes) and the tables
+        uint64_t getUsedMemory(void) const
         {
-            (*callback)(true, userData);
+            int64_t tableBytes = mTableBytes.load(std::memory_order_relaxed);
+            return mAllocator->getUsedBytes() + uint64_t(tableBytes > 0 ? tableBytes : 0);
         }
 
-        virtual void unwatch(void *userData, KVD_standardCallback callback) override final
+        KeyExpiry *findExpiry(const KeyRef &k) const
         {
-            (*callback)(true, userData);
+            if (k.mShard->mExpires->size() == 0)
+            {
+                return nullptr;
+            }
+            return static_cast<KeyExpiry *>(k.mShard->mExpires->find(k.mKey, k.mKeyLength, k.mHash));
         }
 
-        // Give up a timeslice to the database system
-        virtual void pump(void) override final
+        bool isExpired(const KeyRef &k) const
         {
+            KeyExpiry *e = findExpiry(k);
+            return e && e->mWhen <= getTimeMilliseconds();
+        }
 
+        void destroyExpiry(KeyExpiry *e)
+        {
+            uint32_t size = uint32_t(sizeof(KeyExpiry)) + e->mKeyLength + 1;
+            e->~KeyExpiry();
+            mAllocator->deallocate(e, size);
         }
 
-        virtual void select(uint32_t index, void *userPointer, KVD_standardCallback callback) override final
+        // The shard's write lock must be held for everything which changes a key or its expiry
+        void setExpiry(const KeyRef &k, int64_t when)
         {
-            assert(callback);
-            if (!callback) return;
-            if (index == 0)
+            bool added;
+            void **slot = k.mShard->mExpires->insert(k.mKey, k.mKeyLength, k.mHash, added);
+            if (added)
             {
-                (*callback)(true, userPointer);
+                KeyExpiry *e = new (mAllocator->allocate(uint32_t(sizeof(KeyExpiry)) + k.mKeyLength + 1)) KeyExpiry;
+                e->mKeyLength = k.mKeyLength;
+                memcpy(e->getKey(), k.mKey, k.mKeyLength + 1);
+                k.mShard->mExpiryQueue->add(e, when);
+                *slot = e;
             }
             else
             {
-                (*callback)(false, userPointer);
+                k.mShard->mExpiryQueue->update(static_cast<KeyExpiry *>(*slot), when);
             }
         }
 
-        virtual void setnx(const char *_key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) override final
+        // Returns true if the key had an expiry
+        bool clearExpiry(const KeyRef &k)
         {
-            bool added = false;
-            lock();
-            std::string key(_key);
-            const auto &found = mDatabase.find(key);
-            if (found == mDatabase.end())
+            if (k.mShard->mExpires->size() == 0)
             {
-                Value *v = new Value(data, dataLen, false);
-                mDatabase[key] = v;
-                added = true;
+                return false;
             }
-            unlock();
-            (*callback)(true,added ? 1 : 0, userPointer);
+            KeyExpiry *e = static_cast<KeyExpiry *>(k.mShard->mExpires->remove(k.mKey, k.mKeyLength, k.mHash));
+            if (e == nullptr)
+            {
+                return false;
+            }
+            k.mShard->mExpiryQueue->remove(e);
+            destroyExpiry(e);
+            return true;
         }
 
-        // Returns a list of keys which match this wildcard.  If 'match' is null, then it returns
-        // all keys in the database
-        virtual void scan(uint32_t scanIndex,uint32_t maxScan,const char *match,void *userPtr,KVD_scanCallback callback) override final
+        // Takes the key, and its expiry if it has one, out of the database and returns its value
+        // for the caller to free; null if the key did not exist.  The expiry goes last, as the
+        // key may be the copy it holds (see expireDue).
+        Value *detachKey(const KeyRef &k)
         {
-            lock();
-            uint32_t scanCount = 0;
-            uint32_t index = 0;
-            wildcard::WildCard *wc = nullptr;
-            if (match)
-            {
-                wc = wildcard::WildCard::create(match);
-            }
-            bool finished = true;
-            for (auto &i : mDatabase)
+            Value *v = static_cast<Value *>(k.mShard->mKeys->remove(k.mKey, k.mKeyLength, k.mHash));
+            if (v)
             {
-                bool isMatch = true;
-                if (wc)
+                mKeyCounts[k.mShard->mDatabase].fetch_sub(1, std::memory_order_relaxed);
+                if (k.mShard->mIndex)
                 {
-                    isMatch = wc->isMatch(i.first.c_str());
-                }
-                if (isMatch)
-                {
-                    if (index >= scanIndex)
-                    {
-                        if (scanCount >= maxScan)
-                        {
-                            finished = false;
-                            break;
-                        }
-                        scanCount++;
-                        (*callback)(userPtr, i.first.c_str(),index);
-                    }
-                    index++;
+                    k.mShard->mIndex->remove(k.mKey, k.mKeyLength);
                 }
             }
-            (*callback)(userPtr, nullptr,finished ? 0 : index); // notify call of end of scan operation
-            unlock();
+            clearExpiry(k);
+            return v;
         }
 
-        std::mutex      mMutex;
-        KeyValueMap mDatabase;
-    };
+        // Deletes the key, and its expiry if it has one; returns true if the key existed
+        bool removeKey(const KeyRef &k)
+        {
+            Value *v = detachKey(k);
+            if (v)
+            {
+                destroyValue(v);
+            }
+            return v != nullptr;
+        }
+
+        // Every command which changes a key calls this first, so it never sees an expired key
+        void expireIfNeeded(const KeyRef &k)
+        {
+            if (isExpired(k))
+            {
+                removeKey(k);
+            }
+        }
+
+        // The value is freed once the shard's lock is released, so other commands on the shard
+        // do not wait while a big list is walked
+        virtual void del(uint32_t db, const char *_key, void *userPointer,KVD_returnCodeCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            Value *v = detachKey(k);
+            unlockWrite(*k.mShard);
+            if (v)
+            {
+                destroyValue(v);
+            }
+            if (callback)
+            {
+                (*callback)(true,v ? 1 : 0, userPointer);
+            }
+        }
+
+        // As 'del', but a big list is left to the lazy free thread, so not even this client
+        // waits for it
+        virtual void unlink(uint32_t db, uint32_t keyCount, const char **keys, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            int64_t removed = 0;
+            for (uint32_t i = 0; i < keyCount; i++)
+            {
+                KeyRef k = getKeyRef(db, keys[i]);
+                k.mShard->mLock.lockWrite();
+                expireIfNeeded(k);
+                Value *v = detachKey(k);
+                unlockWrite(*k.mShard);
+                if (v)
+                {
+                    lazyFreeValue(v);
+                    removed++;
+                }
+            }
+            if (callback)
+            {
+                (*callback)(true, removed, userPointer);
+            }
+        }
+
+        virtual void exists(uint32_t db, const char *_key,void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            bool ret = false;
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockRead();
+            if (find(k))
+            {
+                ret = true;
+            }
+            k.mShard->mLock.unlockRead();
+            if (callback)
+            {
+                (*callback)(true,ret ? 1 : 0, userPointer);
+            }
+        }
+
+        // The callback is made with the shard's read lock held, so the value can not change
+        // or go away while it is being copied
+        virtual void get(uint32_t db, const char *_key,void *userPointer, KVD_dataCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockRead();
+            Value *v = find(k);
+            char scratch[MAX_INTEGER_TEXT + 1];
+            const void *data;
+            uint32_t dataLen;
+            if (v && v->getString(scratch, data, dataLen))
+            {
+                (*callback)(userPointer, data, dataLen);
+            }
+            else
+            {
+                (*callback)(userPointer, nullptr, 0);
+            }
+            k.mShard->mLock.unlockRead();
+        }
+
+        // Adds to the head or tail of a new or existing list; returns the length of the list
+        virtual void push(uint32_t db, const char *_key, bool toHead, uint32_t valueCount, const void **values, const uint32_t *valueLengths, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            int32_t ret = -1;
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            bool added;
+            void **slot = insert(k, added);
+            if (added)
+            {
+                *slot = createList();
+            }
+            Value *v = static_cast<Value *>(*slot);
+            if (v->isList())
+            {
+                for (uint32_t i = 0; i < valueCount; i++)
+                {
+                    ret = int32_t(v->getList()->push(toHead, values[i], valueLengths[i]));
+                }
+            }
+            unlockWrite(*k.mShard);
+
+            (*callback)(ret >= 0,ret, userPointer);
+
+        }
+
+        // Removes the key once its list is empty.  The shard's write lock must be held.
+        void removeIfEmpty(const KeyRef &k, Value *v)
+        {
+            if (v->getList()->size() == 0)
+            {
+                removeKey(k);
+            }
+        }
+
+        // The element is handed to the callback before it is removed
+        virtual void pop(uint32_t db, const char *_key, bool fromHead, void *userPointer, KVD_listCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            Value *v = find(k);
+            const void *data;
+            uint32_t dataLen;
+            if (v == nullptr)
+            {
+                (*callback)(userPointer, 0, 0, nullptr, 0);
+            }
+            else if (!v->isList())
+            {
+                (*callback)(userPointer, -1, 0, nullptr, 0);
+            }
+            else if (v->getList()->getElement(fromHead ? 0 : -1, data, dataLen))
+            {
+                (*callback)(userPointer, 1, 0, nullptr, 0);
+                (*callback)(userPointer, 1, 0, data, dataLen);
+                v->getList()->pop(fromHead);
+                removeIfEmpty(k, v);
+            }
+            unlockWrite(*k.mShard);
+        }
+
+        virtual void listRange(uint32_t db, const char *_key, int64_t start, int64_t stop, void *userPointer, KVD_listCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockRead();
+            Value *v = find(k);
+            uint32_t first;
+            uint32_t count;
+            if (v == nullptr)
+            {
+                (*callback)(userPointer, 0, 0, nullptr, 0);
+            }
+            else if (!v->isList())
+            {
+                (*callback)(userPointer, -1, 0, nullptr, 0);
+            }
+            else if (!getListRange(v->getList()->size(), start, stop, first, count))
+            {
+                (*callback)(userPointer, 0, 0, nullptr, 0);
+            }
+            else
+            {
+                ListReply lr;
+                lr.mUserPointer = userPointer;
+                lr.mCallback = callback;
+                lr.mCount = int32_t(count);
+                (*callback)(userPointer, lr.mCount, 0, nullptr, 0);
+                v->getList()->forEach(first, count, &lr, replyElement);
+            }
+            k.mShard->mLock.unlockRead();
+        }
+
+        virtual void listIndex(uint32_t db, const char *_key, int64_t index, void *userPointer, KVD_listCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockRead();
+            Value *v = find(k);
+            const void *data;
+            uint32_t dataLen;
+            if (v && !v->isList())
+            {
+                (*callback)(userPointer, -1, 0, nullptr, 0);
+            }
+            else if (v && v->getList()->getElement(index, data, dataLen))
+            {
+                (*callback)(userPointer, 1, 0, nullptr, 0);
+                (*callback)(userPointer, 1, 0, data, dataLen);
+            }
+            else
+            {
+                (*callback)(userPointer, 0, 0, nullptr, 0);
+            }
+            k.mShard->mLock.unlockRead();
+        }
+
+        virtual void listLength(uint32_t db, const char *_key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            int32_t ret = 0;
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockRead();
+            Value *v = find(k);
+            if (v)
+            {
+                ret = v->isList() ? int32_t(v->getList()->size()) : -1;
+            }
+            k.mShard->mLock.unlockRead();
+            (*callback)(ret >= 0, ret, userPointer);
+        }
+
+        virtual void listTrim(uint32_t db, const char *_key, int64_t start, int64_t stop, void *userPointer, KVD_standardCallback callback) override final
+        {
+            bool ok = true;
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            Value *v = find(k);
+            if (v && !v->isList())
+            {
+                ok = false;
+            }
+            else if (v)
+            {
+                uint32_t first;
+                uint32_t count;
+                if (getListRange(v->getList()->size(), start, stop, first, count))
+                {
+                    v->getList()->trim(first, count);
+                }
+                else
+                {
+                    v->getList()->trim(0, 0);
+                }
+                removeIfEmpty(k, v);
+            }
+            unlockWrite(*k.mShard);
+            (*callback)(ok, userPointer);
+        }
+
+        // The write lock must be held
+        void storeValue(const KeyRef &k, const void *data, uint32_t dataLen)
+        {
+            bool added;
+            void **slot = insert(k, added);
+            if (added)
+            {
+                *slot = createValue(data, dataLen);
+            }
+            else
+            {
+                Value *v = static_cast<Value *>(*slot);
+                v->newData(mAllocator, data, dataLen);
+            }
+        }
+
+        // As in Redis, a new value replaces any expiry the key had
+        virtual void set(uint32_t db, const char *_key, const void *data, uint32_t dataLen, void *userPointer, KVD_standardCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            storeValue(k, data, dataLen);
+            clearExpiry(k);
+            unlockWrite(*k.mShard);
+            (*callback)(true, userPointer);
+        }
+
+        virtual void setExpire(uint32_t db, const char *_key, const void *data, uint32_t dataLen, int64_t when, void *userPointer, KVD_standardCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            if (when <= getTimeMilliseconds())
+            {
+                removeKey(k);
+            }
+            else
+            {
+                storeValue(k, data, dataLen);
+                setExpiry(k, when);
+            }
+            unlockWrite(*k.mShard);
+            (*callback)(true, userPointer);
+        }
+
+        virtual void expireAt(uint32_t db, const char *_key, int64_t when, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            bool ret = false;
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            if (find(k))
+            {
+                ret = true;
+                if (when <= getTimeMilliseconds())
+                {
+                    removeKey(k);
+                }
+                else
+                {
+                    setExpiry(k, when);
+                }
+            }
+            unlockWrite(*k.mShard);
+            (*callback)(true, ret ? 1 : 0, userPointer);
+        }
+
+        virtual void timeToLive(uint32_t db, const char *_key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            int64_t ret = -2;
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockRead();
+            if (find(k))
+            {
+                KeyExpiry *e = findExpiry(k);
+                ret = e ? e->mWhen - getTimeMilliseconds() : -1;
+                if (ret < 0 && e)
+                {
+                    ret = 0;
+                }
+            }
+            k.mShard->mLock.unlockRead();
+            (*callback)(true, ret, userPointer);
+        }
+
+        virtual void persist(uint32_t db, const char *_key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            bool ret = clearExpiry(k);
+            unlockWrite(*k.mShard);
+            (*callback)(true, ret ? 1 : 0, userPointer);
+        }
+
+        // Deletes up to 'maxCount' keys whose time has passed, earliest first; returns how many
+        // were deleted.  The shard's write lock must be held.
+        uint32_t expireDue(Shard &s, int64_t now, uint32_t maxCount)
+        {
+            uint32_t ret = 0;
+            while (ret < maxCount)
+            {
+                KeyExpiry *e = static_cast<KeyExpiry *>(s.mExpiryQueue->peek());
+                if (e == nullptr || e->mWhen > now)
+                {
+                    break;
+                }
+                // The key copy belongs to the expiry, which detachKey frees last
+                KeyRef k = getKeyRef(s.mDatabase, e->getKey());
+                removeKey(k);
+                ret++;
+            }
+            return ret;
+        }
+
+        // Visits the shards in turn, carrying on from wherever the last cycle stopped, and deletes
+        // the keys which are due a batch at a time.  Rather than sampling random keys with an
+        // expiry as Redis does, each batch takes the earliest expiries from the shard's queue, so
+        // every key looked at is one which is due.  Returns false if the time budget ran out
+        // before every shard was done.
+        bool activeExpireCycle(int64_t now)
+        {
+            auto start = std::chrono::steady_clock::now();
+            uint32_t finished = 0;
+            uint32_t shardCount = uint32_t(mShards.size());
+            while (finished < shardCount)
+            {
+                Shard &s = mShards[mExpireShard];
+                // Only take the write lock if something is due
+                s.mLock.lockRead();
+                KeyExpiry *e = static_cast<KeyExpiry *>(s.mExpiryQueue->peek());
+                bool due = e && e->mWhen <= now;
+                s.mLock.unlockRead();
+                uint32_t expired = 0;
+                if (due)
+                {
+                    s.mLock.lockWrite();
+                    expired = expireDue(s, now, ACTIVE_EXPIRE_KEYS_PER_LOOP);
+                    unlockWrite(s);
+                }
+                if (expired < ACTIVE_EXPIRE_KEYS_PER_LOOP)
+                {
+                    mExpireShard = (mExpireShard + 1) % shardCount;
+                    finished++;
+                }
+                auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                if (elapsed.count() >= ACTIVE_EXPIRE_CYCLE_BUDGET)
+                {
+                    return finished == shardCount;
+                }
+            }
+            return true;
+        }
+
+        // Moves keys along in the tables which are resizing, so a shard which is not being
+        // written to still finishes, as Redis's incremental rehash in serverCron.  Returns false
+        // if the time budget ran out first.
+        bool activeRehashCycle(void)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (auto &s : mShards)
+            {
+                s.mLock.lockRead();
+                bool resizing = s.mKeys->isResizing() || s.mExpires->isResizing();
+                s.mLock.unlockRead();
+                while (resizing)
+                {
+                    s.mLock.lockWrite();
+                    resizing = s.mKeys->rehash(ACTIVE_REHASH_SLOTS) | s.mExpires->rehash(ACTIVE_REHASH_SLOTS);
+                    unlockWrite(s);
+                    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+                    if (elapsed.count() >= ACTIVE_REHASH_CYCLE_BUDGET)
+                    {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Moves keys along in the first table found resizing.  Returns false if none are.
+        bool rehashStep(void)
+        {
+            for (auto &s : mShards)
+            {
+                s.mLock.lockRead();
+                bool resizing = s.mKeys->isResizing() || s.mExpires->isResizing();
+                s.mLock.unlockRead();
+                if (resizing)
+                {
+                    s.mLock.lockWrite();
+                    s.mKeys->rehash(ACTIVE_REHASH_SLOTS);
+                    s.mExpires->rehash(ACTIVE_REHASH_SLOTS);
+                    unlockWrite(s);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+        bool isInteger(uint32_t db, const char *key) 
+        {
+            bool ret = false;
+
+            KeyRef k = getKeyRef(db, key);
+            k.mShard->mLock.lockRead();
+            Value *v = find(k);
+            if (v)
+            {
+                ret = v->isInteger();
+            }
+            k.mShard->mLock.unlockRead();
+
+            return ret;
+        }
+
+        // Integers are updated in place; nothing is allocated or formatted
+        virtual void increment(uint32_t db, const char *key,int64_t v, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            int64_t ret = 0;
+
+            IncrementError error = IncrementError::NONE;
+
+            KeyRef k = getKeyRef(db, key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+
+            bool added;
+            void **slot = insert(k, added);
+            if (added)
+            {
+                *slot = createValue(v);
+                ret = v;
+            }
+            else
+            {
+                Value *vv = static_cast<Value *>(*slot);
+                if (!vv->isInteger())
+                {
+                    error = IncrementError::NOT_AN_INTEGER;
+                }
+                else
+                {
+                    // A result which would overflow fails, leaving the value as it was
+                    int64_t cv = vv->getInteger();
+                    if ((v >= 0 && cv <= INT64_MAX - v) || (v < 0 && cv >= INT64_MIN - v))
+                    {
+                        ret = cv + v;
+                        vv->updateInteger(ret);
+                    }
+                    else
+                    {
+                        error = IncrementError::WOULD_OVERFLOW;
+                    }
+                }
+            }
+            unlockWrite(*k.mShard);
+            if (error == IncrementError::NONE)
+            {
+                (*callback)(true, ret, userPointer);
+            }
+            else
+            {
+                (*callback)(false, int64_t(error), userPointer);
+            }
+        }
+
+        // The result is stored as its text, as Redis does; if that text is an integer it is
+        // stored as one
+        virtual void incrementFloat(uint32_t db, const char *key, long double v, void *userPointer, KVD_incrementFloatCallback callback) override final
+        {
+            IncrementError error = IncrementError::NONE;
+            char text[MAX_FLOAT_TEXT + 1];
+            uint32_t textLen = 0;
+
+            KeyRef k = getKeyRef(db, key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+
+            Value *vv = find(k);
+            long double current = 0;
+            if (vv && !vv->getNumber(current))
+            {
+                error = IncrementError::NOT_A_FLOAT;
+            }
+            else
+            {
+                long double result = current + v;
+                if (std::isnan(result) || std::isinf(result))
+                {
+                    error = IncrementError::NOT_FINITE;
+                }
+                else
+                {
+                    textLen = formatNumber(result, text);
+                    if (vv)
+                    {
+                        vv->newData(mAllocator, text, textLen);
+                    }
+                    else
+                    {
+                        bool added;
+                        *insert(k, added) = createValue(text, textLen);
+                    }
+                }
+            }
+            unlockWrite(*k.mShard);
+            if (error == IncrementError::NONE)
+            {
+                (*callback)(userPointer, text, textLen, error);
+            }
+            else
+            {
+                (*callback)(userPointer, nullptr, 0, error);
+            }
+        }
+
+        bool isList(uint32_t db, const char *key)
+        {
+            bool ret = false;
+
+            KeyRef k = getKeyRef(db, key);
+            k.mShard->mLock.lockRead();
+
+            Value *v = find(k);
+            if (v)
+            {
+                ret = v->isList();
+            }
+
+            k.mShard->mLock.unlockRead();
+
+            return ret;
+        }
+
+        // not use fully implemented
+        virtual void watch(uint32_t db, uint32_t keyCount, const char **keys, void *userData, KVD_standardCallback callback) override final
+        {
+            (*callback)(true, userData);
+        }
+
+        virtual void unwatch(void *userData, KVD_standardCallback callback) override final
+        {
+            (*callback)(true, userData);
+        }
+
+        // Give up a timeslice to the database system
+        // Runs the active expiry and rehash cycles and advances the clock the eviction policies
+        // use.  Every worker pumps the shared database, so the cycles run on whichever thread
+        // gets to them first; the others carry on.  A cycle which runs out of time is picked up
+        // again on the next pump rather than after the usual period.
+        virtual void pump(void) override final
+        {
+            int64_t now = getTimeMilliseconds();
+            mClock.store(uint32_t(now / 1000), std::memory_order_relaxed);
+            if (now < mNextCycle.load(std::memory_order_relaxed) || mCycleRunning.test_and_set(std::memory_order_acquire))
+            {
+                return;
+            }
+            if (now >= mNextCycle.load(std::memory_order_relaxed))
+            {
+                bool done = activeExpireCycle(now);
+                done = activeRehashCycle() && done;
+                mNextCycle.store(done ? now + ACTIVE_EXPIRE_CYCLE_PERIOD : now, std::memory_order_relaxed);
+            }
+            mCycleRunning.clear(std::memory_order_release);
+        }
+
+        // The in memory database has no connections to wait on
+        virtual void setEventLoop(eventloop::EventLoop *loop) override final
+        {
+        }
+
+        // Every callback is made before the call which issued it returns
+        virtual void cancelCallbacks(void *userPointer) override final
+        {
+        }
+
+        virtual uint32_t getDatabaseCount(void) const override final
+        {
+            return mDatabaseCount;
+        }
+
+        virtual bool isConnected(void) const override final
+        {
+            return true;
+        }
+
+        // Every shard of both databases is locked while their tables are swapped, so no command
+        // sees one half swapped and the other not.  The lower database's shards are always locked
+        // first, as the flushes lock them in the same order.
+        virtual void swapDatabases(uint32_t a, uint32_t b, void *userPointer, KVD_standardCallback callback) override final
+        {
+            if (a >= mDatabaseCount || b >= mDatabaseCount)
+            {
+                (*callback)(false, userPointer);
+                return;
+            }
+            if (a != b)
+            {
+                if (a > b)
+                {
+                    std::swap(a, b);
+                }
+                lockDatabase(a);
+                lockDatabase(b);
+                for (uint32_t i = 0; i < SHARD_COUNT; i++)
+                {
+                    Shard &sa = mShards[a * SHARD_COUNT + i];
+                    Shard &sb = mShards[b * SHARD_COUNT + i];
+                    std::swap(static_cast<ShardTables &>(sa), static_cast<ShardTables &>(sb));
+                    std::swap(sa.mTableBytes, sb.mTableBytes);
+                }
+                int64_t keyCount = mKeyCounts[a].load(std::memory_order_relaxed);
+                mKeyCounts[a].store(mKeyCounts[b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                mKeyCounts[b].store(keyCount, std::memory_order_relaxed);
+                unlockDatabase(b);
+                unlockDatabase(a);
+            }
+            (*callback)(true, userPointer);
+        }
+
+        // Gives each shard of the database which has keys new, empty tables.  The database must
+        // be locked.  With 'async' the old tables are queued for the lazy free thread; otherwise
+        // they are added to 'detached', for the caller to free once it has released the locks.
+        void detachDatabase(uint32_t db, bool async, std::vector< ShardTables > &detached)
+        {
+            for (uint32_t i = 0; i < SHARD_COUNT; i++)
+            {
+                Shard &s = mShards[db * SHARD_COUNT + i];
+                if (s.mKeys->size() == 0)
+                {
+                    continue;
+                }
+                if (async)
+                {
+                    LazyFreeJob *job = new LazyFreeJob;
+                    job->mTables = s;
+                    queueLazyFree(job, s.mKeys->size());
+                }
+                else
+                {
+                    detached.push_back(s);
+                }
+                createTables(s, s.mIndex != nullptr);
+            }
+            mKeyCounts[db].store(0, std::memory_order_relaxed);
+        }
+
+        // Either way the database is only locked while its tables are replaced, which does not
+        // grow with the number of keys; freeing them is left to the lazy free thread or done
+        // after the locks are released.
+        virtual void flushDatabase(uint32_t db, bool async, void *userPointer, KVD_standardCallback callback) override final
+        {
+            if (db >= mDatabaseCount)
+            {
+                (*callback)(false, userPointer);
+                return;
+            }
+            std::vector< ShardTables > detached;
+            lockDatabase(db);
+            detachDatabase(db, async, detached);
+            unlockDatabase(db);
+            for (auto &t : detached)
+            {
+                freeTables(t);
+            }
+            (*callback)(true, userPointer);
+        }
+
+        // Every database is locked at once, lowest first, so no command sees some flushed and
+        // others not
+        virtual void flushAll(bool async, void *userPointer, KVD_standardCallback callback) override final
+        {
+            std::vector< ShardTables > detached;
+            for (uint32_t db = 0; db < mDatabaseCount; db++)
+            {
+                lockDatabase(db);
+            }
+            for (uint32_t db = 0; db < mDatabaseCount; db++)
+            {
+                detachDatabase(db, async, detached);
+            }
+            for (uint32_t db = mDatabaseCount; db-- > 0; )
+            {
+                unlockDatabase(db);
+            }
+            for (auto &t : detached)
+            {
+                freeTables(t);
+            }
+            (*callback)(true, userPointer);
+        }
+
+        virtual void setnx(uint32_t db, const char *_key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            bool added = false;
+            KeyRef k = getKeyRef(db, _key);
+            k.mShard->mLock.lockWrite();
+            expireIfNeeded(k);
+            void **slot = insert(k, added);
+            if (added)
+            {
+                *slot = createValue(data, dataLen);
+            }
+            unlockWrite(*k.mShard);
+            (*callback)(true,added ? 1 : 0, userPointer);
+        }
+
+        virtual bool setMaxMemory(uint64_t maxMemory, EvictionPolicy policy) override final
+        {
+            mMaxMemory.store(maxMemory, std::memory_order_relaxed);
+            mEvictionPolicy.store(policy, std::memory_order_relaxed);
+            std::lock_guard< std::mutex > lock(mEvictionLock);
+            mEvictionPool.clear(); // Scored under the old policy
+            return true;
+        }
+
+        virtual void getMaxMemory(uint64_t &maxMemory, EvictionPolicy &policy) override final
+        {
+            maxMemory = mMaxMemory.load(std::memory_order_relaxed);
+            policy = mEvictionPolicy.load(std::memory_order_relaxed);
+        }
+
+        // Evicts one key at a time until the database is back under the limit.  One thread evicts
+        // at a time; a thread which finds another already evicting waits for it and checks again.
+        virtual bool freeMemoryIfNeeded(void) override final
+        {
+            uint64_t maxMemory = mMaxMemory.load(std::memory_order_relaxed);
+            if (maxMemory == 0 || getUsedMemory() <= maxMemory)
+            {
+                return true;
+            }
+            EvictionPolicy policy = mEvictionPolicy.load(std::memory_order_relaxed);
+            if (policy == EvictionPolicy::NO_EVICTION)
+            {
+                return false;
+            }
+            std::lock_guard< std::mutex > lock(mEvictionLock);
+            while (getUsedMemory() > maxMemory)
+            {
+                // A table which is resizing counts both of its slot arrays until the last key has
+                // moved; finishing the move frees the old one, which beats evicting keys for it
+                if (rehashStep())
+                {
+                    continue;
+                }
+                if (!evictKey(policy))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // How strongly the policy wants this key evicted
+        uint64_t getEvictionScore(EvictionPolicy policy, const Value *v) const
+        {
+            uint32_t seconds = mClock.load(std::memory_order_relaxed);
+            if (policy == EvictionPolicy::ALLKEYS_LRU)
+            {
+                return uint16_t(uint16_t(seconds) - v->getAccess()); // Seconds idle
+            }
+            return 255 - getLfuCount(v->getAccess(), seconds);
+        }
+
+        // Keeps the pool sorted by score, lowest first, dropping the lowest once it is full
+        void addCandidate(uint64_t score, uint32_t db, const char *key, uint32_t keyLen)
+        {
+            if (mEvictionPool.size() == EVICTION_POOL_SIZE && score <= mEvictionPool[0].mScore)
+            {
+                return;
+            }
+            size_t i = 0;
+            while (i < mEvictionPool.size() && mEvictionPool[i].mScore < score)
+            {
+                i++;
+            }
+            mEvictionPool.insert(mEvictionPool.begin() + i, EvictionCandidate());
+            mEvictionPool[i].mScore = score;
+            mEvictionPool[i].mDatabase = db;
+            mEvictionPool[i].mKey.assign(key, keyLen);
+            if (mEvictionPool.size() > EVICTION_POOL_SIZE)
+            {
+                mEvictionPool.erase(mEvictionPool.begin());
+            }
+        }
+
+        // Adds keys from the shard to the eviction pool.  For LRU and LFU the samples are a run of
+        // slots from a random starting point, as Redis's dictGetSomeKeys; keys land in the table
+        // by their hash, so neighbors are as random as any.  For volatile-ttl the shard's expiry
+        // queue gives the key which is due soonest without any sampling.
+        void sampleShard(Shard &s, EvictionPolicy policy)
+        {
+            s.mLock.lockRead();
+            if (policy == EvictionPolicy::VOLATILE_TTL)
+            {
+                KeyExpiry *e = static_cast<KeyExpiry *>(s.mExpiryQueue->peek());
+                if (e)
+                {
+                    addCandidate(UINT64_MAX - uint64_t(e->mWhen), s.mDatabase, e->getKey(), e->mKeyLength);
+                }
+            }
+            else if (s.mKeys->size())
+            {
+                uint32_t slotCount = s.mKeys->getSlotCount();
+                uint32_t slot = uint32_t(getRandom() % slotCount);
+                uint32_t samples = 0;
+                for (uint32_t i = 0; i < slotCount && samples < EVICTION_SAMPLES; i++)
+                {
+                    const char *key;
+                    uint32_t keyLen;
+                    void *value;
+                    if (s.mKeys->getSlot(slot, key, keyLen, value))
+                    {
+                        addCandidate(getEvictionScore(policy, static_cast<Value *>(value)), s.mDatabase, key, keyLen);
+                        samples++;
+                    }
+                    slot = slot + 1 == slotCount ? 0 : slot + 1;
+                }
+            }
+            s.mLock.unlockRead();
+        }
+
+        // Deletes the key if it is still there (and, for volatile-ttl, still has an expiry); the
+        // pool may hold keys which have gone since they were sampled
+        bool evictCandidate(uint32_t db, const std::string &key, EvictionPolicy policy)
+        {
+            KeyRef k = getKeyRef(db, key.c_str());
+            k.mShard->mLock.lockWrite();
+            bool ret = false;
+            if (policy != EvictionPolicy::VOLATILE_TTL || findExpiry(k))
+            {
+                ret = removeKey(k);
+            }
+            unlockWrite(*k.mShard);
+            return ret;
+        }
+
+        // Deletes any one key from the shard
+        bool evictRandom(Shard &s)
+        {
+            std::string key;
+            s.mLock.lockRead();
+            if (s.mKeys->size())
+            {
+                uint32_t slotCount = s.mKeys->getSlotCount();
+                uint32_t slot = uint32_t(getRandom() % slotCount);
+                for (uint32_t i = 0; i < slotCount; i++)
+                {
+                    const char *k;
+                    uint32_t keyLen;
+                    void *value;
+                    if (s.mKeys->getSlot(slot, k, keyLen, value))
+                    {
+                        key.assign(k, keyLen);
+                        break;
+                    }
+                    slot = slot + 1 == slotCount ? 0 : slot + 1;
+                }
+            }
+            s.mLock.unlockRead();
+            return !key.empty() && evictCandidate(s.mDatabase, key, EvictionPolicy::ALLKEYS_RANDOM);
+        }
+
+        // Evicts one key, sampling the shards in turn, and takes the best candidate sampled so
+        // far.  A shard gives several samples for LRU and LFU but only one key for volatile-ttl,
+        // so volatile-ttl samples as many shards as the others sample keys.  The eviction lock is
+        // held.  Returns false if no shard has a key the policy may evict.
+        bool evictKey(EvictionPolicy policy)
+        {
+            uint32_t shards = policy == EvictionPolicy::VOLATILE_TTL ? EVICTION_SAMPLES : 1;
+            for (uint32_t i = 0; i < mShards.size(); i++)
+            {
+                Shard &s = mShards[mEvictionShard];
+                mEvictionShard = (mEvictionShard + 1) % uint32_t(mShards.size());
+                if (policy == EvictionPolicy::ALLKEYS_RANDOM)
+                {
+                    if (evictRandom(s))
+                    {
+                        mEvictedKeys++;
+                        return true;
+                    }
+                    continue;
+                }
+                sampleShard(s, policy);
+                if (i + 1 < shards)
+                {
+                    continue;
+                }
+                while (!mEvictionPool.empty())
+                {
+                    std::string key;
+                    key.swap(mEvictionPool.back().mKey);
+                    uint32_t db = mEvictionPool.back().mDatabase;
+                    mEvictionPool.pop_back();
+                    if (evictCandidate(db, key, policy))
+                    {
+                        mEvictedKeys++;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        // The fragmentation ratio compares the pages the allocator holds with the bytes the
+        // stored strings and values actually asked for
+        virtual void memoryInfo(void *userPointer, KVD_dataCallback callback) override final
+        {
+            int64_t keyBytes = mTableBytes.load(std::memory_order_relaxed);
+            slaballocator::SlabStats stats;
+            mAllocator->getStats(stats);
+            uint64_t maxMemory;
+            EvictionPolicy policy;
+            getMaxMemory(maxMemory, policy);
+            std::string info;
+            char scratch[1024];
+            snprintf(scratch, sizeof(scratch),
+                "# Memory\r\n"
+                "used_memory:%llu\r\n"
+                "used_memory_dataset:%llu\r\n"
+                "maxmemory:%llu\r\n"
+                "maxmemory_policy:%s\r\n"
+                "evicted_keys:%llu\r\n"
+                "lazyfree_pending_objects:%llu\r\n"
+                "key_table_bytes:%llu\r\n"
+                "slab_requested_bytes:%llu\r\n"
+                "slab_used_bytes:%llu\r\n"
+                "slab_free_bytes:%llu\r\n"
+                "slab_page_bytes:%llu\r\n"
+                "slab_large_bytes:%llu\r\n"
+                "slab_fragmentation_ratio:%.2f\r\n",
+                (unsigned long long)getUsedMemory(),
+                (unsigned long long)(stats.mRequestedBytes + stats.mLargeBytes),
+                (unsigned long long)maxMemory,
+                getEvictionPolicyName(policy),
+                (unsigned long long)mEvictedKeys.load(std::memory_order_relaxed),
+                (unsigned long long)mLazyFreePending.load(std::memory_order_relaxed),
+                (unsigned long long)keyBytes,
+                (unsigned long long)stats.mRequestedBytes,
+                (unsigned long long)stats.mUsedBytes,
+                (unsigned long long)stats.mFreeBytes,
+                (unsigned long long)stats.mPageBytes,
+                (unsigned long long)stats.mLargeBytes,
+                stats.mRequestedBytes ? double(stats.mPageBytes) / double(stats.mRequestedBytes) : 1.0);
+            info = scratch;
+            // One line for each size class which has any pages, as memcached's 'stats slabs'
+            for (uint32_t i = 0; i < mAllocator->getClassCount(); i++)
+            {
+                slaballocator::SlabClassStats cs;
+                mAllocator->getClassStats(i, cs);
+                if (cs.mPageCount)
+                {
+                    snprintf(scratch, sizeof(scratch), "slab_class_%u:chunk_size=%u,pages=%u,used_chunks=%llu,free_chunks=%llu,requested_bytes=%llu\r\n",
+                        i, cs.mChunkSize, cs.mPageCount,
+                        (unsigned long long)cs.mUsedChunks,
+                        (unsigned long long)cs.mFreeChunks,
+                        (unsigned long long)cs.mRequestedBytes);
+                    info += scratch;
+                }
+            }
+            (*callback)(userPointer, info.c_str(), uint32_t(info.size()));
+        }
+
+        // Building the index of a shard which already has keys sorts all of them under its
+        // write lock
+        virtual bool setKeyIndex(bool enable) override final
+        {
+            for (auto &s : mShards)
+            {
+                s.mLock.lockWrite();
+                if (enable && s.mIndex == nullptr)
+                {
+                    s.mIndex = keyindex::KeyIndex::create();
+                    for (uint32_t i = 0; i < s.mKeys->getSlotCount(); i++)
+                    {
+                        const char *key;
+                        uint32_t keyLen;
+                        void *value;
+                        if (s.mKeys->getSlot(i, key, keyLen, value))
+                        {
+                            s.mIndex->insert(key, keyLen);
+                        }
+                    }
+                }
+                else if (!enable && s.mIndex)
+                {
+                    s.mIndex->release();
+                    s.mIndex = nullptr;
+                }
+                unlockWrite(s);
+            }
+            return true;
+        }
+
+        // Hands a key the scan visits to the caller, unless it has expired or does not match
+        static void scanKey(ScanState &ss, const char *key, uint32_t keyLen)
+        {
+            ss.mSeen++;
+            if (ss.mShard->mExpires->size())
+            {
+                KeyRef k;
+                k.mKey = key;
+                k.mKeyLength = keyLen;
+                k.mHash = keyhashtable::hashKey(key, keyLen);
+                k.mShard = ss.mShard;
+                KeyExpiry *e = ss.mThis->findExpiry(k);
+                if (e && e->mWhen <= ss.mNow)
+                {
+                    return;
+                }
+            }
+            if (ss.mMatch && !ss.mMatch->isMatch(key, keyLen))
+            {
+                return;
+            }
+            ss.mMatched++;
+            if (ss.mKeys)
+            {
+                ss.mKeys->append((const char *)&keyLen, sizeof(keyLen));
+                ss.mKeys->append(key, keyLen);
+            }
+            else if (ss.mCallback)
+            {
+                (*ss.mCallback)(ss.mUserPtr, key, 0);
+            }
+        }
+
+        // Visits every key of the shard, or with the key index only those starting with the prefix
+        static void visitKeys(ScanState &ss, Shard &s, const char *prefix, uint32_t prefixLen)
+        {
+            ss.mShard = &s;
+            if (prefixLen && s.mIndex)
+            {
+                s.mIndex->walk(prefix, prefixLen, nullptr, 0, &ss, [](void *userPtr, const char *key, uint32_t keyLen)
+                {
+                    scanKey(*(ScanState *)userPtr, key, keyLen);
+                    return true;
+                });
+            }
+            else
+            {
+                for (uint32_t i = 0; i < s.mKeys->getSlotCount(); i++)
+                {
+                    const char *key;
+                    uint32_t keyLen;
+                    void *value;
+                    if (s.mKeys->getSlot(i, key, keyLen, value))
+                    {
+                        scanKey(ss, key, keyLen);
+                    }
+                }
+            }
+        }
+
+        // Every shard of the database is read locked while the matching keys are copied out, so
+        // they are all from one moment.  The locks are dropped before the caller sees any of them;
+        // it may send the reply on as it goes without holding up writers.  A pattern with a literal
+        // prefix walks the key index where there is one.
+        virtual void keys(uint32_t db, const char *match, void *userPtr, KVD_keysCallback callback) override final
+        {
+            std::string found;
+            ScanState state;
+            state.mThis = this;
+            state.mUserPtr = userPtr;
+            state.mNow = getTimeMilliseconds();
+            state.mKeys = &found;
+            const char *prefix = nullptr;
+            uint32_t prefixLen = 0;
+            if (match)
+            {
+                state.mMatch = wildcard::WildCard::create(match);
+                prefix = state.mMatch->getPrefix(prefixLen);
+            }
+            for (uint32_t i = 0; i < SHARD_COUNT; i++)
+            {
+                mShards[db * SHARD_COUNT + i].mLock.lockRead();
+            }
+            for (uint32_t i = 0; i < SHARD_COUNT; i++)
+            {
+                visitKeys(state, mShards[db * SHARD_COUNT + i], prefix, prefixLen);
+            }
+            for (uint32_t i = 0; i < SHARD_COUNT; i++)
+            {
+                mShards[db * SHARD_COUNT + i].mLock.unlockRead();
+            }
+            if (state.mMatch)
+            {
+                state.mMatch->release();
+            }
+            (*callback)(userPtr, nullptr, state.mMatched);
+            size_t pos = 0;
+            while (pos < found.size())
+            {
+                uint32_t keyLen;
+                memcpy(&keyLen, &found[pos], sizeof(keyLen));
+                pos += sizeof(keyLen);
+                (*callback)(userPtr, &found[pos], keyLen);
+                pos += keyLen;
+            }
+        }
+
+        // Remembers where a walk of a shard's key index stopped; returns the id the cursor carries
+        // to carry on from there.  Only the last SCAN_RESUME_SLOTS places are kept.
+        uint64_t saveScanResume(uint32_t shard, const std::string &key)
+        {
+            std::lock_guard< std::mutex > lock(mScanResumeLock);
+            // Ids never use more bits than fit above the shard in the cursor, and are never 0
+            uint64_t id = mNextScanResume++;
+            if (mNextScanResume >> (64 - SHARD_BITS))
+            {
+                mNextScanResume = 1;
+            }
+            ScanResume &r = mScanResumes[id % SCAN_RESUME_SLOTS];
+            r.mId = id;
+            r.mShard = shard;
+            r.mKey = key;
+            return id;
+        }
+
+        // Finds the key a walk of this shard should carry on after.  False if the place has since
+        // been forgotten, or the cursor is not one a walk of the shard returned, in which case the
+        // shard is walked again from the start: keys may be returned twice, but none are missed.
+        bool findScanResume(uint64_t id, uint32_t shard, std::string &key)
+        {
+            std::lock_guard< std::mutex > lock(mScanResumeLock);
+            const ScanResume &r = mScanResumes[id % SCAN_RESUME_SLOTS];
+            if (r.mId != id || r.mShard != shard)
+            {
+                return false;
+            }
+            key = r.mKey;
+            return true;
+        }
+
+        // Kept counted as keys are added and deleted
+        virtual void dbSize(uint32_t db, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            (*callback)(true, mKeyCounts[db].load(std::memory_order_relaxed), userPointer);
+        }
+
+        // Returns a list of keys which match this wildcard.  If 'match' is null, then it returns
+        // all keys in the database
+        // The shards are scanned in order, each with its table's own cursor.  The shard goes in
+        // the low bits of the cursor and the table's cursor above it, as Redis's kvstore does
+        // with its per slot dictionaries.  A call stops once 'maxScan' keys have been visited,
+        // or after ten times as many cursor steps, so a sparse table does not make one call walk
+        // all of it.
+        // With the key index on, a pattern which starts with literal characters is scanned
+        // through the index instead, visiting only the keys with that prefix.  A walk which stops
+        // part way through a shard remembers the last key it returned (see saveScanResume), and
+        // the cursor carries the id of that place instead of a table cursor.
+        virtual void scan(uint32_t db, uint64_t cursor,uint32_t maxScan,const char *match,void *userPtr,KVD_scanCallback callback) override final
+        {
+            ScanState state;
+            state.mThis = this;
+            state.mUserPtr = userPtr;
+            state.mCallback = callback;
+            state.mNow = getTimeMilliseconds();
+            const char *prefix = nullptr;
+            uint32_t prefixLen = 0;
+            if (match)
+            {
+                state.mMatch = wildcard::WildCard::create(match);
+                prefix = state.mMatch->getPrefix(prefixLen);
+            }
+            uint32_t shard = uint32_t(cursor & (SHARD_COUNT - 1));
+            uint64_t tableCursor = cursor >> SHARD_BITS;
+            uint64_t steps = uint64_t(maxScan) * 10;
+            while (shard < SHARD_COUNT && state.mSeen < maxScan && steps)
+            {
+                Shard &s = mShards[db * SHARD_COUNT + shard];
+                state.mShard = &s;
+                s.mLock.lockRead();
+                if (prefixLen && s.mIndex)
+                {
+                    std::string after;
+                    bool resume = tableCursor && findScanResume(tableCursor, db * SHARD_COUNT + shard, after);
+                    state.mMaxSeen = maxScan;
+                    state.mResumeKey.clear();
+                    s.mIndex->walk(prefix, prefixLen, resume ? after.c_str() : nullptr, uint32_t(after.size()), &state, [](void *userPtr, const char *key, uint32_t keyLen)
+                    {
+                        ScanState &ss = *(ScanState *)userPtr;
+                        scanKey(ss, key, keyLen);
+                        if (ss.mSeen >= ss.mMaxSeen)
+                        {
+                            ss.mResumeKey.assign(key, keyLen);
+                            return false;
+                        }
+                        return true;
+                    });
+                    tableCursor = state.mResumeKey.empty() ? 0 : saveScanResume(db * SHARD_COUNT + shard, state.mResumeKey);
+                    steps--;
+                }
+                else do
+                {
+                    tableCursor = s.mKeys->scan(tableCursor, &state, [](void *userPtr, const char *key, uint32_t keyLen, void *value)
+                    {
+                        scanKey(*(ScanState *)userPtr, key, keyLen);
+                    });
+                    steps--;
+                } while (tableCursor && state.mSeen < maxScan && steps);
+                s.mLock.unlockRead();
+                if (tableCursor == 0)
+                {
+                    shard++;
+                }
+            }
+            if (state.mMatch)
+            {
+                state.mMatch->release();
+            }
+            // The table's cursor never uses more bits than its group mask, so it fits above the shard
+            (*callback)(userPtr, nullptr, shard == SHARD_COUNT ? 0 : (tableCursor << SHARD_BITS) | shard); // notify call of end of scan operation
+        }
+
+        slaballocator::SlabAllocator    *mAllocator{ nullptr };
+        uint32_t                        mDatabaseCount{ 0 };
+        std::vector< Shard >            mShards;            // SHARD_COUNT for each database
+        std::vector< std::atomic< int64_t > > mKeyCounts;   // Keys in each database's tables
+        std::atomic< int64_t >          mNextCycle{ 0 };    // When pump next runs the expiry and rehash cycles
+        std::atomic_flag                mCycleRunning = ATOMIC_FLAG_INIT;
+        uint32_t                        mExpireShard{ 0 };  // Where the next active expiry cycle starts
+        std::atomic< int64_t >          mTableBytes{ 0 };   // Sum of every shard's mTableBytes
+        std::atomic< uint32_t >         mClock{ 0 };        // Seconds since the epoch, as of the last pump
+        std::atomic< uint64_t >         mMaxMemory{ 0 };
+        std::atomic< EvictionPolicy >   mEvictionPolicy{ EvictionPolicy::NO_EVICTION };
+        std::atomic< uint64_t >         mEvictedKeys{ 0 };
+        std::mutex                      mEvictionLock;      // Held by the thread evicting; guards the pool and the shard it samples next
+        std::vector< EvictionCandidate > mEvictionPool;
+        uint32_t                        mEvictionShard{ 0 };
+        std::mutex                      mScanResumeLock;
+        std::vector< ScanResume >       mScanResumes{ SCAN_RESUME_SLOTS };
+        uint64_t                        mNextScanResume{ 1 };
+        std::thread                     *mLazyFreeThread{ nullptr };
+        std::mutex                      mLazyFreeLock;      // Guards the exit flag; the thread sleeps on it
+        std::condition_variable         mLazyFreeSignal;
+        std::atomic< LazyFreeJob * >    mLazyFreeJobs{ nullptr };   // The lock free stack of jobs waiting
+        bool                            mLazyFreeExit{ false };
+        std::atomic< uint64_t >         mLazyFreePending{ 0 };  // Values, and keys in tables, waiting to be freed
+    };
+
+int64_t getTimeMilliseconds(void)
+{
+    return int64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+static bool isSameName(const char *a, const char *b)
+{
+    while (*a && tolower(uint8_t(*a)) == tolower(uint8_t(*b)))
+    {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static const char *gEvictionPolicyNames[] =
+{
+    "noeviction",
+    "allkeys-lru",
+    "allkeys-lfu",
+    "volatile-ttl",
+    "allkeys-random",
+};
+
+const char *getEvictionPolicyName(EvictionPolicy policy)
+{
+    return gEvictionPolicyNames[int32_t(policy)];
+}
+
+bool getEvictionPolicy(const char *name, EvictionPolicy &policy)
+{
+    for (int32_t i = 0; i < int32_t(sizeof(gEvictionPolicyNames) / sizeof(gEvictionPolicyNames[0])); i++)
+    {
+        if (isSameName(name, gEvictionPolicyNames[i]))
+        {
+            policy = EvictionPolicy(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseMemorySize(const char *text, uint64_t &bytes)
+{
+    char *end;
+    errno = 0;
+    if (!isdigit((uint8_t)text[0]))
+    {
+        return false;
+    }
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno == ERANGE)
+    {
+        return false;
+    }
+    uint64_t unit = 1;
+    if (*end)
+    {
+        static const char *units[] = { "k", "kb", "m", "mb", "g", "gb" };
+        static const uint64_t sizes[] = { 1000, 1024, 1000*1000, 1024*1024, 1000*1000*1000, 1024*1024*1024 };
+        unit = 0;
+        for (uint32_t i = 0; i < 6; i++)
+        {
+            if (isSameName(end, units[i]))
+            {
+                unit = sizes[i];
+            }
+        }
+        if (unit == 0 || value > UINT64_MAX / unit)
+        {
+            return false;
+        }
+    }
+    bytes = uint64_t(value) * unit;
+    return true;
+}
 
 KeyValueDatabase *createKeyValueDatabaseRedis(void);
 
-KeyValueDatabase *KeyValueDatabase::create(Provider p)
+KeyValueDatabase *KeyValueDatabase::create(Provider p, uint32_t databaseCount)
 {
     if (p == IN_MEMORY)
     {
-        auto ret = new KeyValueDatabaseImpl;
+        auto ret = new KeyValueDatabaseImpl(databaseCount);
         return static_cast<KeyValueDatabase *>(ret);
     }
     return createKeyValueDatabaseRedis();
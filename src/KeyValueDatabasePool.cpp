@@ -0,0 +1,178 @@
+#include "KeyValueDatabasePool.h"
+#include "KeyValueDatabase.h"
+
+#include <assert.h>
+#include <chrono>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define RECONNECT_INTERVAL 1000    // Milliseconds between attempts to open missing connections
+
+namespace keyvaluedatabasepool
+{
+
+    class PooledConnection
+    {
+    public:
+        keyvaluedatabase::KeyValueDatabase  *mDatabase{ nullptr };
+        uint32_t                            mClientCount{ 0 };
+    };
+
+    typedef std::vector< PooledConnection > PooledConnectionVector;
+
+    class KeyValueDatabasePoolImpl : public KeyValueDatabasePool
+    {
+    public:
+        KeyValueDatabasePoolImpl(uint32_t connectionCount) : mConnectionCount(connectionCount)
+        {
+            connect();
+        }
+
+        // Opens as many of the missing connections as it can
+        void connect(void)
+        {
+            while (mConnections.size() < mConnectionCount)
+            {
+                PooledConnection pc;
+                pc.mDatabase = keyvaluedatabase::KeyValueDatabase::create(keyvaluedatabase::KeyValueDatabase::REDIS);
+                if (pc.mDatabase == nullptr)
+                {
+                    break;
+                }
+                if (mEventLoop)
+                {
+                    pc.mDatabase->setEventLoop(mEventLoop);
+                }
+                mConnections.push_back(pc);
+            }
+            mNextConnect = std::chrono::steady_clock::now() + std::chrono::milliseconds(RECONNECT_INTERVAL);
+        }
+
+        virtual ~KeyValueDatabasePoolImpl(void)
+        {
+            for (auto &i : mConnections)
+            {
+                i.mDatabase->release();
+            }
+            for (auto &i : mLost)
+            {
+                i.mDatabase->release();
+            }
+        }
+
+        // Takes connections whose server has gone away out of the pool, so they are opened again
+        // like any other missing connection.  One which still has clients is kept aside, failing
+        // their commands, until the last of them releases it.
+        void removeLostConnections(void)
+        {
+            for (size_t i = 0; i < mConnections.size();)
+            {
+                PooledConnection &pc = mConnections[i];
+                if (pc.mDatabase->isConnected())
+                {
+                    i++;
+                    continue;
+                }
+                if (pc.mClientCount)
+                {
+                    mLost.push_back(pc);
+                }
+                else
+                {
+                    pc.mDatabase->release();
+                }
+                mConnections[i] = mConnections.back();
+                mConnections.pop_back();
+            }
+        }
+
+        virtual keyvaluedatabase::KeyValueDatabase *acquireDatabase(void) override final
+        {
+            removeLostConnections();
+            if (mConnections.size() < mConnectionCount && std::chrono::steady_clock::now() >= mNextConnect)
+            {
+                connect();
+            }
+            PooledConnection *best = nullptr;
+            for (auto &i : mConnections)
+            {
+                if (best == nullptr || i.mClientCount < best->mClientCount)
+                {
+                    best = &i;
+                }
+            }
+            if (best == nullptr)
+            {
+                return nullptr;
+            }
+            best->mClientCount++;
+            return best->mDatabase;
+        }
+
+        virtual void releaseDatabase(keyvaluedatabase::KeyValueDatabase *database) override final
+        {
+            for (auto &i : mConnections)
+            {
+                if (i.mDatabase == database)
+                {
+                    assert(i.mClientCount);
+                    i.mClientCount--;
+                    return;
+                }
+            }
+            for (size_t i = 0; i < mLost.size(); i++)
+            {
+                if (mLost[i].mDatabase == database)
+                {
+                    assert(mLost[i].mClientCount);
+                    if (--mLost[i].mClientCount == 0)
+                    {
+                        database->release();
+                        mLost[i] = mLost.back();
+                        mLost.pop_back();
+                    }
+                    return;
+                }
+            }
+        }
+
+        virtual void setEventLoop(eventloop::EventLoop *loop) override final
+        {
+            mEventLoop = loop;
+            for (auto &i : mConnections)
+            {
+                i.mDatabase->setEventLoop(loop);
+            }
+            for (auto &i : mLost)
+            {
+                i.mDatabase->setEventLoop(loop);
+            }
+        }
+
+        virtual uint32_t getConnectionCount(void) const override final
+        {
+            return uint32_t(mConnections.size());
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+        uint32_t                mConnectionCount{ 0 };  // Connections the pool should have
+        PooledConnectionVector  mConnections;
+        PooledConnectionVector  mLost;                  // Dropped connections which clients still hold
+        eventloop::EventLoop    *mEventLoop{ nullptr };
+        std::chrono::steady_clock::time_point   mNextConnect;   // When missing connections may next be tried
+    };
+
+KeyValueDatabasePool *KeyValueDatabasePool::create(uint32_t connectionCount)
+{
+    auto ret = new KeyValueDatabasePoolImpl(connectionCount);
+    return static_cast<KeyValueDatabasePool *>(ret);
+}
+
+}
@@ -1,16 +1,19 @@
 // Implementation of the KeyValueDatabase class that actually just talks to redis
 #include "KeyValueDatabase.h"
 #include "socketchat.h"
-#include "RedisCommandStream.h"
+#include "EventLoop.h"
+#include "RespParser.h"
 #include "SimpleBuffer.h"
-#include "MemoryStream.h"
+#include "itoa_jeaiii.h"
 #include "Wildcard.h"
 
+#include "wplatform.h"
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <queue>
+#include <deque>
 
 #ifdef _MSC_VER
 #pragma warning(disable:4100)
@@ -22,6 +25,7 @@
 #define MAX_COMMAND_STRING (1024*4) // 4k
 #define MAX_TOTAL_MEMORY (1024*1024)*1024	// 1gb
 #define MAX_PENDING_COMMAND_COUNT 256
+#define CONNECT_REPLY_TIMEOUT 1000  // Milliseconds to wait for the server's database count when connecting
 
 
 namespace keyvaluedatabase
@@ -29,16 +33,34 @@ namespace keyvaluedatabase
     enum class RedisCommand : uint32_t
     {
         NONE,
+        CONFIG_GET_DATABASES,
         SELECT,
+        SWAPDB,
+        FLUSHDB,
+        FLUSHALL,
         SET,
         SETNX,
+        EXPIRE,
+        TIME_TO_LIVE,
+        PERSIST,
         EXISTS,
         DEL,
+        UNLINK,
         GET,
         WATCH,
         UNWATCH,
         INCREMENT,
+        INCREMENT_FLOAT,
         SCAN,
+        KEYS,
+        DBSIZE,
+        INFO,
+        LIST_PUSH,
+        LIST_POP,
+        LIST_RANGE,
+        LIST_INDEX,
+        LIST_LENGTH,
+        LIST_TRIM,
     };
 
     class PendingRedisCommand
@@ -49,422 +71,697 @@ namespace keyvaluedatabase
         void            *mCallback;
     };
 
-    class KeyValueDatabaseRedis : public KeyValueDatabase, socketchat::SocketChatCallback
+    class KeyValueDatabaseRedis : public KeyValueDatabase, socketchat::SocketChatFrameCallback, eventloop::EventLoopCallback
     {
     public:
         KeyValueDatabaseRedis(void)
         {
             mSocketChat = socketchat::SocketChat::create("localhost", REDIS_PORT_NUMBER);
             mRedisSendBuffer = simplebuffer::SimpleBuffer::create(MAX_COMMAND_STRING, MAX_TOTAL_MEMORY);
-            mCommandStream = rediscommandstream::RedisCommandStream::create();
+            getServerDatabaseCount();
         }
 
-        virtual ~KeyValueDatabaseRedis(void)
+        // Asks the server how many databases it has, and waits for the answer, so SELECT can be
+        // checked before anything is sent.  If it does not answer in time, Redis's default is
+        // assumed.
+        void getServerDatabaseCount(void)
         {
-            delete mSocketChat;
-            if (mCommandStream)
+            if (mSocketChat == nullptr)
             {
-                mCommandStream->release();
+                return;
             }
+            beginCommand(2, "CONFIG");
+            addArgument("GET");
+            addArgument("databases");
+            addPendingResponse(RedisCommand::CONFIG_GET_DATABASES, nullptr, nullptr);
+            for (uint32_t i = 0; i < CONNECT_REPLY_TIMEOUT && !mPendingRedisCommands.empty(); i++)
+            {
+                service();
+                wplatform::sleepNano(1000 * 1000);
+            }
+        }
+
+        virtual ~KeyValueDatabaseRedis(void)
+        {
+            setEventLoop(nullptr);
+            delete mSocketChat;
             if (mRedisSendBuffer)
             {
                 mRedisSendBuffer->release();
             }
         }
 
-        // Give up a timeslice to the database system
+        // Give up a timeslice to the database system.  Once attached to an event loop the
+        // loop drives the connection, so there is nothing to do here.
         virtual void pump(void) override final
         {
-            if (mSocketChat)
+            if (mEventLoop == nullptr)
             {
-                mSocketChat->poll(this, 0);
-                sendResponses();
+                service();
             }
         }
 
-        virtual void sendResponses(void)
+        virtual void setEventLoop(eventloop::EventLoop *loop) override final
         {
-            uint32_t streamLen;
-            const uint8_t *scan = mRedisSendBuffer->getData(streamLen);	// Get the raw stream of responses
-            if (streamLen)
+            if (mEventLoop && mSocketChat)
+            {
+                mEventLoop->removeSocket(mSocketChat->getSocket());
+                mEventLoop->cancel(this);
+            }
+            mEventLoop = loop;
+            mFlushScheduled = false;
+            if (mEventLoop && mSocketChat)
             {
-                const uint8_t *eof = &scan[streamLen];	// This is the end of the data stream
-                while (scan < eof)
+                mEventLoop->addSocket(mSocketChat->getSocket(), this);
+                if (mRedisSendBuffer->getSize())
                 {
-                    const uint32_t *header = (const uint32_t *)scan;	// Get the header
-                    uint32_t stringLen = header[0];				// Get the length of the API string (JSON response)
-                    if (stringLen == 0)
-                    {
-                    }
-                    else
-                    {
-                        const char *msg = (const char *)&header[1];
-                        mSocketChat->sendText(msg);
-                    }
-                    scan += (stringLen + 1 + sizeof(uint32_t));	// Advance to the next response
+                    scheduleFlush();
                 }
-                mRedisSendBuffer->clear();	// Zero out the response buffer now that we have processed all responses
             }
         }
 
-        virtual void get(const char *key, void *userPointer, KVD_dataCallback callback) override final
+        // The connection to the redis server is ready, or commands were queued during this
+        // iteration of the event loop; read the replies and flush any pending sends
+        virtual void onEvent(uint32_t events) override final
         {
-            assert(callback); // not implemented yet
+            mFlushScheduled = false;
+            service();
+        }
 
-            mSocketChat->sendText("*2");
+        // Hand every command queued since the last flush to the connection as one block, then
+        // send it and read whatever replies have arrived.  Once the server has gone away nothing
+        // queued will be answered, so it all fails straight away.
+        void service(void)
+        {
+            if (mSocketChat)
+            {
+                uint32_t streamLen;
+                const uint8_t *stream = mRedisSendBuffer->getData(streamLen);
+                if (streamLen)
+                {
+                    mSocketChat->sendRaw(stream, streamLen);
+                    mRedisSendBuffer->clear();
+                }
+                mSocketChat->pollFrames(this, 0);
+                if (!isConnected())
+                {
+                    failPendingCommands();
+                }
+            }
+        }
 
-            mSocketChat->sendText("$3");
-            mSocketChat->sendText("GET");
-            initMemoryStream();
-            uint32_t dlen = uint32_t(strlen(key));
-            mOutput << "$";
-            mOutput << dlen;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
+        // Answers every command still waiting on the server with an error, oldest first, as if
+        // the server had sent it.  A callback may queue more commands; they fail too.
+        void failPendingCommands(void)
+        {
+            respparser::RespElement lost;
+            lost.mType = respparser::RespType::ERROR;
+            lost.mData = "ERR connection to redis lost";
+            lost.mLength = uint32_t(strlen(lost.mData));
+            while (!mPendingRedisCommands.empty())
+            {
+                mRedisSendBuffer->clear();
+                receiveFrame(&lost, 1);
+            }
+        }
 
-            mSocketChat->sendText(key);
+        void scheduleFlush(void)
+        {
+            if (mEventLoop && !mFlushScheduled)
+            {
+                mFlushScheduled = true;
+                mEventLoop->schedule(this);
+            }
+        }
 
-            addPendingResponse(RedisCommand::GET, callback, userPointer);
+        // Commands are encoded as RESP arrays of bulk strings straight into the send buffer
+        void beginCommand(uint32_t argc, const char *command)
+        {
+            addHeader('*', argc + 1);
+            addArgument(command);
         }
 
+        void addHeader(char prefix, uint32_t value)
+        {
+            char scratch[16];
+            scratch[0] = prefix;
+            u32toa_jeaiii(value, &scratch[1]);
+            uint32_t len = uint32_t(strlen(scratch));
+            scratch[len] = '\r';
+            scratch[len + 1] = '\n';
+            mRedisSendBuffer->addBuffer(scratch, len + 2);
+        }
 
-        virtual void del(const char *key, void *userPointer, KVD_returnCodeCallback callback) override final
+        void addArgument(const void *data, uint32_t dataLen)
         {
-            assert(callback); // not implemented yet
+            addHeader('$', dataLen);
+            uint8_t *dest = mRedisSendBuffer->confirmCapacity(dataLen + 2);
+            assert(dest);
+            if (!dest) return;
+            memcpy(dest, data, dataLen);
+            dest[dataLen] = '\r';
+            dest[dataLen + 1] = '\n';
+            mRedisSendBuffer->addBuffer(nullptr, dataLen + 2);
+        }
 
-            mSocketChat->sendText("*2");
+        void addArgument(const char *str)
+        {
+            addArgument(str, uint32_t(strlen(str)));
+        }
 
-            mSocketChat->sendText("$3");
-            mSocketChat->sendText("DEL");
-            initMemoryStream();
-            uint32_t dlen = uint32_t(strlen(key));
-            mOutput << "$";
-            mOutput << dlen;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
+        void addArgument(int64_t value)
+        {
+            char scratch[32];
+            i64toa_jeaiii(value, scratch);
+            addArgument(scratch);
+        }
 
-            mSocketChat->sendText(key);
+        virtual void get(uint32_t db, const char *key, void *userPointer, KVD_dataCallback callback) override final
+        {
+            assert(callback); // not implemented yet
+            selectDatabase(db);
+            beginCommand(1, "GET");
+            addArgument(key);
+            addPendingResponse(RedisCommand::GET, callback, userPointer);
+        }
 
+        virtual void del(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            assert(callback); // not implemented yet
+            selectDatabase(db);
+            beginCommand(1, "DEL");
+            addArgument(key);
             addPendingResponse(RedisCommand::DEL, callback, userPointer);
-
         }
 
-
-        virtual void exists(const char *key, void *userPointer, KVD_returnCodeCallback callback) override final
+        virtual void unlink(uint32_t db, uint32_t keyCount, const char **keys, void *userPointer, KVD_returnCodeCallback callback) override final
         {
             assert(callback); // not implemented yet
+            selectDatabase(db);
+            beginCommand(keyCount, "UNLINK");
+            for (uint32_t i = 0; i < keyCount; i++)
+            {
+                addArgument(keys[i]);
+            }
+            addPendingResponse(RedisCommand::UNLINK, callback, userPointer);
+        }
 
-            mSocketChat->sendText("*2");
-
-            mSocketChat->sendText("$6");
-            mSocketChat->sendText("EXISTS");
-
-            initMemoryStream();
-            uint32_t dlen = uint32_t(strlen(key));
-            mOutput << "$";
-            mOutput << dlen;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
-
-            mSocketChat->sendText(key);
-
+        virtual void exists(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            assert(callback); // not implemented yet
+            selectDatabase(db);
+            beginCommand(1, "EXISTS");
+            addArgument(key);
             addPendingResponse(RedisCommand::EXISTS, callback, userPointer);
+        }
 
+        // The connection may be shared by clients with different databases selected, so each
+        // command is preceded by a SELECT whenever it is for a different database than the last
+        void selectDatabase(uint32_t db)
+        {
+            if (db != mSelectedDatabase)
+            {
+                beginCommand(1, "SELECT");
+                addArgument(int64_t(db));
+                addPendingResponse(RedisCommand::SELECT, nullptr, nullptr);
+                mSelectedDatabase = db;
+            }
         }
 
+        virtual uint32_t getDatabaseCount(void) const override final
+        {
+            return mDatabaseCount;
+        }
 
+        virtual void swapDatabases(uint32_t a, uint32_t b, void *userPointer, KVD_standardCallback callback) override final
+        {
+            beginCommand(2, "SWAPDB");
+            addArgument(int64_t(a));
+            addArgument(int64_t(b));
+            addPendingResponse(RedisCommand::SWAPDB, (void *)callback, userPointer);
+        }
 
-        // Initialize the memory stream for the response
-        inline void initMemoryStream(void)
+        // Without ASYNC, Redis flushes synchronously unless its lazyfree-lazy-user-flush is set
+        virtual void flushDatabase(uint32_t db, bool async, void *userPointer, KVD_standardCallback callback) override final
         {
-            mOutput.init(mScratchBuffer, MAX_COMMAND_STRING);
+            selectDatabase(db);
+            beginCommand(async ? 1 : 0, "FLUSHDB");
+            if (async)
+            {
+                addArgument("ASYNC");
+            }
+            addPendingResponse(RedisCommand::FLUSHDB, (void *)callback, userPointer);
         }
 
-        virtual void select (uint32_t index, void *userPointer, KVD_standardCallback callback) override final
+        virtual void flushAll(bool async, void *userPointer, KVD_standardCallback callback) override final
         {
-            assert(callback);
-            // Send the 'SELECT' command to the Redis server and push the response we are waiting for...
-            initMemoryStream();
-            mOutput << "SELECT ";
-            mOutput << index;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
-            addPendingResponse(RedisCommand::SELECT, callback, userPointer);
+            beginCommand(async ? 1 : 0, "FLUSHALL");
+            if (async)
+            {
+                addArgument("ASYNC");
+            }
+            addPendingResponse(RedisCommand::FLUSHALL, (void *)callback, userPointer);
         }
 
-        virtual void set(const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_standardCallback callback) override final
+        virtual void set(uint32_t db, const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_standardCallback callback) override final
         {
             assert(callback); // not implemented yet
+            selectDatabase(db);
+            beginCommand(2, "SET");
+            addArgument(key);
+            addArgument(data, dataLen);
+            addPendingResponse(RedisCommand::SET, callback, userPointer);
+        }
 
-            mSocketChat->sendText("*3");
-
-            mSocketChat->sendText("$3");
-            mSocketChat->sendText("SET");
-
-            initMemoryStream();
-            uint32_t dlen = uint32_t(strlen(key));
-            mOutput << "$";
-            mOutput << dlen;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
-
-            mSocketChat->sendText(key);
-
-            initMemoryStream();
-            mOutput << "$";
-            mOutput << dataLen;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
+        // PSETEX rather than SET with PXAT, which needs Redis 6.2
+        virtual void setExpire(uint32_t db, const char *key, const void *data, uint32_t dataLen, int64_t when, void *userPointer, KVD_standardCallback callback) override final
+        {
+            int64_t ttl = when - getTimeMilliseconds();
+            selectDatabase(db);
+            beginCommand(3, "PSETEX");
+            addArgument(key);
+            addArgument(ttl > 0 ? ttl : int64_t(1));
+            addArgument(data, dataLen);
+            addPendingResponse(RedisCommand::SET, (void *)callback, userPointer);
+        }
 
-            mSocketChat->sendBinary(data, dataLen);
+        virtual void expireAt(uint32_t db, const char *key, int64_t when, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(2, "PEXPIREAT");
+            addArgument(key);
+            addArgument(when);
+            addPendingResponse(RedisCommand::EXPIRE, (void *)callback, userPointer);
+        }
 
+        virtual void timeToLive(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(1, "PTTL");
+            addArgument(key);
+            addPendingResponse(RedisCommand::TIME_TO_LIVE, (void *)callback, userPointer);
+        }
 
-            addPendingResponse(RedisCommand::SET, callback, userPointer);
+        virtual void persist(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(1, "PERSIST");
+            addArgument(key);
+            addPendingResponse(RedisCommand::PERSIST, (void *)callback, userPointer);
         }
 
-        virtual void setnx(const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) override final
+        virtual void setnx(uint32_t db, const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) override final
         {
             assert(callback); // not implemented yet
+            selectDatabase(db);
+            beginCommand(2, "SETNX");
+            addArgument(key);
+            addArgument(data, dataLen);
+            addPendingResponse(RedisCommand::SETNX, callback, userPointer);
+        }
 
-            mSocketChat->sendText("*3");
-
-            mSocketChat->sendText("$5");
-            mSocketChat->sendText("SETNX");
-
-            initMemoryStream();
-            uint32_t dlen = uint32_t(strlen(key));
-            mOutput << "$";
-            mOutput << dlen;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
-
-            mSocketChat->sendText(key);
+        virtual void push(uint32_t db, const char *key, bool toHead, uint32_t valueCount, const void **values, const uint32_t *valueLengths, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(1 + valueCount, toHead ? "LPUSH" : "RPUSH");
+            addArgument(key);
+            for (uint32_t i = 0; i < valueCount; i++)
+            {
+                addArgument(values[i], valueLengths[i]);
+            }
+            addPendingResponse(RedisCommand::LIST_PUSH, (void *)callback, userPointer);
+        }
 
-            initMemoryStream();
-            mOutput << "$";
-            mOutput << dataLen;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
+        virtual void pop(uint32_t db, const char *key, bool fromHead, void *userPointer, KVD_listCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(1, fromHead ? "LPOP" : "RPOP");
+            addArgument(key);
+            addPendingResponse(RedisCommand::LIST_POP, (void *)callback, userPointer);
+        }
 
-            mSocketChat->sendBinary(data, dataLen);
+        virtual void listRange(uint32_t db, const char *key, int64_t start, int64_t stop, void *userPointer, KVD_listCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(3, "LRANGE");
+            addArgument(key);
+            addArgument(start);
+            addArgument(stop);
+            addPendingResponse(RedisCommand::LIST_RANGE, (void *)callback, userPointer);
+        }
 
+        virtual void listIndex(uint32_t db, const char *key, int64_t index, void *userPointer, KVD_listCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(2, "LINDEX");
+            addArgument(key);
+            addArgument(index);
+            addPendingResponse(RedisCommand::LIST_INDEX, (void *)callback, userPointer);
+        }
 
-            addPendingResponse(RedisCommand::SETNX, callback, userPointer);
+        virtual void listLength(uint32_t db, const char *key, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(1, "LLEN");
+            addArgument(key);
+            addPendingResponse(RedisCommand::LIST_LENGTH, (void *)callback, userPointer);
         }
 
+        virtual void listTrim(uint32_t db, const char *key, int64_t start, int64_t stop, void *userPointer, KVD_standardCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(3, "LTRIM");
+            addArgument(key);
+            addArgument(start);
+            addArgument(stop);
+            addPendingResponse(RedisCommand::LIST_TRIM, (void *)callback, userPointer);
+        }
 
-        // append to an existing or new record; returns size of the list or -1 if unable to do a push
-        virtual void push(const char *key, const void *data, uint32_t dataLen, void *userPointer, KVD_returnCodeCallback callback) override final
+        virtual void increment(uint32_t db, const char *key, int64_t v, void *userPointer, KVD_returnCodeCallback callback) override final
         {
-            assert(0); // not implemented yet
+            selectDatabase(db);
+            beginCommand(2, "INCRBY");
+            addArgument(key);
+            addArgument(v);
+            addPendingResponse(RedisCommand::INCREMENT, (void *)callback, userPointer);
         }
 
-        virtual void increment(const char *key, int32_t v, void *userPointer, KVD_returnCodeCallback callback) override final
+        // Enough digits that the server parses back exactly the same long double
+        virtual void incrementFloat(uint32_t db, const char *key, long double v, void *userPointer, KVD_incrementFloatCallback callback) override final
         {
-            char scratch[512];
-            if (v >= 0)
-            {
-                snprintf(scratch,512, "incrby \"%s\" %d", key, v);
-            }
-            else
-            {
-                snprintf(scratch, 512, "decrby \"%s\" %d", key, -v);
-            }
-            mSocketChat->sendText(scratch);
-            addPendingResponse(RedisCommand::INCREMENT, callback, userPointer);
+            char scratch[64];
+            snprintf(scratch, sizeof(scratch), "%.21Lg", v);
+            selectDatabase(db);
+            beginCommand(2, "INCRBYFLOAT");
+            addArgument(key);
+            addArgument(scratch);
+            addPendingResponse(RedisCommand::INCREMENT_FLOAT, (void *)callback, userPointer);
         }
 
         // not use fully implemented
-        virtual void watch(uint32_t keyCount, const char **keys, void *userData, KVD_standardCallback callback) override final
+        virtual void watch(uint32_t db, uint32_t keyCount, const char **keys, void *userData, KVD_standardCallback callback) override final
         {
-            initMemoryStream();
-            mOutput << "*";
-            mOutput << keyCount + 1;
-            mOutput << char(0);
-            mSocketChat->sendText((const char *)mScratchBuffer);
-
-            mSocketChat->sendText("$5");
-            mSocketChat->sendText("WATCH");
-
+            selectDatabase(db);
+            beginCommand(keyCount, "WATCH");
             for (uint32_t i = 0; i < keyCount; i++)
             {
-                const char *key = keys[i];
-                initMemoryStream();
-                uint32_t dlen = uint32_t(strlen(key));
-                mOutput << "$";
-                mOutput << dlen;
-                mOutput << char(0);
-                mSocketChat->sendText((const char *)mScratchBuffer);
-                mSocketChat->sendText(key);
+                addArgument(keys[i]);
             }
-
             addPendingResponse(RedisCommand::WATCH, callback, userData);
         }
 
         virtual void unwatch(void *userData, KVD_standardCallback callback) override final
         {
-            mSocketChat->sendText("unwatch");
+            beginCommand(0, "UNWATCH");
             addPendingResponse(RedisCommand::UNWATCH, callback, userData);
         }
 
-        virtual void release(void) override final
+        virtual bool setKeyIndex(bool enable) override final
         {
-            delete this;
+            return false;
         }
 
-        bool isValid(void) const
+        // Redis enforces its own maxmemory and evicts for itself, replying to a refused command
+        // with its own out of memory error
+        virtual bool setMaxMemory(uint64_t maxMemory, EvictionPolicy policy) override final
         {
-            return mSocketChat ? true : false;
+            return false;
         }
 
-        void addRedisSend(const char *str)
+        virtual void getMaxMemory(uint64_t &maxMemory, EvictionPolicy &policy) override final
         {
-            uint32_t slen = uint32_t(strlen(str));
-            uint8_t *writeBuffer = mRedisSendBuffer->confirmCapacity(MAX_COMMAND_STRING); // make sure there enough room in the response buffer for both the JSON portion and the binary data blob
-            assert(writeBuffer);
-            if (!writeBuffer) return;
-            uint32_t *header = (uint32_t *)writeBuffer;
-            header[0] = slen;
-            if (slen)
-            {
-                memcpy(&header[1], str, slen + 1);
-            }
-            mRedisSendBuffer->addBuffer(nullptr, slen + 1 + sizeof(uint32_t));
+            maxMemory = 0;
+            policy = EvictionPolicy::NO_EVICTION;
         }
 
-        virtual void receiveBinaryMessage(const void *data, uint32_t dataLen) override final
+        virtual bool freeMemoryIfNeeded(void) override final
         {
-            assert(0); // not yet implemented
+            return true;
         }
 
-        // When we get a message from the Redis server; we parse it and if it's a complete command
-        // we handle the response logic
-        virtual void receiveMessage(const char *data) override final
+        virtual void memoryInfo(void *userPointer, KVD_dataCallback callback) override final
         {
-            uint32_t argc;
-            rediscommandstream::RedisCommand command = mCommandStream->addStream(data, argc);
-            switch (command)
-            {
-                case rediscommandstream::RedisCommand::ERR:
-                    processERR();
-                    break;
-                case rediscommandstream::RedisCommand::OK:
-                    processOK();
-                    break;
-                case rediscommandstream::RedisCommand::NONE:
-                    break;
-                case rediscommandstream::RedisCommand::RETURN_CODE:
-                    processReturnCode();
-                    break;
-                case rediscommandstream::RedisCommand::RETURN_DATA:
-                    processReturnData();
-                    break;
-                default:
-                    assert(0); // not yet implemented!
-                    break;
-            }
-            if (command != rediscommandstream::RedisCommand::NONE)
+            beginCommand(1, "INFO");
+            addArgument("memory");
+            addPendingResponse(RedisCommand::INFO, (void *)callback, userPointer);
+        }
+
+        // The reply still has to be read, so the command stays in the queue without a callback
+        virtual void cancelCallbacks(void *userPointer) override final
+        {
+            for (auto &i : mPendingRedisCommands)
             {
-                mCommandStream->resetAttributes();
+                if (i.mUserPointer == userPointer)
+                {
+                    i.mCallback = nullptr;
+                }
             }
         }
 
-        void processReturnData(void)
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+        virtual bool isConnected(void) const override final
+        {
+            return mSocketChat && mSocketChat->getReadyState() != socketchat::SocketChat::CLOSED;
+        }
+
+        // The redis server sent back something which is not valid RESP; the connection is dropped
+        virtual void receiveProtocolError(const char *error) override final
+        {
+            printf("Redis connection protocol error: %s\n", error);
+        }
+
+        // A complete reply frame from the Redis server.  Replies arrive in the order the commands were
+        // sent, so it belongs to the oldest pending command.  Bulk string payloads are handed on with
+        // their length, so values may contain any bytes at all.
+        virtual void receiveFrame(const respparser::RespElement *elements, uint32_t elementCount) override final
         {
             if (mPendingRedisCommands.empty())
             {
                 assert(0); // got a response we were not expecting!
                 return;
             }
-            PendingRedisCommand prc = mPendingRedisCommands.front();
-            mPendingRedisCommands.pop();
-            switch (prc.mCommand)
-            {
-            case RedisCommand::GET:
+            if (elementCount == 0)
             {
-                KVD_dataCallback callback = (KVD_dataCallback)prc.mCallback;
-                uint32_t dataLen;
-                const char *c = mCommandStream->getCommandString(dataLen);
-                (*callback)(prc.mUserPointer, c, dataLen);
+                return;
             }
-            break;
-            case RedisCommand::SCAN:
-                // Time to return the scan results!
+            PendingRedisCommand prc = mPendingRedisCommands.front();
+            mPendingRedisCommands.pop_front();
+            bool isError = elements[0].mType == respparser::RespType::ERROR || elements[0].mType == respparser::RespType::BULK_ERROR;
+            if (prc.mCommand == RedisCommand::CONFIG_GET_DATABASES)
+            {
+                // An array of the name and the value
+                if (!isError && elementCount == 3 && elements[2].mData)
                 {
-                    KVD_scanCallback callback = (KVD_scanCallback)prc.mCallback;
-                    uint32_t dataLen;
-                    const char *c = mCommandStream->getCommandString(dataLen);
-                    uint32_t index = 0;
-                    if (c)
-                    {
-                        index = atoi(c);
-                    }
-                    uint32_t attributeCount = mCommandStream->getAttributeCount();
-                    for (uint32_t i = 0; i < attributeCount; i++)
+                    uint32_t count = uint32_t(strtoul(elements[2].mData, nullptr, 10));
+                    if (count)
                     {
-                        rediscommandstream::RedisAttribute atr;
-                        const char *result = mCommandStream->getAttribute(i, atr, dataLen);
-                        if (result)
-                        {
-                            (*callback)(prc.mUserPointer, result, 0);
-                        }
+                        mDatabaseCount = count;
                     }
-                    (*callback)(prc.mUserPointer, nullptr, index);
                 }
-                break;
-            default:
-                assert(0); // not implemented yet
-                break;
-            }
-        }
-
-        void processReturnCode(void)
-        {
-            if (mPendingRedisCommands.empty())
-            {
-                assert(0); // got a response we were not expecting!
                 return;
             }
-            PendingRedisCommand prc = mPendingRedisCommands.front();
-            mPendingRedisCommands.pop();
-            switch (prc.mCommand)
+            // Commands sent after a SELECT which failed ran in whichever database the connection
+            // was left on, not the one they were for, so until the next SELECT they fail too
+            respparser::RespElement selectFailed;
+            if (prc.mCommand == RedisCommand::SELECT)
             {
-            case RedisCommand::EXISTS:
-            case RedisCommand::DEL:
-            case RedisCommand::INCREMENT:
-            case RedisCommand::SETNX:
-            {
-                KVD_returnCodeCallback callback = (KVD_returnCodeCallback)prc.mCallback;
-                uint32_t dataLen;
-                const char *c = mCommandStream->getCommandString(dataLen);
-                int32_t value = c ? atoi(c) : -1;
-                (*callback)(true,value, prc.mUserPointer);
+                mSelectFailed = isError;
+                if (isError)
+                {
+                    mSelectedDatabase = UINT32_MAX; // Which database the connection is left on is not known
+                }
             }
-            break;
-            default:
-                assert(0); // not implemented yet
-                break;
+            else if (mSelectFailed)
+            {
+                selectFailed.mType = respparser::RespType::ERROR;
+                selectFailed.mData = "ERR SELECT failed";
+                selectFailed.mLength = uint32_t(strlen(selectFailed.mData));
+                elements = &selectFailed;
+                elementCount = 1;
+                isError = true;
             }
-        }
-
-        void processOK(void)
-        {
-            if (mPendingRedisCommands.empty())
+            const respparser::RespElement &reply = elements[0];
+            if (prc.mCallback == nullptr)
             {
-                assert(0); // got a response we were not expecting!
-                return;
+                return; // the client which sent this command has gone away, or nobody needs the reply
             }
-            PendingRedisCommand prc = mPendingRedisCommands.front();
-            mPendingRedisCommands.pop();
             switch (prc.mCommand)
             {
                 case RedisCommand::SELECT:
+                case RedisCommand::SWAPDB:
+                case RedisCommand::FLUSHDB:
+                case RedisCommand::FLUSHALL:
                 case RedisCommand::SET:
                 case RedisCommand::WATCH:
                 case RedisCommand::UNWATCH:
+                case RedisCommand::LIST_TRIM:
+                    {
+                        KVD_standardCallback callback = (KVD_standardCallback)prc.mCallback;
+                        (*callback)(!isError, prc.mUserPointer);
+                    }
+                    break;
+                case RedisCommand::EXISTS:
+                case RedisCommand::DEL:
+                case RedisCommand::UNLINK:
+                case RedisCommand::SETNX:
+                case RedisCommand::EXPIRE:
+                case RedisCommand::TIME_TO_LIVE:
+                case RedisCommand::PERSIST:
+                case RedisCommand::DBSIZE:
+                    {
+                        KVD_returnCodeCallback callback = (KVD_returnCodeCallback)prc.mCallback;
+                        if (reply.mType == respparser::RespType::INTEGER)
+                        {
+                            (*callback)(true, int64_t(strtoll(reply.mData, nullptr, 10)), prc.mUserPointer);
+                        }
+                        else
+                        {
+                            (*callback)(false, 0, prc.mUserPointer);
+                        }
+                    }
+                    break;
+                case RedisCommand::INCREMENT:
+                    // The server's error text tells an overflow apart from a value which is not an integer
+                    {
+                        KVD_returnCodeCallback callback = (KVD_returnCodeCallback)prc.mCallback;
+                        if (reply.mType == respparser::RespType::INTEGER)
+                        {
+                            (*callback)(true, int64_t(strtoll(reply.mData, nullptr, 10)), prc.mUserPointer);
+                        }
+                        else
+                        {
+                            IncrementError error = IncrementError::NOT_AN_INTEGER;
+                            if (isError && reply.mData && strstr(reply.mData, "overflow"))
+                            {
+                                error = IncrementError::WOULD_OVERFLOW;
+                            }
+                            (*callback)(false, int64_t(error), prc.mUserPointer);
+                        }
+                    }
+                    break;
+                case RedisCommand::INCREMENT_FLOAT:
                     {
-                    KVD_standardCallback callback = (KVD_standardCallback)prc.mCallback;
-                    (*callback)(true, prc.mUserPointer);
+                        KVD_incrementFloatCallback callback = (KVD_incrementFloatCallback)prc.mCallback;
+                        if (reply.mType == respparser::RespType::BULK_STRING)
+                        {
+                            (*callback)(prc.mUserPointer, reply.mData, reply.mLength, IncrementError::NONE);
+                        }
+                        else
+                        {
+                            IncrementError error = IncrementError::NOT_A_FLOAT;
+                            if (isError && reply.mData && strstr(reply.mData, "NaN or Infinity"))
+                            {
+                                error = IncrementError::NOT_FINITE;
+                            }
+                            (*callback)(prc.mUserPointer, nullptr, 0, error);
+                        }
+                    }
+                    break;
+                case RedisCommand::LIST_PUSH:
+                case RedisCommand::LIST_LENGTH:
+                    // An error here is WRONGTYPE; the key holds something other than a list
+                    {
+                        KVD_returnCodeCallback callback = (KVD_returnCodeCallback)prc.mCallback;
+                        if (reply.mType == respparser::RespType::INTEGER)
+                        {
+                            (*callback)(true, int64_t(strtoll(reply.mData, nullptr, 10)), prc.mUserPointer);
+                        }
+                        else
+                        {
+                            (*callback)(false, -1, prc.mUserPointer);
+                        }
+                    }
+                    break;
+                case RedisCommand::LIST_POP:
+                case RedisCommand::LIST_INDEX:
+                case RedisCommand::LIST_RANGE:
+                    // A single element (or nil), or for LRANGE an array of elements
+                    {
+                        KVD_listCallback callback = (KVD_listCallback)prc.mCallback;
+                        if (isError)
+                        {
+                            (*callback)(prc.mUserPointer, -1, 0, nullptr, 0);
+                        }
+                        else if (reply.mType == respparser::RespType::BULK_STRING)
+                        {
+                            (*callback)(prc.mUserPointer, 1, 0, nullptr, 0);
+                            (*callback)(prc.mUserPointer, 1, 0, reply.mData, reply.mLength);
+                        }
+                        else if (reply.mType == respparser::RespType::ARRAY && reply.mCount == (elementCount - 1))
+                        {
+                            int32_t count = int32_t(reply.mCount);
+                            (*callback)(prc.mUserPointer, count, 0, nullptr, 0);
+                            for (uint32_t i = 1; i < elementCount; i++)
+                            {
+                                const respparser::RespElement &e = elements[i];
+                                (*callback)(prc.mUserPointer, count, i - 1, e.mData ? e.mData : "", e.mLength);
+                            }
+                        }
+                        else
+                        {
+                            (*callback)(prc.mUserPointer, 0, 0, nullptr, 0);
+                        }
+                    }
+                    break;
+                case RedisCommand::GET:
+                case RedisCommand::INFO:
+                    {
+                        KVD_dataCallback callback = (KVD_dataCallback)prc.mCallback;
+                        if (reply.mType == respparser::RespType::BULK_STRING)
+                        {
+                            (*callback)(prc.mUserPointer, reply.mData, reply.mLength);
+                        }
+                        else
+                        {
+                            (*callback)(prc.mUserPointer, nullptr, 0);
+                        }
+                    }
+                    break;
+                case RedisCommand::SCAN:
+                    // The reply is a two element array; the next cursor followed by an array of keys
+                    {
+                        KVD_scanCallback callback = (KVD_scanCallback)prc.mCallback;
+                        uint64_t cursor = 0;
+                        if (reply.mType == respparser::RespType::ARRAY && reply.mCount == 2 && elementCount >= 3)
+                        {
+                            cursor = uint64_t(strtoull(elements[1].mData ? elements[1].mData : "0", nullptr, 10));
+                            for (uint32_t i = 3; i < elementCount; i++)
+                            {
+                                if (elements[i].mData)
+                                {
+                                    (*callback)(prc.mUserPointer, elements[i].mData, 0);
+                                }
+                            }
+                        }
+                        (*callback)(prc.mUserPointer, nullptr, cursor);
+                    }
+                    break;
+                case RedisCommand::KEYS:
+                    {
+                        KVD_keysCallback callback = (KVD_keysCallback)prc.mCallback;
+                        uint32_t keyCount = 0;
+                        if (reply.mType == respparser::RespType::ARRAY)
+                        {
+                            for (uint32_t i = 1; i < elementCount; i++)
+                            {
+                                if (elements[i].mData)
+                                {
+                                    keyCount++;
+                                }
+                            }
+                        }
+                        (*callback)(prc.mUserPointer, nullptr, keyCount);
+                        for (uint32_t i = 1; keyCount && i < elementCount; i++)
+                        {
+                            if (elements[i].mData)
+                            {
+                                (*callback)(prc.mUserPointer, elements[i].mData, elements[i].mLength);
+                            }
+                        }
                     }
                     break;
                 default:
@@ -473,36 +770,6 @@ namespace keyvaluedatabase
             }
         }
 
-        void processERR(void)
-        {
-            if (mPendingRedisCommands.empty())
-            {
-                assert(0); // got a response we were not expecting!
-                return;
-            }
-            PendingRedisCommand prc = mPendingRedisCommands.front();
-            mPendingRedisCommands.pop();
-            switch (prc.mCommand)
-            {
-            case RedisCommand::SELECT:
-            case RedisCommand::SET:
-            {
-                KVD_standardCallback callback = (KVD_standardCallback)prc.mCallback;
-                (*callback)(false, prc.mUserPointer);
-            }
-            break;
-            case RedisCommand::INCREMENT:
-            {
-                KVD_returnCodeCallback callback = (KVD_returnCodeCallback)prc.mCallback;
-                (*callback)(false, 0, prc.mUserPointer);
-            }
-                break;
-            default:
-                assert(0); // not implemented yet
-                break;
-            }
-        }
-
 
         void addPendingResponse(RedisCommand rc,void *callback,void *userPtr)
         {
@@ -510,47 +777,63 @@ namespace keyvaluedatabase
             prc.mCommand = rc;
             prc.mCallback = callback;
             prc.mUserPointer = userPtr;
-            mPendingRedisCommands.push(prc);
+            mPendingRedisCommands.push_back(prc);
+            // Every command queued during this event loop iteration goes out together at the end of it
+            scheduleFlush();
         }
 
         // Returns a list of keys which match this wildcard.  If 'match' is null, then it returns
         // all keys in the database
-        virtual void scan(uint32_t cursorPosition,uint32_t maxScan,const char *_match,void *userPtr,KVD_scanCallback callback) override final
+        virtual void scan(uint32_t db, uint64_t cursor,uint32_t maxScan,const char *match,void *userPtr,KVD_scanCallback callback) override final
         {
-            char scratch[512];
-            char count[512];
-            char match[512];
-
-            const char *countStr = "";
-            const char *matchStr = "";
+            selectDatabase(db);
+            beginCommand(1 + (maxScan > 0 ? 2 : 0) + (match ? 2 : 0), "SCAN");
+            char scratch[32];
+            u64toa_jeaiii(cursor, scratch); // Redis's cursors use all 64 bits
+            addArgument(scratch);
             if (maxScan > 0)
             {
-                snprintf(count, 512, " count %d", maxScan);
-                countStr = count;
+                addArgument("COUNT");
+                addArgument(int64_t(maxScan));
             }
-            if (_match)
+            if (match)
             {
-                snprintf(match, 512, " match \"%s\"", _match);
-                matchStr = match;
+                addArgument("MATCH");
+                addArgument(match);
             }
-            snprintf(scratch, 512, "scan %d %s%s", cursorPosition, countStr, matchStr);
-            mSocketChat->sendText(scratch);
             addPendingResponse(RedisCommand::SCAN, callback, userPtr);
         }
 
+        virtual void keys(uint32_t db, const char *match, void *userPtr, KVD_keysCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(1, "KEYS");
+            addArgument(match ? match : "*");
+            addPendingResponse(RedisCommand::KEYS, (void *)callback, userPtr);
+        }
+
+        virtual void dbSize(uint32_t db, void *userPointer, KVD_returnCodeCallback callback) override final
+        {
+            selectDatabase(db);
+            beginCommand(0, "DBSIZE");
+            addPendingResponse(RedisCommand::DBSIZE, (void *)callback, userPointer);
+        }
+
 
-        simplebuffer::SimpleBuffer	            *mRedisSendBuffer{ nullptr };// Where pending responses are stored
-        rediscommandstream::RedisCommandStream  *mCommandStream{ nullptr };
+        simplebuffer::SimpleBuffer	            *mRedisSendBuffer{ nullptr };// Commands queued since the last flush, as RESP
         socketchat::SocketChat                  *mSocketChat{ nullptr };
-        memorystream::MemoryStream              mOutput;
-        uint8_t                                 mScratchBuffer[MAX_COMMAND_STRING];
-        std::queue< PendingRedisCommand >       mPendingRedisCommands;
+        eventloop::EventLoop                    *mEventLoop{ nullptr };
+        bool                                    mFlushScheduled{ false };
+        uint32_t                                mSelectedDatabase{ 0 };    // As of the last command queued on the connection
+        uint32_t                                mDatabaseCount{ KVD_DEFAULT_DATABASES };   // As the server reported when connecting
+        bool                                    mSelectFailed{ false };    // The last SELECT answered failed
+        std::deque< PendingRedisCommand >       mPendingRedisCommands;
     };
 
     KeyValueDatabase *createKeyValueDatabaseRedis(void)
     {
         auto ret = new KeyValueDatabaseRedis;
-        if (!ret->isValid())
+        if (!ret->isConnected())
         {
             delete ret;
             ret = nullptr;
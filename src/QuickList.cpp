@@ -0,0 +1,455 @@
+#include "QuickList.h"
+#include "SlabAllocator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <new>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define NODE_MAX_SIZE (1024*8)  // Elements are packed into a node until it holds this many bytes
+#define NODE_MIN_CAPACITY 64    // A new node starts this small and doubles as it fills, so short lists stay small
+
+namespace quicklist
+{
+
+    class Node
+    {
+    public:
+        uint8_t *getData(void)
+        {
+            return (uint8_t *)(this + 1);
+        }
+
+        const uint8_t *getData(void) const
+        {
+            return (const uint8_t *)(this + 1);
+        }
+
+        Node        *mPrevious{ nullptr };
+        Node        *mNext{ nullptr };
+        uint32_t    mCount{ 0 };        // Number of elements packed in the node
+        uint32_t    mSize{ 0 };         // Bytes of element data in use
+        uint32_t    mCapacity{ 0 };     // Bytes of element data allocated, following the node
+    };
+
+    // Lengths are stored seven bits to a byte with the high bit set on every byte but the last.
+    // The copy after the element holds the same bytes in reverse order, so it can be read from
+    // its end.
+    static uint32_t getLengthSize(uint32_t len)
+    {
+        uint32_t ret = 1;
+        while (len >= 128)
+        {
+            len >>= 7;
+            ret++;
+        }
+        return ret;
+    }
+
+    static uint32_t getElementSize(uint32_t len)
+    {
+        return getLengthSize(len) * 2 + len;
+    }
+
+    static void writeElement(uint8_t *dest, const void *data, uint32_t dataLen)
+    {
+        uint32_t n = getLengthSize(dataLen);
+        uint8_t *trailer = dest + n + dataLen;
+        uint32_t v = dataLen;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint8_t b = uint8_t(v & 0x7F);
+            v >>= 7;
+            if ((i + 1) < n)
+            {
+                b |= 0x80;
+            }
+            dest[i] = b;
+            trailer[n - 1 - i] = b;
+        }
+        memcpy(dest + n, data, dataLen);
+    }
+
+    // Reads the element starting at 'src'; returns its total size
+    static uint32_t readElement(const uint8_t *src, const uint8_t *&data, uint32_t &dataLen)
+    {
+        uint32_t v = 0;
+        uint32_t shift = 0;
+        uint32_t n = 0;
+        for (;;)
+        {
+            uint8_t b = src[n++];
+            v |= uint32_t(b & 0x7F) << shift;
+            shift += 7;
+            if (!(b & 0x80))
+            {
+                break;
+            }
+        }
+        data = src + n;
+        dataLen = v;
+        return n * 2 + v;
+    }
+
+    // Reads the element which ends at 'end'; returns its total size
+    static uint32_t readElementBackwards(const uint8_t *end, const uint8_t *&data, uint32_t &dataLen)
+    {
+        uint32_t v = 0;
+        uint32_t shift = 0;
+        uint32_t n = 0;
+        for (;;)
+        {
+            n++;
+            uint8_t b = *(end - n);
+            v |= uint32_t(b & 0x7F) << shift;
+            shift += 7;
+            if (!(b & 0x80))
+            {
+                break;
+            }
+        }
+        data = end - n - v;
+        dataLen = v;
+        return n * 2 + v;
+    }
+
+    class QuickListImpl : public QuickList
+    {
+    public:
+        QuickListImpl(slaballocator::SlabAllocator *allocator) : mAllocator(allocator)
+        {
+        }
+
+        virtual ~QuickListImpl(void)
+        {
+            Node *n = mHead;
+            while (n)
+            {
+                Node *next = n->mNext;
+                mAllocator->deallocate(n, uint32_t(sizeof(Node)) + n->mCapacity);
+                n = next;
+            }
+        }
+
+        virtual uint32_t push(bool toHead, const void *data, uint32_t dataLen) override final
+        {
+            uint32_t elementSize = getElementSize(dataLen);
+            Node *n = toHead ? mHead : mTail;
+            if (n == nullptr || (n->mSize + elementSize) > NODE_MAX_SIZE)
+            {
+                n = allocateNode(elementSize);
+                linkNode(n, toHead);
+            }
+            else if ((n->mSize + elementSize) > n->mCapacity)
+            {
+                n = growNode(n, n->mSize + elementSize);
+            }
+            uint8_t *dest = n->getData();
+            if (toHead)
+            {
+                memmove(dest + elementSize, dest, n->mSize);
+            }
+            else
+            {
+                dest += n->mSize;
+            }
+            writeElement(dest, data, dataLen);
+            n->mSize += elementSize;
+            n->mCount++;
+            mCount++;
+            return mCount;
+        }
+
+        virtual bool pop(bool fromHead) override final
+        {
+            if (mCount == 0)
+            {
+                return false;
+            }
+            if (fromHead)
+            {
+                removeFromHead(1);
+            }
+            else
+            {
+                removeFromTail(1);
+            }
+            return true;
+        }
+
+        virtual uint32_t size(void) const override final
+        {
+            return mCount;
+        }
+
+        virtual bool getElement(int64_t index, const void *&data, uint32_t &dataLen) const override final
+        {
+            if (index < 0)
+            {
+                index += mCount;
+            }
+            if (index < 0 || index >= int64_t(mCount))
+            {
+                return false;
+            }
+            const uint8_t *element;
+            uint32_t i = uint32_t(index);
+            if (i < mCount / 2)
+            {
+                uint32_t offset;
+                const Node *n = findFromHead(i, offset);
+                readElement(n->getData() + offset, element, dataLen);
+            }
+            else
+            {
+                // Count back from the end of the tail
+                uint32_t back = mCount - 1 - i;
+                const Node *n = mTail;
+                while (back >= n->mCount)
+                {
+                    back -= n->mCount;
+                    n = n->mPrevious;
+                }
+                const uint8_t *end = n->getData() + n->mSize;
+                for (;;)
+                {
+                    end -= readElementBackwards(end, element, dataLen);
+                    if (back == 0)
+                    {
+                        break;
+                    }
+                    back--;
+                }
+            }
+            data = element;
+            return true;
+        }
+
+        virtual void forEach(uint32_t start, uint32_t count, void *userPtr, QL_elementCallback callback) const override final
+        {
+            assert((uint64_t(start) + count) <= mCount);
+            if (count == 0)
+            {
+                return;
+            }
+            uint32_t offset;
+            const Node *n = findFromHead(start, offset);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                if (offset == n->mSize)
+                {
+                    n = n->mNext;
+                    offset = 0;
+                }
+                const uint8_t *data;
+                uint32_t dataLen;
+                offset += readElement(n->getData() + offset, data, dataLen);
+                (*callback)(userPtr, i, data, dataLen);
+            }
+        }
+
+        virtual void trim(uint32_t start, uint32_t count) override final
+        {
+            assert((uint64_t(start) + count) <= mCount);
+            removeFromTail(mCount - start - count);
+            removeFromHead(start);
+        }
+
+        virtual uint64_t getMemoryUsed(void) const override final
+        {
+            return mMemoryUsed;
+        }
+
+        virtual void release(void) override final
+        {
+            slaballocator::SlabAllocator *allocator = mAllocator;
+            this->~QuickListImpl();
+            allocator->deallocate(this, uint32_t(sizeof(QuickListImpl)));
+        }
+
+    private:
+        // Finds the node holding element 'index', and the offset of the element within it
+        const Node *findFromHead(uint32_t index, uint32_t &offset) const
+        {
+            const Node *n = mHead;
+            while (index >= n->mCount)
+            {
+                index -= n->mCount;
+                n = n->mNext;
+            }
+            offset = 0;
+            const uint8_t *data = n->getData();
+            for (uint32_t i = 0; i < index; i++)
+            {
+                const uint8_t *element;
+                uint32_t elementLen;
+                offset += readElement(data + offset, element, elementLen);
+            }
+            return n;
+        }
+
+        Node *allocateNode(uint32_t minCapacity)
+        {
+            uint32_t capacity = minCapacity < NODE_MIN_CAPACITY ? NODE_MIN_CAPACITY : minCapacity;
+            Node *n = (Node *)mAllocator->allocate(uint32_t(sizeof(Node)) + capacity);
+            new (n) Node;
+            n->mCapacity = capacity;
+            mMemoryUsed += sizeof(Node) + capacity;
+            return n;
+        }
+
+        // Doubles the node's capacity (at least to 'minCapacity', at most to the node size limit).
+        // The node may move.
+        Node *growNode(Node *n, uint32_t minCapacity)
+        {
+            uint32_t capacity = n->mCapacity * 2;
+            if (capacity > NODE_MAX_SIZE)
+            {
+                capacity = NODE_MAX_SIZE;
+            }
+            if (capacity < minCapacity)
+            {
+                capacity = minCapacity;
+            }
+            mMemoryUsed += capacity - n->mCapacity;
+            Node *grown = (Node *)mAllocator->allocate(uint32_t(sizeof(Node)) + capacity);
+            memcpy(grown, n, sizeof(Node) + n->mSize);
+            mAllocator->deallocate(n, uint32_t(sizeof(Node)) + n->mCapacity);
+            n = grown;
+            n->mCapacity = capacity;
+            if (n->mPrevious)
+            {
+                n->mPrevious->mNext = n;
+            }
+            else
+            {
+                mHead = n;
+            }
+            if (n->mNext)
+            {
+                n->mNext->mPrevious = n;
+            }
+            else
+            {
+                mTail = n;
+            }
+            return n;
+        }
+
+        void linkNode(Node *n, bool atHead)
+        {
+            if (atHead)
+            {
+                n->mNext = mHead;
+                if (mHead)
+                {
+                    mHead->mPrevious = n;
+                }
+                mHead = n;
+                if (mTail == nullptr)
+                {
+                    mTail = n;
+                }
+            }
+            else
+            {
+                n->mPrevious = mTail;
+                if (mTail)
+                {
+                    mTail->mNext = n;
+                }
+                mTail = n;
+                if (mHead == nullptr)
+                {
+                    mHead = n;
+                }
+            }
+        }
+
+        void freeNode(Node *n)
+        {
+            if (n->mPrevious)
+            {
+                n->mPrevious->mNext = n->mNext;
+            }
+            else
+            {
+                mHead = n->mNext;
+            }
+            if (n->mNext)
+            {
+                n->mNext->mPrevious = n->mPrevious;
+            }
+            else
+            {
+                mTail = n->mPrevious;
+            }
+            mCount -= n->mCount;
+            mMemoryUsed -= sizeof(Node) + n->mCapacity;
+            mAllocator->deallocate(n, uint32_t(sizeof(Node)) + n->mCapacity);
+        }
+
+        // Whole nodes are freed; a partial node has its remaining elements moved to the front
+        void removeFromHead(uint32_t count)
+        {
+            while (count && count >= mHead->mCount)
+            {
+                count -= mHead->mCount;
+                freeNode(mHead);
+            }
+            if (count)
+            {
+                uint8_t *data = mHead->getData();
+                uint32_t offset = 0;
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    const uint8_t *element;
+                    uint32_t elementLen;
+                    offset += readElement(data + offset, element, elementLen);
+                }
+                memmove(data, data + offset, mHead->mSize - offset);
+                mHead->mSize -= offset;
+                mHead->mCount -= count;
+                mCount -= count;
+            }
+        }
+
+        void removeFromTail(uint32_t count)
+        {
+            while (count && count >= mTail->mCount)
+            {
+                count -= mTail->mCount;
+                freeNode(mTail);
+            }
+            if (count)
+            {
+                const uint8_t *end = mTail->getData() + mTail->mSize;
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    const uint8_t *element;
+                    uint32_t elementLen;
+                    end -= readElementBackwards(end, element, elementLen);
+                }
+                mTail->mSize = uint32_t(end - mTail->getData());
+                mTail->mCount -= count;
+                mCount -= count;
+            }
+        }
+
+        slaballocator::SlabAllocator    *mAllocator{ nullptr };
+        Node        *mHead{ nullptr };
+        Node        *mTail{ nullptr };
+        uint32_t    mCount{ 0 };
+        uint64_t    mMemoryUsed{ 0 };
+    };
+
+QuickList *QuickList::create(slaballocator::SlabAllocator *allocator)
+{
+    auto ret = new (allocator->allocate(uint32_t(sizeof(QuickListImpl)))) QuickListImpl(allocator);
+    return static_cast<QuickList *>(ret);
+}
+
+}
@@ -1,6 +1,7 @@
 #include "RedisCommandStream.h"
 #include "StringId.h"			// Helper class to made a string to an id/enum and back very quickly
 #include "SimpleBuffer.h"
+#include "RespParser.h"
 #include <assert.h>
 
 #ifdef _MSC_VER
@@ -11,6 +12,7 @@
 #define MAX_TOTAL_MEMORY (1024*1024)*1024	// 1gb
 
 #define DEFAULT_ARG_COUNT 256   // Default number of arguments we will accumulate
+#define MAX_KEYWORD_LENGTH 32   // No command or attribute name is longer than this; longer arguments are never looked up
 
 namespace rediscommandstream
 {
@@ -524,6 +526,57 @@ public:
         return ret;
     }
 
+    virtual RedisCommand addFrame(const respparser::RespElement *elements, uint32_t elementCount, uint32_t &argc) override final
+    {
+        resetAttributes();
+        argc = 0;
+        if (elementCount && elements[0].mType == respparser::RespType::ARRAY)
+        {
+            // A command is a flat array; anything nested is not something we can process
+            if (elements[0].mCount != (elementCount - 1))
+            {
+                return RedisCommand::NONE;
+            }
+            elements++;
+            elementCount--;
+        }
+        while (mMaxArgs < elementCount)
+        {
+            growArguments();
+        }
+        for (uint32_t i = 0; i < elementCount; i++)
+        {
+            const respparser::RespElement &e = elements[i];
+            if (e.mData == nullptr)
+            {
+                resetAttributes();
+                return RedisCommand::NONE;
+            }
+            RedisArgument &arg = mArguments[i];
+            arg.mData = (uint8_t *)e.mData;
+            arg.mDataLen = e.mLength;
+            if (i == 0)
+            {
+                arg.mCommand = e.mLength <= MAX_KEYWORD_LENGTH ? getCommand(e.mData) : RedisCommand::NONE;
+            }
+            else
+            {
+                arg.mAttribute = e.mLength <= MAX_KEYWORD_LENGTH ? getAttribute(e.mData) : RedisAttribute::NONE;
+                if (arg.mAttribute == RedisAttribute::NONE)
+                {
+                    arg.mAttribute = RedisAttribute::ASCIIZ;
+                }
+            }
+        }
+        mArgumentCount = elementCount;
+        if (elementCount == 0)
+        {
+            return RedisCommand::NONE;
+        }
+        argc = elementCount - 1;
+        return mArguments[0].mCommand;
+    }
+
     // Returns a pointer to a specific argument, null of it doesn't exist.
     // 'atr' is the type of attribute this is, string, binary data, or a specific known attribute type.
     // 'dataLen' is the length in bytes of this attribute.  Strings will always be zero byte terminated for
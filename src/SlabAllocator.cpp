@@ -0,0 +1,338 @@
+#include "SlabAllocator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4100)
+#endif
+
+#define MIN_PAGE_SIZE (64*1024)     // A size class's first page; each page after it is twice the size, up to the maximum
+#define MAX_PAGE_SIZE (1024*1024)
+#define MIN_CHUNK_SIZE 16
+#define MAX_CHUNK_SIZE (16*1024)    // Larger blocks are passed through to malloc
+#define CHUNK_ALIGNMENT 8
+#define MAX_CLASSES 48
+#define CACHE_COUNT 16              // Threads beyond this many share caches
+#define CACHE_CHUNKS 32             // Most chunks a thread cache holds for one size class
+#define CACHE_BYTES (64*1024)       // Large size classes cache fewer chunks, so free memory is not stranded in the caches
+
+namespace slaballocator
+{
+
+    // The size class's shared state; free chunks are linked through their first bytes
+    class SlabClass
+    {
+    public:
+        std::mutex              mLock;
+        uint32_t                mChunkSize{ 0 };
+        uint32_t                mCacheCapacity{ 0 };    // Chunks of this size a thread cache may hold
+        void                    *mFreeList{ nullptr };
+        uint64_t                mFreeCount{ 0 };
+        uint8_t                 *mPageCursor{ nullptr };// The next chunk to carve from the newest page
+        uint32_t                mPageRemaining{ 0 };    // Chunks left to carve from the newest page
+        uint32_t                mPageSize{ MIN_PAGE_SIZE };
+        uint64_t                mPageBytes{ 0 };        // Bytes of every page allocated so far
+        std::vector< void * >   mPages;
+    };
+
+    class CacheClass
+    {
+    public:
+        uint32_t    mCount{ 0 };
+        void        *mChunks[CACHE_CHUNKS];
+        // Allocations and frees made through this cache.  A chunk may be freed by a different
+        // thread than the one which allocated it, so only the sum over every cache is meaningful.
+        int64_t     mUsedChunks{ 0 };
+        int64_t     mRequestedBytes{ 0 };
+    };
+
+    // A thread's cache.  Its lock is almost never contended; it only matters when more threads
+    // than caches share one, or while statistics are gathered.
+    class ThreadCache
+    {
+    public:
+        void lock(void)
+        {
+            while (mLock.test_and_set(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        void unlock(void)
+        {
+            mLock.clear(std::memory_order_release);
+        }
+
+        // Only changed with the lock held, but read without it, so the total can be taken on every
+        // command without locking every cache
+        void addUsedBytes(int64_t bytes)
+        {
+            mUsedBytes.store(mUsedBytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+        }
+
+        std::atomic_flag    mLock = ATOMIC_FLAG_INIT;
+        std::atomic< int64_t > mUsedBytes{ 0 }; // Chunk and large block bytes allocated through this cache, less those freed
+        int64_t             mLargeBytes{ 0 };
+        int64_t             mLargeCount{ 0 };
+        CacheClass          mClasses[MAX_CLASSES];
+    };
+
+    // Threads are numbered in the order they first allocate
+    static uint32_t getThreadIndex(void)
+    {
+        static std::atomic< uint32_t > gThreadCount{ 0 };
+        static thread_local uint32_t tThreadIndex = gThreadCount++;
+        return tThreadIndex;
+    }
+
+    class SlabAllocatorImpl : public SlabAllocator
+    {
+    public:
+        SlabAllocatorImpl(void)
+        {
+            // Each size is about 25% larger than the one before, as memcached's default growth factor
+            uint32_t size = MIN_CHUNK_SIZE;
+            for (;;)
+            {
+                assert(mClassCount < MAX_CLASSES);
+                SlabClass &sc = mClasses[mClassCount++];
+                sc.mChunkSize = size;
+                uint32_t capacity = CACHE_BYTES / size;
+                sc.mCacheCapacity = capacity > CACHE_CHUNKS ? CACHE_CHUNKS : (capacity < 2 ? 2 : capacity);
+                if (size == MAX_CHUNK_SIZE)
+                {
+                    break;
+                }
+                size = (size + size / 4 + CHUNK_ALIGNMENT - 1) & ~uint32_t(CHUNK_ALIGNMENT - 1);
+                if (size > MAX_CHUNK_SIZE)
+                {
+                    size = MAX_CHUNK_SIZE;
+                }
+            }
+            // Every multiple of the alignment maps straight to the smallest class which holds it
+            uint32_t c = 0;
+            for (uint32_t i = 0; i <= MAX_CHUNK_SIZE / CHUNK_ALIGNMENT; i++)
+            {
+                while (mClasses[c].mChunkSize < i * CHUNK_ALIGNMENT)
+                {
+                    c++;
+                }
+                mClassIndex[i] = uint8_t(c);
+            }
+        }
+
+        virtual ~SlabAllocatorImpl(void)
+        {
+            for (uint32_t i = 0; i < mClassCount; i++)
+            {
+                for (auto &p : mClasses[i].mPages)
+                {
+                    free(p);
+                }
+            }
+        }
+
+        virtual void *allocate(uint32_t size) override final
+        {
+            ThreadCache &t = getCache();
+            if (size > MAX_CHUNK_SIZE)
+            {
+                t.lock();
+                t.mLargeBytes += size;
+                t.mLargeCount++;
+                t.addUsedBytes(size);
+                t.unlock();
+                return malloc(size);
+            }
+            uint32_t c = mClassIndex[(size + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT];
+            t.lock();
+            CacheClass &cc = t.mClasses[c];
+            if (cc.mCount == 0)
+            {
+                refill(mClasses[c], cc);
+            }
+            void *ret = cc.mChunks[--cc.mCount];
+            cc.mUsedChunks++;
+            cc.mRequestedBytes += size;
+            t.addUsedBytes(mClasses[c].mChunkSize);
+            t.unlock();
+            return ret;
+        }
+
+        virtual void deallocate(void *p, uint32_t size) override final
+        {
+            if (p == nullptr)
+            {
+                return;
+            }
+            ThreadCache &t = getCache();
+            if (size > MAX_CHUNK_SIZE)
+            {
+                free(p);
+                t.lock();
+                t.mLargeBytes -= size;
+                t.mLargeCount--;
+                t.addUsedBytes(-int64_t(size));
+                t.unlock();
+                return;
+            }
+            uint32_t c = mClassIndex[(size + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT];
+            SlabClass &sc = mClasses[c];
+            t.lock();
+            CacheClass &cc = t.mClasses[c];
+            if (cc.mCount == sc.mCacheCapacity)
+            {
+                drain(sc, cc, sc.mCacheCapacity / 2);
+            }
+            cc.mChunks[cc.mCount++] = p;
+            cc.mUsedChunks--;
+            cc.mRequestedBytes -= size;
+            t.addUsedBytes(-int64_t(sc.mChunkSize));
+            t.unlock();
+        }
+
+        virtual void getStats(SlabStats &stats) override final
+        {
+            stats = SlabStats();
+            for (uint32_t i = 0; i < mClassCount; i++)
+            {
+                SlabClassStats cs;
+                getClassStats(i, cs);
+                stats.mRequestedBytes += cs.mRequestedBytes;
+                stats.mUsedBytes += cs.mUsedChunks * cs.mChunkSize;
+                stats.mFreeBytes += cs.mFreeChunks * cs.mChunkSize;
+                stats.mPageBytes += cs.mPageBytes;
+            }
+            int64_t largeBytes = 0;
+            int64_t largeCount = 0;
+            for (auto &t : mCaches)
+            {
+                t.lock();
+                largeBytes += t.mLargeBytes;
+                largeCount += t.mLargeCount;
+                t.unlock();
+            }
+            stats.mLargeBytes = uint64_t(largeBytes);
+            stats.mLargeCount = uint64_t(largeCount);
+        }
+
+        virtual uint64_t getUsedBytes(void) const override final
+        {
+            int64_t ret = 0;
+            for (auto &t : mCaches)
+            {
+                ret += t.mUsedBytes.load(std::memory_order_relaxed);
+            }
+            return ret > 0 ? uint64_t(ret) : 0;
+        }
+
+        virtual uint32_t getClassCount(void) const override final
+        {
+            return mClassCount;
+        }
+
+        virtual void getClassStats(uint32_t index, SlabClassStats &stats) override final
+        {
+            stats = SlabClassStats();
+            if (index >= mClassCount)
+            {
+                return;
+            }
+            int64_t usedChunks = 0;
+            int64_t requestedBytes = 0;
+            uint64_t cachedChunks = 0;
+            for (auto &t : mCaches)
+            {
+                t.lock();
+                const CacheClass &cc = t.mClasses[index];
+                usedChunks += cc.mUsedChunks;
+                requestedBytes += cc.mRequestedBytes;
+                cachedChunks += cc.mCount;
+                t.unlock();
+            }
+            SlabClass &sc = mClasses[index];
+            sc.mLock.lock();
+            stats.mChunkSize = sc.mChunkSize;
+            stats.mPageCount = uint32_t(sc.mPages.size());
+            stats.mPageBytes = sc.mPageBytes;
+            stats.mFreeChunks = sc.mFreeCount + cachedChunks;
+            sc.mLock.unlock();
+            stats.mUsedChunks = uint64_t(usedChunks);
+            stats.mRequestedBytes = uint64_t(requestedBytes);
+        }
+
+        virtual void release(void) override final
+        {
+            delete this;
+        }
+
+    private:
+        ThreadCache &getCache(void)
+        {
+            return mCaches[getThreadIndex() % CACHE_COUNT];
+        }
+
+        // Fills half of the cache from the size class's free chunks, carving new ones from a
+        // page when there are not enough.  The cache's lock is held.
+        void refill(SlabClass &sc, CacheClass &cc)
+        {
+            uint32_t count = sc.mCacheCapacity / 2;
+            std::lock_guard< std::mutex > lock(sc.mLock);
+            while (cc.mCount < count && sc.mFreeList)
+            {
+                void *chunk = sc.mFreeList;
+                memcpy(&sc.mFreeList, chunk, sizeof(void *));
+                sc.mFreeCount--;
+                cc.mChunks[cc.mCount++] = chunk;
+            }
+            while (cc.mCount < count)
+            {
+                if (sc.mPageRemaining == 0)
+                {
+                    sc.mPageCursor = (uint8_t *)malloc(sc.mPageSize);
+                    sc.mPageRemaining = sc.mPageSize / sc.mChunkSize;
+                    sc.mPages.push_back(sc.mPageCursor);
+                    sc.mPageBytes += sc.mPageSize;
+                    if (sc.mPageSize < MAX_PAGE_SIZE)
+                    {
+                        sc.mPageSize *= 2;
+                    }
+                }
+                cc.mChunks[cc.mCount++] = sc.mPageCursor;
+                sc.mPageCursor += sc.mChunkSize;
+                sc.mPageRemaining--;
+            }
+        }
+
+        // Returns chunks from the cache to the size class.  The cache's lock is held.
+        void drain(SlabClass &sc, CacheClass &cc, uint32_t count)
+        {
+            std::lock_guard< std::mutex > lock(sc.mLock);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                void *chunk = cc.mChunks[--cc.mCount];
+                memcpy(chunk, &sc.mFreeList, sizeof(void *));
+                sc.mFreeList = chunk;
+                sc.mFreeCount++;
+            }
+        }
+
+        uint32_t        mClassCount{ 0 };
+        uint8_t         mClassIndex[MAX_CHUNK_SIZE / CHUNK_ALIGNMENT + 1];  // Size class for each multiple of the alignment
+        SlabClass       mClasses[MAX_CLASSES];
+        ThreadCache     mCaches[CACHE_COUNT];
+    };
+
+SlabAllocator *SlabAllocator::create(void)
+{
+    auto ret = new SlabAllocatorImpl;
+    return static_cast<SlabAllocator *>(ret);
+}
+
+}
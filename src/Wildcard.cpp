@@ -1,71 +1,128 @@
-#pragma warning(disable:4996)
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <regex>
 #include <string>
+#include <vector>
 
 #include "Wildcard.h"
 
-class RegularExpression;
-
-// Performs a conventional DOS style wildcard compare, with
-// ? and * notation, by converting it into a regular expression match.
+// Follows Redis's stringmatchlen: a '[' with no closing ']' runs to the end of the pattern, a
+// range may be given either way round ('[z-a]'), and a '\' at the very end matches itself.
+//
+// The stars split the pattern into segments, each of which matches a fixed number of
+// characters.  The first segment must match at the start of the string and the last at the end,
+// so 'user:*' is one compare.  The segments in between are found left to right, each as early
+// as it can match; that is never worse than matching later, as the next star can take up any
+// characters in between.  A segment which starts with a literal is searched for with memchr.
 
 namespace wildcard
 {
-        class WildCardImpl : public WildCard
+        enum class Op : uint8_t
+        {
+            LITERAL,    // mLength bytes of mLiterals, from mIndex
+            ANY,        // mLength characters of any value
+            CLASS,      // One character from mClasses[mIndex]
+        };
+
+        class Step
         {
         public:
-            WildCardImpl(const char *wild)
+            Op          mOp{ Op::LITERAL };
+            uint32_t    mIndex{ 0 };
+            uint32_t    mLength{ 0 };   // Characters the step matches
+        };
+
+        // A set of characters, one bit each
+        class CharClass
+        {
+        public:
+            void add(uint8_t c)
             {
-                mIsWild = false;
-                mWild = wild;
+                mBits[c >> 5] |= 1u << (c & 31);
+            }
 
-                // std::regex uses the EMScript standard.
-                std::string expression = std::string("^");
+            bool has(uint8_t c) const
+            {
+                return (mBits[c >> 5] >> (c & 31)) & 1;
+            }
 
-                uint32_t len = (uint32_t)strlen(wild);
+            void invert(void)
+            {
+                for (auto &b : mBits)
+                {
+                    b = ~b;
+                }
+            }
+
+            uint32_t    mBits[8]{};
+        };
+
+        // The steps between two stars (or the start or end of the pattern)
+        class Segment
+        {
+        public:
+            uint32_t    mFirst{ 0 };    // Index of the first step
+            uint32_t    mCount{ 0 };    // Steps
+            uint32_t    mLength{ 0 };   // Characters matched by all of the steps together
+        };
 
-                for (uint32_t i = 0; i < len; i++)
+        class WildCardImpl : public WildCard
+        {
+        public:
+            WildCardImpl(const char *wild)
+            {
+                mSegments.push_back(Segment());
+                const char *p = wild;
+                while (*p)
                 {
-                    switch (wild[i])
+                    switch (*p)
                     {
-                    case '?':
-                        expression += '.'; // regular expression notation.
-                        mIsWild = true;
-                        break;
                     case '*':
-                        expression += std::string(".*");
-                        mIsWild = true;
+                        while (*p == '*')
+                        {
+                            p++;
+                        }
+                        mHasStar = true;
+                        mSegments.push_back(Segment());
+                        mSegments.back().mFirst = uint32_t(mSteps.size());
                         break;
-                    case '.':
-                        expression += '\\';
-                        expression += wild[i];
+                    case '?':
+                        if (mSegments.back().mCount && mSteps.back().mOp == Op::ANY)
+                        {
+                            mSteps.back().mLength++;
+                            mSegments.back().mLength++;
+                        }
+                        else
+                        {
+                            addStep(Op::ANY, 0, 1);
+                        }
+                        p++;
                         break;
-                    case ';':
-                        expression += '|';
-                        mIsWild = true;
+                    case '[':
+                        p = addClass(p + 1);
+                        break;
+                    case '\\':
+                        if (p[1])
+                        {
+                            p++;
+                        }
+                        addLiteral(*p++);
                         break;
                     default:
-                        expression += wild[i];
+                        addLiteral(*p++);
+                        break;
                     }
                 }
-
-                if (mIsWild)
+                mIsWild = mHasStar;
+                for (auto &s : mSteps)
                 {
-                    expression += '$';
-                    mRegEx = new std::regex(expression.c_str(), std::regex_constants::extended);
-                }
-                else
-                {
-                    mRegEx = nullptr;
+                    mIsWild |= s.mOp != Op::LITERAL;
                 }
             }
+
             ~WildCardImpl(void) final
             {
-                delete mRegEx;
             }
 
             void release(void) final
@@ -78,34 +135,197 @@ namespace wildcard
                 return mIsWild;
             } // see if this is a wildcard string.
 
+            const char *getPrefix(uint32_t &len) const final
+            {
+                const Segment &first = mSegments.front();
+                if (first.mCount == 0 || mSteps[first.mFirst].mOp != Op::LITERAL)
+                {
+                    len = 0;
+                    return "";
+                }
+                len = mSteps[first.mFirst].mLength;
+                return &mLiterals[mSteps[first.mFirst].mIndex];
+            }
+
             bool isMatch(const char *test) const final
             {
-                bool ret = false;
+                return test && isMatch(test, uint32_t(strlen(test)));
+            }
+
+            bool isMatch(const char *test, uint32_t len) const final
+            {
+                const Segment &first = mSegments.front();
+                if (!mHasStar)
+                {
+                    return len == first.mLength && matchSegment(first, test);
+                }
+                const Segment &last = mSegments.back();
+                if (len < first.mLength + last.mLength || !matchSegment(first, test) || !matchSegment(last, test + len - last.mLength))
+                {
+                    return false;
+                }
+                const char *p = test + first.mLength;
+                const char *end = test + len - last.mLength;
+                for (size_t i = 1; i + 1 < mSegments.size(); i++)
+                {
+                    p = findSegment(mSegments[i], p, end);
+                    if (p == nullptr)
+                    {
+                        return false;
+                    }
+                    p += mSegments[i].mLength;
+                }
+                return true;
+            }
+
+        private:
+            void addStep(Op op, uint32_t index, uint32_t length)
+            {
+                Step s;
+                s.mOp = op;
+                s.mIndex = index;
+                s.mLength = length;
+                mSteps.push_back(s);
+                mSegments.back().mCount++;
+                mSegments.back().mLength += length;
+            }
 
-                if (test)
+            void addLiteral(char c)
+            {
+                if (mSegments.back().mCount && mSteps.back().mOp == Op::LITERAL)
                 {
-                    if (mIsWild)
+                    mSteps.back().mLength++;
+                    mSegments.back().mLength++;
+                }
+                else
+                {
+                    addStep(Op::LITERAL, uint32_t(mLiterals.size()), 1);
+                }
+                mLiterals += c;
+            }
+
+            // 'p' is just past the '['; returns the position just past the closing ']'
+            const char *addClass(const char *p)
+            {
+                CharClass cc;
+                bool negate = *p == '^';
+                if (negate)
+                {
+                    p++;
+                }
+                while (*p && *p != ']')
+                {
+                    if (*p == '\\' && p[1])
+                    {
+                        p++;
+                        cc.add(uint8_t(*p));
+                    }
+                    else if (p[1] == '-' && p[2])
                     {
-                        if(std::regex_match(test, *mRegEx))
+                        uint8_t start = uint8_t(p[0]);
+                        uint8_t end = uint8_t(p[2]);
+                        if (start > end)
                         {
-                            ret = true;
+                            uint8_t swap = start;
+                            start = end;
+                            end = swap;
                         }
+                        for (uint32_t c = start; c <= end; c++)
+                        {
+                            cc.add(uint8_t(c));
+                        }
+                        p += 2;
                     }
                     else
                     {
-                        if (strcmp(test, mWild.c_str()) == 0)
+                        cc.add(uint8_t(*p));
+                    }
+                    p++;
+                }
+                if (*p == ']')
+                {
+                    p++;
+                }
+                if (negate)
+                {
+                    cc.invert();
+                }
+                addStep(Op::CLASS, uint32_t(mClasses.size()), 1);
+                mClasses.push_back(cc);
+                return p;
+            }
+
+            // The string has at least the segment's length left
+            bool matchSegment(const Segment &seg, const char *str) const
+            {
+                for (uint32_t i = seg.mFirst; i < seg.mFirst + seg.mCount; i++)
+                {
+                    const Step &s = mSteps[i];
+                    switch (s.mOp)
+                    {
+                    case Op::LITERAL:
+                        if (memcmp(str, &mLiterals[s.mIndex], s.mLength) != 0)
                         {
-                            ret = true;
+                            return false;
                         }
+                        break;
+                    case Op::ANY:
+                        break;
+                    case Op::CLASS:
+                        if (!mClasses[s.mIndex].has(uint8_t(*str)))
+                        {
+                            return false;
+                        }
+                        break;
                     }
+                    str += s.mLength;
                 }
-                return ret;
+                return true;
             }
 
-        private:
-            std::regex             *mRegEx;
-            bool                    mIsWild;
-            std::string             mWild;
+            // The earliest position from 'p' where the segment matches and ends by 'end'
+            const char *findSegment(const Segment &seg, const char *p, const char *end) const
+            {
+                if (uint32_t(end - p) < seg.mLength)
+                {
+                    return nullptr;
+                }
+                const char *last = end - seg.mLength;
+                const Step &s = mSteps[seg.mFirst];
+                if (s.mOp == Op::LITERAL)
+                {
+                    char c = mLiterals[s.mIndex];
+                    while (p <= last)
+                    {
+                        p = (const char *)memchr(p, c, size_t(last - p) + 1);
+                        if (p == nullptr)
+                        {
+                            return nullptr;
+                        }
+                        if (matchSegment(seg, p))
+                        {
+                            return p;
+                        }
+                        p++;
+                    }
+                    return nullptr;
+                }
+                for (; p <= last; p++)
+                {
+                    if (matchSegment(seg, p))
+                    {
+                        return p;
+                    }
+                }
+                return nullptr;
+            }
+
+            bool                    mIsWild{ false };
+            bool                    mHasStar{ false };
+            std::vector< Step >     mSteps;
+            std::vector< Segment >  mSegments;  // More than one only if there are stars; they go between the segments
+            std::vector< CharClass > mClasses;
+            std::string             mLiterals;  // The literal characters of every step, one after another
         };
 
         WildCard * WildCard::create(const char *str)
@@ -114,4 +334,4 @@ namespace wildcard
             return static_cast<WildCard *>(ret);
         }
 
-} 
+}